@@ -0,0 +1,165 @@
+/*
+ * AudioBuffer.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  AudioBuffer - planar float sample storage
+
+  Every channel is a contiguous plane, all planes live in one
+  block and start on a 64 byte boundary (the plane stride is
+  rounded up to 16 floats), so the kernels could run unit stride
+  over one channel with aligned vector loads. A interleaved
+  buffer is split once with deinterleave(), view() hand out a
+  read only range of one channel without a copy.
+****************************************************************/
+
+#include <new>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#pragma once
+
+#ifndef AUDIOBUFFER_H
+#define AUDIOBUFFER_H
+
+class AudioBuffer {
+public:
+    static constexpr size_t ALIGN = 64;
+
+    // a range of one channel, no ownership
+    struct View {
+        const float* data;
+        uint32_t frames;
+
+        View slice(uint32_t start, uint32_t count) const {
+            start = std::min(start, frames);
+            return {data + start, std::min(count, frames - start)};
+        }
+    };
+
+    AudioBuffer() : mem(nullptr), stride(0), chan(0), size(0) {}
+
+    ~AudioBuffer() {
+        release();
+    }
+
+    AudioBuffer(const AudioBuffer&) = delete;
+    AudioBuffer& operator=(const AudioBuffer&) = delete;
+
+    AudioBuffer(AudioBuffer&& o) noexcept : mem(o.mem), stride(o.stride), chan(o.chan), size(o.size) {
+        o.mem = nullptr;
+        o.stride = 0;
+        o.chan = 0;
+        o.size = 0;
+    }
+
+    AudioBuffer& operator=(AudioBuffer&& o) noexcept {
+        if (this != &o) {
+            release();
+            std::swap(mem, o.mem);
+            std::swap(stride, o.stride);
+            std::swap(chan, o.chan);
+            std::swap(size, o.size);
+        }
+        return *this;
+    }
+
+    // room for channels planes of frames frames, the content is undefined
+    bool allocate(uint32_t channels, uint32_t frames) {
+        release();
+        if (!channels || !frames) return false;
+        const size_t s = ((size_t)frames + ALIGN / sizeof(float) - 1) & ~(ALIGN / sizeof(float) - 1);
+        try {
+            mem = static_cast<float*>(::operator new[](s * channels * sizeof(float),
+                                                            std::align_val_t(ALIGN)));
+        } catch (...) {
+            return false;
+        }
+        stride = s;
+        chan = channels;
+        size = frames;
+        return true;
+    }
+
+    // split chan interleaved frames into the planes in one pass
+    bool deinterleave(const float* src, uint32_t frames, uint32_t channels) {
+        if (!src || !allocate(channels, frames)) return false;
+        if (channels == 1) {
+            std::memcpy(mem, src, (size_t)frames * sizeof(float));
+        } else if (channels == 2) {
+            float* l = mem;
+            float* r = mem + stride;
+            for (uint32_t i = 0; i < frames; i++) {
+                l[i] = src[(size_t)i * 2];
+                r[i] = src[(size_t)i * 2 + 1];
+            }
+        } else {
+            for (uint32_t i = 0; i < frames; i++)
+                for (uint32_t c = 0; c < channels; c++)
+                    mem[c * stride + i] = src[(size_t)i * channels + c];
+        }
+        return true;
+    }
+
+    // merge the planes into chan interleaved frames
+    void interleave(float* dst) const {
+        for (uint32_t i = 0; i < size; i++)
+            for (uint32_t c = 0; c < chan; c++)
+                dst[(size_t)i * chan + c] = mem[c * stride + i];
+    }
+
+    // keep count frames from start, the planes stay where they are
+    void crop(uint32_t start, uint32_t count) {
+        start = std::min(start, size);
+        count = std::min(count, size - start);
+        if (start)
+            for (uint32_t c = 0; c < chan; c++)
+                std::memmove(mem + c * stride, mem + c * stride + start, (size_t)count * sizeof(float));
+        size = count;
+    }
+
+    void release() {
+        if (mem) ::operator delete[](mem, std::align_val_t(ALIGN));
+        mem = nullptr;
+        stride = 0;
+        chan = 0;
+        size = 0;
+    }
+
+    inline uint32_t channels() const noexcept {
+        return chan;
+    }
+
+    inline uint32_t frames() const noexcept {
+        return size;
+    }
+
+    inline float* channel(uint32_t c) noexcept {
+        return mem + c * stride;
+    }
+
+    inline const float* channel(uint32_t c) const noexcept {
+        return mem + c * stride;
+    }
+
+    inline View view(uint32_t c) const noexcept {
+        return {channel(c), size};
+    }
+
+    inline View view(uint32_t c, uint32_t start, uint32_t count) const noexcept {
+        return view(c).slice(start, count);
+    }
+
+private:
+    float* mem;
+    size_t stride;      // floats from one plane to the next
+    uint32_t chan;
+    uint32_t size;      // frames
+};
+
+#endif
@@ -0,0 +1,351 @@
+/*
+ * AudioCache.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  AudioCache - on-disk cache for decoded (and resampled) audio
+
+  Entries are keyed by the content hash of the source file,
+  the target sample rate and the resampler quality.
+  Each entry is a 64 byte header followed by the raw sample data,
+  so it could be mapped straight into memory.
+  The last access time of a entry is tracked by its modification
+  time, when the cache grows above the size cap the least
+  recently used entries get removed.
+  Next to the audio a entry could hold the analysis (pitch and
+  loudness) of the decoded file, so a library is analysed only once.
+****************************************************************/
+
+#include <filesystem>
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#pragma once
+
+#ifndef AUDIOCACHE_H
+#define AUDIOCACHE_H
+
+class AudioCache {
+public:
+    enum SampleFormat : uint32_t {
+        FLOAT32 = 0,
+        INT16   = 1
+    };
+
+    // the analysis of a decoded file
+    struct Analysis {
+        float frequency = 0.0f;
+        float loudness = 0.0f;      // LUFS
+        float rms = 0.0f;           // dBFS
+        int16_t pitchCorrection = 0;
+        uint8_t rootKey = 0;
+    };
+
+    AudioCache() {
+        maxSize = 1024ull * 1024ull * 1024ull; // 1 GiB
+        const char* xdg = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+        if (xdg && *xdg) cacheDir = std::filesystem::path(xdg) / "sf2generate";
+        else if (home && *home) cacheDir = std::filesystem::path(home) / ".cache" / "sf2generate";
+        else cacheDir = std::filesystem::temp_directory_path() / "sf2generate";
+    }
+
+    ~AudioCache() {}
+
+    // set the directory used to store the cache entries
+    void setDirectory(const std::string& dir) {
+        cacheDir = dir;
+    }
+
+    // set the maximum size (in bytes) the cache could use on disk
+    void setMaxSize(uint64_t bytes) {
+        maxSize = bytes;
+    }
+
+    // FNV-1a 64 bit hash over the file content, return 0 on failure
+    static uint64_t hashFile(const char* file) {
+        std::ifstream in(file, std::ios::binary);
+        if (!in) return 0;
+        uint64_t h = 0xcbf29ce484222325ull;
+        std::vector<char> block(1 << 16);
+        while (in) {
+            in.read(block.data(), block.size());
+            const std::streamsize n = in.gcount();
+            for (std::streamsize i = 0; i < n; i++) {
+                h ^= static_cast<uint8_t>(block[i]);
+                h *= 0x100000001b3ull;
+            }
+        }
+        return h;
+    }
+
+    // load a cache entry into a new allocated float buffer (delete[] by the caller)
+    bool load(uint64_t hash, uint32_t targetRate, uint32_t quality, float** samples,
+                uint32_t* frames, uint32_t* channels, uint32_t* samplerate) {
+        if (!hash) return false;
+        const std::filesystem::path p = entryPath(hash, targetRate, quality);
+        std::error_code ec;
+        const uint64_t fsize = std::filesystem::file_size(p, ec);
+        if (ec || fsize < sizeof(Header)) return false;
+
+        bool ret = false;
+        #if !defined(_WIN32)
+        int fd = open(p.c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        void* map = mmap(nullptr, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (map == MAP_FAILED) return false;
+        madvise(map, fsize, MADV_SEQUENTIAL);
+        ret = readEntry(static_cast<const uint8_t*>(map), fsize, hash, targetRate,
+                                    quality, samples, frames, channels, samplerate);
+        munmap(map, fsize);
+        #else
+        std::vector<uint8_t> buf(fsize);
+        std::ifstream in(p, std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(buf.data()), fsize)) return false;
+        ret = readEntry(buf.data(), fsize, hash, targetRate,
+                                    quality, samples, frames, channels, samplerate);
+        #endif
+        // touch the entry to mark it as recently used
+        if (ret) std::filesystem::last_write_time(p,
+                    std::filesystem::file_time_type::clock::now(), ec);
+        return ret;
+    }
+
+    // store a float buffer as cache entry and evict old entries when needed
+    bool store(uint64_t hash, uint32_t targetRate, uint32_t quality, const float* samples,
+                uint32_t frames, uint32_t channels, uint32_t samplerate) {
+        if (!hash || !samples) return false;
+        const uint64_t dataSize = (uint64_t)frames * channels * sizeof(float);
+        if (dataSize + sizeof(Header) > maxSize) return false;
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir, ec);
+        if (ec) {
+            std::cerr << "Warning: could not create cache directory " << cacheDir << std::endl;
+            return false;
+        }
+
+        Header hdr;
+        std::memset(&hdr, 0, sizeof(Header));
+        std::memcpy(hdr.magic, "SFGC", 4);
+        hdr.version = VERSION;
+        hdr.hash = hash;
+        hdr.targetRate = targetRate;
+        hdr.quality = quality;
+        hdr.format = FLOAT32;
+        hdr.channels = channels;
+        hdr.samplerate = samplerate;
+        hdr.frames = frames;
+
+        // write to a temporary file first, so a parallel reader never sees a partial entry
+        const std::filesystem::path p = entryPath(hash, targetRate, quality);
+        std::filesystem::path tmp = p;
+        tmp += ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out) return false;
+            out.write(reinterpret_cast<const char*>(&hdr), sizeof(Header));
+            out.write(reinterpret_cast<const char*>(samples), dataSize);
+            if (!out) {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+        std::filesystem::rename(tmp, p, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        evict();
+        return true;
+    }
+
+    // load the analysis stored for a decoded file
+    bool loadAnalysis(uint64_t hash, uint32_t targetRate, uint32_t quality, Analysis& a) {
+        if (!hash) return false;
+        const std::filesystem::path p = analysisPath(hash, targetRate, quality);
+        AnalysisEntry e;
+        std::ifstream in(p, std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(&e), sizeof(AnalysisEntry))) return false;
+        if (std::memcmp(e.magic, "SFGA", 4) != 0 || e.version != VERSION || e.hash != hash ||
+            e.targetRate != targetRate || e.quality != quality) return false;
+        a.frequency = e.frequency;
+        a.loudness = e.loudness;
+        a.rms = e.rms;
+        a.pitchCorrection = e.pitchCorrection;
+        a.rootKey = e.rootKey;
+        return true;
+    }
+
+    // store the analysis of a decoded file, the entry is evicted with the audio
+    bool storeAnalysis(uint64_t hash, uint32_t targetRate, uint32_t quality, const Analysis& a) {
+        if (!hash) return false;
+        std::error_code ec;
+        std::filesystem::create_directories(cacheDir, ec);
+        if (ec) return false;
+        AnalysisEntry e;
+        std::memset(&e, 0, sizeof(AnalysisEntry));
+        std::memcpy(e.magic, "SFGA", 4);
+        e.version = VERSION;
+        e.hash = hash;
+        e.targetRate = targetRate;
+        e.quality = quality;
+        e.frequency = a.frequency;
+        e.loudness = a.loudness;
+        e.rms = a.rms;
+        e.pitchCorrection = a.pitchCorrection;
+        e.rootKey = a.rootKey;
+        const std::filesystem::path p = analysisPath(hash, targetRate, quality);
+        std::filesystem::path tmp = p;
+        tmp += ".tmp" + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        {
+            std::ofstream out(tmp, std::ios::binary);
+            if (!out) return false;
+            out.write(reinterpret_cast<const char*>(&e), sizeof(AnalysisEntry));
+            if (!out) {
+                out.close();
+                std::filesystem::remove(tmp, ec);
+                return false;
+            }
+        }
+        std::filesystem::rename(tmp, p, ec);
+        if (ec) {
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+        return true;
+    }
+
+    // remove least recently used entries until the cache fit into the size cap
+    void evict() {
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type time;
+            uint64_t size;
+        };
+        std::vector<Entry> entries;
+        uint64_t total = 0;
+        std::error_code ec;
+        for (const auto& e : std::filesystem::directory_iterator(cacheDir, ec)) {
+            if (e.path().extension() != ".sfc" && e.path().extension() != ".sfa") continue;
+            Entry en;
+            en.path = e.path();
+            en.size = e.file_size(ec);
+            if (ec) continue;
+            en.time = e.last_write_time(ec);
+            if (ec) continue;
+            total += en.size;
+            entries.push_back(std::move(en));
+        }
+        if (total <= maxSize) return;
+        std::sort(entries.begin(), entries.end(),
+        [](Entry const &a, Entry const &b) {
+            return a.time < b.time;
+        });
+        for (const auto& en : entries) {
+            if (total <= maxSize) break;
+            if (std::filesystem::remove(en.path, ec)) total -= en.size;
+        }
+    }
+
+private:
+    static constexpr uint32_t VERSION = 1;
+
+    // 64 byte header, keeps the sample data aligned for mapping
+    struct Header {
+        char     magic[4];
+        uint32_t version;
+        uint64_t hash;
+        uint32_t targetRate;
+        uint32_t quality;
+        uint32_t format;
+        uint32_t channels;
+        uint32_t samplerate;
+        uint32_t frames;
+        uint8_t  reserved[24];
+    };
+    static_assert(sizeof(Header) == 64, "AudioCache::Header must be 64 bytes");
+
+    struct AnalysisEntry {
+        char     magic[4];
+        uint32_t version;
+        uint64_t hash;
+        uint32_t targetRate;
+        uint32_t quality;
+        float    frequency;
+        float    loudness;
+        float    rms;
+        int16_t  pitchCorrection;
+        uint8_t  rootKey;
+        uint8_t  reserved[9];
+    };
+    static_assert(sizeof(AnalysisEntry) == 48, "AudioCache::AnalysisEntry must be 48 bytes");
+
+    std::filesystem::path cacheDir;
+    uint64_t maxSize;
+
+    std::filesystem::path entryPath(uint64_t hash, uint32_t targetRate, uint32_t quality) const {
+        char name[64];
+        snprintf(name, 64, "%016llx-%u-%u.sfc", (unsigned long long)hash, targetRate, quality);
+        return cacheDir / name;
+    }
+
+    std::filesystem::path analysisPath(uint64_t hash, uint32_t targetRate, uint32_t quality) const {
+        std::filesystem::path p = entryPath(hash, targetRate, quality);
+        p.replace_extension(".sfa");
+        return p;
+    }
+
+    // validate a mapped entry and copy it into a new float buffer
+    bool readEntry(const uint8_t* data, uint64_t size, uint64_t hash, uint32_t targetRate,
+                uint32_t quality, float** samples, uint32_t* frames, uint32_t* channels,
+                uint32_t* samplerate) {
+        Header hdr;
+        std::memcpy(&hdr, data, sizeof(Header));
+        if (std::memcmp(hdr.magic, "SFGC", 4) != 0 || hdr.version != VERSION ||
+            hdr.hash != hash || hdr.targetRate != targetRate || hdr.quality != quality ||
+            !hdr.channels || !hdr.frames) return false;
+        const uint64_t count = (uint64_t)hdr.frames * hdr.channels;
+        const uint64_t bytes = count * (hdr.format == INT16 ? sizeof(int16_t) : sizeof(float));
+        if (size < sizeof(Header) + bytes) return false;
+        float* buf = nullptr;
+        try {
+            buf = new float[count];
+        } catch (...) {
+            return false;
+        }
+        const uint8_t* src = data + sizeof(Header);
+        if (hdr.format == INT16) {
+            const int16_t* s = reinterpret_cast<const int16_t*>(src);
+            for (uint64_t i = 0; i < count; i++) buf[i] = s[i] * (1.0f / 32767.0f);
+        } else {
+            std::memcpy(buf, src, bytes);
+        }
+        *samples = buf;
+        *frames = hdr.frames;
+        *channels = hdr.channels;
+        *samplerate = hdr.samplerate;
+        return true;
+    }
+};
+
+#endif
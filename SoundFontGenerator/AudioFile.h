@@ -10,11 +10,16 @@
 
 #include <iostream>
 #include <cstring>
+#include <chrono>
 #include <new>
 #include <sndfile.hh>
 
+#include "AudioBuffer.h"
+#include "AudioCache.h"
 #include "CheckResample.h"
+#include "MappedAudio.h"
 #include "SoundFontGen.h"
+#include "Trace.h"
 
 #pragma once
 
@@ -25,6 +30,10 @@
         class AudioFile - load a Audio File into buffer
                           and resample when needed
                           save a buffer to audio file
+
+  The file is loaded interleaved (that is what the decoders, the
+  resampler, the cache and the audio output want), toPlanar()
+  move it once into the planar buffer for the offline kernels.
 ****************************************************************/
 
 class AudioFile : public CheckResample {
@@ -32,33 +41,69 @@ public:
     uint32_t channels;
     uint32_t samplesize;
     uint32_t samplerate;
-    float*   samples;
-    float* saveBuffer;
+    float*   samples;       // interleaved, nullptr after toPlanar()
+    AudioBuffer buffer;     // planar, filled by toPlanar()
     SoundFontWriter swf;
+    AudioCache cache;
+    double resampleTime;    // ms spent in the resampler on the last load
+    uint64_t fileHash;      // content hash of the last loaded file, 0 without cache
     
     AudioFile() {
         channels   = 0;
         samplesize = 0;
         samplerate = 0;
         samples    = nullptr;
-        saveBuffer = nullptr;
+        useCache   = false;
+        resampleTime = 0.0;
+        fileHash = 0;
     }
     
     ~AudioFile() {
         delete[] samples;
-        delete[] saveBuffer;
+    }
+
+    // enable/disable the on-disk cache for decoded and resampled files
+    void setCache(bool enable) {
+        useCache = enable;
     }
 
     // load a Audio File into the buffer
     inline bool getAudioFile(const char* file, const uint32_t expectedSampleRate = 0) {
+        TRACE_SCOPE("AudioFile::getAudioFile");
         SF_INFO info;
         info.format = 0;
 
         channels = 0;
         samplesize = 0;
         samplerate = 0;
+        resampleTime = 0.0;
         delete[] samples;
         samples = nullptr;
+        buffer.release();
+        fileHash = 0;
+        uint64_t hash = 0;
+        if (useCache) {
+            hash = AudioCache::hashFile(file);
+            fileHash = hash;
+            if (cache.load(hash, expectedSampleRate, getQuality(), &samples,
+                                    &samplesize, &channels, &samplerate))
+                return true;
+        }
+        // uncompressed WAV/AIFF files get converted straight from the mapped file
+        MappedAudio mapped;
+        if (mapped.open(file)) {
+            try {
+                samples = new float[(uint64_t)mapped.frames * mapped.channels];
+            } catch (...) {
+                std::cerr << "Error: could not load file" << std::endl;
+                return false;
+            }
+            samplesize = mapped.readFloat(samples, 0, mapped.frames);
+            channels = mapped.channels;
+            samplerate = mapped.samplerate;
+            mapped.close();
+            return finishLoad(hash, expectedSampleRate);
+        }
         // Open the wave file for reading
         SNDFILE *sndfile = sf_open(file, SFM_READ, &info);
 
@@ -76,15 +121,71 @@ public:
             std::cerr << "Error: could not load file" << std::endl;
             return false;
         }
-        std::memset(samples, 0, info.frames * info.channels * sizeof(float));
         samplesize = (uint32_t) sf_readf_float(sndfile, &samples[0], info.frames);
-        if (!samplesize ) samplesize = info.frames;
+        if (!samplesize ) {
+            std::memset(samples, 0, info.frames * info.channels * sizeof(float));
+            samplesize = info.frames;
+        }
         channels = info.channels;
         samplerate = info.samplerate;
         sf_close(sndfile);
-        if (expectedSampleRate)
-            samples = checkSampleRate(&samplesize, channels, samples, samplerate, expectedSampleRate);
-        return samples ? true : false;
+        return finishLoad(hash, expectedSampleRate);
+    }
+
+    // load frames frames from start of a Audio File (a note of a long recording),
+    // regions are not cached
+    inline bool getAudioRegion(const char* file, const uint32_t start, const uint32_t frames,
+                                        const uint32_t expectedSampleRate = 0) {
+        TRACE_SCOPE("AudioFile::getAudioRegion");
+        channels = 0;
+        samplesize = 0;
+        samplerate = 0;
+        resampleTime = 0.0;
+        fileHash = 0;
+        delete[] samples;
+        samples = nullptr;
+        buffer.release();
+        MappedAudio mapped;
+        SNDFILE *sndfile = nullptr;
+        SF_INFO info;
+        info.format = 0;
+        if (mapped.open(file)) {
+            channels = mapped.channels;
+            samplerate = mapped.samplerate;
+        } else {
+            sndfile = sf_open(file, SFM_READ, &info);
+            if (!sndfile) {
+                std::cerr << "Error: could not open file " << sf_error (sndfile) << std::endl;
+                return false;
+            }
+            if (info.channels > 2 || sf_seek(sndfile, start, SEEK_SET) < 0) {
+                sf_close(sndfile);
+                return false;
+            }
+            channels = info.channels;
+            samplerate = info.samplerate;
+        }
+        try {
+            samples = new float[(uint64_t)frames * channels];
+        } catch (...) {
+            std::cerr << "Error: could not load file" << std::endl;
+            if (sndfile) sf_close(sndfile);
+            return false;
+        }
+        samplesize = sndfile ? (uint32_t)sf_readf_float(sndfile, samples, frames)
+                             : mapped.readFloat(samples, start, frames);
+        if (sndfile) sf_close(sndfile);
+        if (!samplesize) return false;
+        return finishLoad(0, expectedSampleRate);
+    }
+
+    // de-interleave the loaded samples into buffer and release them
+    inline bool toPlanar() {
+        TRACE_SCOPE("AudioFile::toPlanar");
+        if (!buffer.deinterleave(samples, samplesize, channels)) return false;
+        delete[] samples;
+        samples = nullptr;
+        return true;
     }
 
     // save a audio file from buffer to file
@@ -104,19 +205,49 @@ public:
     }
 
     // save from buffer to sf2 file
-    void savesf2(std::string name, const uint32_t from, const uint32_t to,
+    bool savesf2(std::string name, const uint32_t from, const uint32_t to,
                         const uint32_t SampleRate, const float gain, const uint8_t rootkey,
-                        const uint16_t chorus, const uint16_t reverb, const int16_t pitchCorrection) {
-        delete[] saveBuffer;
-        saveBuffer = nullptr;
-        saveBuffer = new float[samplesize];
-        std::memset(saveBuffer, 0, samplesize * sizeof(float));
-        for (uint32_t i = 0 ; i < samplesize ;i++){
-            saveBuffer[i] = samples[i*channels] * gain;
+                        const uint16_t chorus, const uint16_t reverb, const int16_t pitchCorrection,
+                        const bool stereo = false) {
+        // the first channel (or with stereo both) is converted with gain
+        // straight from the interleaved or the planar buffer, a interleaved
+        // stereo buffer is split into planes first
+        std::string sf2name = sf2Name(name);
+        const AudioBuffer* planes = (!samples && buffer.channels()) ? &buffer : nullptr;
+        AudioBuffer split;
+        if (!planes && stereo && channels == 2) {
+            if (!split.deinterleave(samples, samplesize, channels)) return false;
+            planes = &split;
         }
-        std::string sf2name = name.substr(0,name.find_last_of('.'))+".sf2";
-        swf.generate_sf2(saveBuffer, from, to, samplesize, SampleRate, sf2name,
+        if (planes)
+            return swf.generate_sf2(planes->channel(0),
+                        stereo && planes->channels() == 2 ? planes->channel(1) : nullptr, gain,
+                        from, to, planes->frames(), SampleRate, sf2name,
                         "Sample", rootkey, chorus, reverb, pitchCorrection);
+        return swf.generate_sf2(samples, channels, gain, from, to, samplesize, SampleRate, sf2name,
+                        "Sample", rootkey, chorus, reverb, pitchCorrection);
+    }
+
+    // the sf2 file name savesf2() use for name
+    static std::string sf2Name(const std::string& name) {
+        return name.substr(0,name.find_last_of('.'))+".sf2";
+    }
+
+private:
+    bool useCache;
+
+    // resample when needed and store the result in the cache
+    inline bool finishLoad(const uint64_t hash, const uint32_t expectedSampleRate) {
+        if (expectedSampleRate) {
+            const auto t = std::chrono::steady_clock::now();
+            samples = checkSampleRate(&samplesize, channels, samples, samplerate, expectedSampleRate);
+            resampleTime = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - t).count();
+        }
+        if (useCache && hash && samples)
+            cache.store(hash, expectedSampleRate, getQuality(), samples,
+                                    samplesize, channels, samplerate);
+        return samples ? true : false;
     }
 
 };
@@ -12,7 +12,16 @@
 #include <assert.h>
 #include <cmath>
 #include <cstring>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include <thread>
 #include <zita-resampler/resampler.h>
+#include "HalfBand.h"
+#include "Trace.h"
 
 
 #pragma once
@@ -20,16 +29,180 @@
 #ifndef CHECKRESAMPLE_H
 #define CHECKRESAMPLE_H
 
+/****************************************************************
+  CheckResample - resample a buffer or a stream
+
+  The quality tiers select the zita filter length, draft (16),
+  standard (32) and mastering (96), any length between could be
+  set as well. The ratios 2, 4, 1/2 and 1/4 (44.1k <-> 88.2k,
+  48k <-> 96k, ...) run through half-band stages of the same
+  quality instead of the generic zita polyphase filter.
+  Rates within RATE_TOLERANCE are taken as equal and not resampled.
+****************************************************************/
+
 class CheckResample : Resampler{
 public:
-    CheckResample() {}
+    // the quality tiers, the value is the filter length
+    enum Quality {
+        DRAFT = 16,
+        STANDARD = 32,
+        MASTERING = 96
+    };
+
+    // relative difference of two rates which is not worth resampling (0.17 cent)
+    static constexpr double RATE_TOLERANCE = 1e-4;
+
+    CheckResample() : quality(STANDARD), stream_inp(0), stream_outp(0), stream_left(0),
+                        stream_chan(0) {}
+
+    // the resampler quality (filter length) used by checkSampleRate()
+    uint32_t getQuality() const {
+        return quality;
+    }
+
+    // zita-resampler accept a filter length between 16 and 96
+    void setQuality(uint32_t q) {
+        quality = std::clamp<uint32_t>(q, 16, 96);
+    }
+
+    // "draft", "standard", "mastering" or a filter length between 16 and 96
+    static bool parseQuality(const std::string& name, uint32_t* q) {
+        if (name == "draft") *q = DRAFT;
+        else if (name == "standard") *q = STANDARD;
+        else if (name == "mastering") *q = MASTERING;
+        else {
+            char* e = nullptr;
+            const unsigned long v = std::strtoul(name.c_str(), &e, 10);
+            if (!e || *e != '\0' || e == name.c_str() || v < 16 || v > 96) return false;
+            *q = (uint32_t)v;
+        }
+        return true;
+    }
+
+    static std::string qualityName(uint32_t q) {
+        if (q == DRAFT) return "draft";
+        if (q == STANDARD) return "standard";
+        if (q == MASTERING) return "mastering";
+        return std::to_string(q);
+    }
+
+    // true when the rates differ by more than the tolerance
+    static bool needResample(uint32_t imprate, uint32_t samplerate) {
+        if (!imprate || !samplerate || imprate == samplerate) return false;
+        const double d = std::fabs((double)imprate - (double)samplerate);
+        return d > RATE_TOLERANCE * std::max(imprate, samplerate);
+    }
+
+    // the number of 2x half-band stages for the ratio, 0 when it isn't 2, 4, 1/2 or 1/4
+    static uint32_t halfBandStages(uint32_t imprate, uint32_t samplerate) {
+        for (uint32_t n = 1; n <= 2; n++) {
+            if ((uint64_t)imprate << n == samplerate || (uint64_t)samplerate << n == imprate)
+                return n;
+        }
+        return 0;
+    }
 
     float *checkSampleRate(uint32_t *count, uint32_t chan, float *impresp,
                             uint32_t imprate, uint32_t samplerate) {
-        if (imprate != samplerate) {
-            return process(imprate, *count, impresp, chan, samplerate, count, 32);
+        if (!needResample(imprate, samplerate)) return impresp;
+        if (halfBandStages(imprate, samplerate))
+            return processHalfBand(imprate, count, impresp, chan, samplerate);
+        return process(imprate, *count, impresp, chan, samplerate, count, quality);
+    }
+
+    // streaming use: setup once and feed the input block wise, the output
+    // is the same as from checkSampleRate() for the whole buffer.
+    // return the maximal output size for ilen input frames, 0 on error
+    uint32_t beginStream(uint32_t imprate, uint32_t samplerate, uint32_t chan, uint32_t ilen) {
+        uint32_t d = gcd(imprate, samplerate);
+        uint32_t ratio_a = imprate / d;
+        uint32_t ratio_b = samplerate / d;
+        stream_inp = imprate;
+        stream_outp = samplerate;
+        stream_chan = chan;
+        stream_left = 0;
+        clear();
+        stages.clear();
+        const uint32_t n = halfBandStages(imprate, samplerate);
+        if (n) {
+            stages.resize(n);
+            stageOut.resize(n);
+            stream_left = ilen;
+            for (auto& st : stages) {
+                st.setup(samplerate > imprate, quality, chan);
+                stream_left = HalfBand::outputSize(samplerate > imprate, stream_left);
+            }
+            return stream_left;
+        }
+        if (setup(imprate, samplerate, chan, quality) != 0) {
+            return 0;
         }
-        return impresp;
+        // pre-fill with k/2-1 zeros
+        int32_t k = inpsize();
+        inp_count = k/2-1;
+        inp_data = 0;
+        out_count = 1; // must be at least 1 to get going
+        out_data = 0;
+        if (Resampler::process() != 0) {
+            return 0;
+        }
+        stream_left = (uint32_t)(((uint64_t)ilen * ratio_b + ratio_a - 1) / ratio_a);
+        return stream_left;
+    }
+
+    // resample a block, output must have room for the remaining output size
+    bool processBlock(const float *input, uint32_t ilen, float *output, uint32_t *olen) {
+        TRACE_SCOPE("CheckResample::processBlock");
+        *olen = 0;
+        if (!stream_left) return true;
+        if (!stages.empty()) return halfBandBlock(0, input, ilen, output, olen);
+        inp_count = ilen;
+        inp_data = const_cast<float*>(input);
+        out_count = stream_left;
+        out_data = output;
+        if (Resampler::process() != 0) {
+            return false;
+        }
+        *olen = stream_left - out_count;
+        stream_left = out_count;
+        return true;
+    }
+
+    // flush the filter with k/2 zeros
+    bool endStream(float *output, uint32_t *olen) {
+        TRACE_SCOPE("CheckResample::endStream");
+        *olen = 0;
+        if (!stages.empty()) {
+            // flush the stages in order, the tail of a stage run through the following
+            for (uint32_t i = 0; i < stages.size(); i++) {
+                float* out = output + (size_t)*olen * stream_chan;
+                uint32_t n = 0;
+                if (i + 1 < stages.size()) {
+                    std::vector<float>& tail = stageOut[i];
+                    tail.resize((size_t)stages[i].maxOutput(stages[i].pendingFrames()) * stream_chan);
+                    halfBandBlock(i + 1, tail.data(), stages[i].flush(tail.data()), out, &n);
+                } else {
+                    n = stages[i].flush(out);
+                    stream_left -= std::min(n, stream_left);
+                }
+                *olen += n;
+            }
+            return true;
+        }
+        inp_data = 0;
+        inp_count = inpsize()/2;
+        out_count = stream_left;
+        out_data = output;
+        if (Resampler::process() != 0) {
+            return false;
+        }
+        *olen = stream_left - out_count;
+        stream_left = out_count;
+        #ifndef NDEBUG
+        if (inp_count)
+            printf("resampled from %i to: %i, lost %i samples\n",stream_inp, stream_outp, inp_count);
+        #endif
+        return true;
     }
 
     ~CheckResample() {
@@ -37,6 +210,54 @@ public:
     }
 
 private:
+    uint32_t quality;
+    uint32_t stream_inp;
+    uint32_t stream_outp;
+    uint32_t stream_left;
+    uint32_t stream_chan;
+    std::vector<HalfBand> stages;
+    std::vector<std::vector<float>> stageOut;
+
+    // run a block through the half-band stages from first on
+    // the output buffer hold the remaining output of the stream
+    bool halfBandBlock(uint32_t first, const float *input, uint32_t ilen, float *output, uint32_t *olen) {
+        const float* in = input;
+        uint32_t n = ilen;
+        for (uint32_t i = first; i < stages.size(); i++) {
+            float* out = output;
+            if (i + 1 < stages.size()) {
+                stageOut[i].resize((size_t)stages[i].maxOutput(n) * stream_chan);
+                out = stageOut[i].data();
+            }
+            n = stages[i].process(in, n, out);
+            in = out;
+        }
+        *olen = n;
+        stream_left -= std::min(n, stream_left);
+        return true;
+    }
+
+    // the whole buffer through the half-band stages
+    float* processHalfBand(uint32_t fs_inp, uint32_t *count, float *input, uint32_t chan,
+                                                                    uint32_t fs_outp) {
+        TRACE_SCOPE("CheckResample::processHalfBand");
+        const uint32_t nout = beginStream(fs_inp, fs_outp, chan, *count);
+        float *p = nullptr;
+        try {
+            p = new float[(size_t)nout * chan];
+        } catch (...) {
+            return 0;
+        }
+        uint32_t a = 0, b = 0;
+        if (!processBlock(input, *count, p, &a) || !endStream(p + (size_t)a * chan, &b)) {
+            delete[] p;
+            return 0;
+        }
+        stages.clear();
+        *count = a + b;
+        delete[] input;
+        return p;
+    }
 
     static uint32_t gcd (uint32_t a, uint32_t b) {
         if (a == 0) return b;
@@ -57,6 +278,7 @@ private:
 
     float* process(int32_t fs_inp, int32_t ilen, float *input, uint32_t chan, 
                     int32_t fs_outp, uint32_t *olen, const int32_t qual){
+        TRACE_SCOPE("CheckResample::process");
         uint32_t d = gcd(fs_inp, fs_outp);
         uint32_t ratio_a = fs_inp / d;
         uint32_t ratio_b = fs_outp / d;
@@ -101,5 +323,137 @@ private:
     }
 };
 
+/****************************************************************
+  PreviewResampler - resample the preview on the fly in the audio callback
+
+  setup() is called outside of the audio thread when a file is loaded
+  or the Sample Rate of the server change. process() pull the input
+  block wise from a source function and is real-time safe.
+****************************************************************/
+
+class PreviewResampler : Resampler {
+public:
+    PreviewResampler() : channels(0), delay(0), running(false) {}
+
+    // prepare for a rate pair, without a rate change process() is bypassed
+    bool setup(uint32_t fs_inp, uint32_t fs_outp, uint32_t chan, uint32_t quality = 32) {
+        running = false;
+        delay = 0;
+        clear();
+        if (!CheckResample::needResample(fs_inp, fs_outp)) return true;
+        if (Resampler::setup(fs_inp, fs_outp, chan, quality) != 0) return false;
+        channels = chan;
+        block.assign((size_t)BLOCK * chan, 0.0f);
+        // pre-fill with k/2-1 zeros
+        inp_count = inpsize()/2-1;
+        inp_data = 0;
+        out_count = 1; // must be at least 1 to get going
+        out_data = 0;
+        Resampler::process();
+        inp_count = 0;
+        delay = inpsize()/2;
+        running = true;
+        return true;
+    }
+
+    // true when the rates differ
+    bool active() const {
+        return running;
+    }
+
+    // the input frames the output lag behind the source
+    uint32_t latency() const {
+        return delay;
+    }
+
+    // fill frames interleaved output frames, source(buffer, n) must
+    // render n interleaved input frames
+    template <typename Source>
+    void process(float *output, uint32_t frames, Source&& source) {
+        out_data = output;
+        out_count = frames;
+        while (out_count) {
+            if (!inp_count) {
+                source(block.data(), BLOCK);
+                inp_data = block.data();
+                inp_count = BLOCK;
+            }
+            if (Resampler::process() != 0) {
+                std::memset(out_data, 0, out_count * channels * sizeof(float));
+                break;
+            }
+        }
+    }
+
+    ~PreviewResampler() {
+        clear();
+    }
+
+private:
+    static constexpr uint32_t BLOCK = 64;
+    std::vector<float> block;
+    uint32_t channels;
+    uint32_t delay;
+    bool running;
+};
+
+/****************************************************************
+  PreviewSwap - hand a new PreviewResampler to the audio callback
+
+  setup() build the resampler for a new rate pair in the calling
+  (GUI) thread and publish it with a atomic pointer, the callback
+  take the current one in enter() and is done with it in leave().
+  Both bump a sequence counter (odd while a cycle runs), so the
+  old resampler is only freed when the callback is outside of a
+  cycle or has finished the one which may still use it.
+****************************************************************/
+
+class PreviewSwap {
+public:
+    PreviewSwap() : current(new PreviewResampler()), seq(0) {}
+
+    ~PreviewSwap() {
+        delete current.load();
+        for (auto p : retired) delete p;
+    }
+
+    PreviewSwap(const PreviewSwap&) = delete;
+    PreviewSwap& operator=(const PreviewSwap&) = delete;
+
+    // build and publish a resampler for the rate pair, not real-time safe
+    bool setup(uint32_t fs_inp, uint32_t fs_outp, uint32_t chan, uint32_t quality = 32) {
+        PreviewResampler* p = new PreviewResampler();
+        const bool ok = p->setup(fs_inp, fs_outp, chan, quality);
+        PreviewResampler* old = current.exchange(p);
+        // wait for the end of a running cycle, a stuck callback keep the old one alive
+        const uint32_t s = seq.load();
+        for (uint32_t i = 0; (s & 1) && seq.load() == s; i++) {
+            if (i == 1000) {
+                retired.push_back(old);
+                return ok;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        delete old;
+        return ok;
+    }
+
+    // the audio callback, the resampler for this cycle
+    PreviewResampler* enter() {
+        seq.fetch_add(1);
+        return current.load();
+    }
+
+    // the audio callback, the resampler of enter() isn't used any more
+    void leave() {
+        seq.fetch_add(1);
+    }
+
+private:
+    std::atomic<PreviewResampler*> current;
+    std::atomic<uint32_t> seq;
+    std::vector<PreviewResampler*> retired;
+};
+
 #endif
 
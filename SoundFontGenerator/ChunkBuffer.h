@@ -0,0 +1,141 @@
+/*
+ * ChunkBuffer.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  ChunkBuffer - bump allocated byte buffer to build RIFF chunks
+
+  Values are stored little-endian with bulk memcpy stores.
+  clear() only reset the write position, the storage is kept,
+  so after the first file of a batch, building the next one
+  doesn't touch the heap as long as it fit into the capacity.
+****************************************************************/
+
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#pragma once
+
+#ifndef CHUNKBUFFER_H
+#define CHUNKBUFFER_H
+
+class ChunkBuffer {
+public:
+    ChunkBuffer() : used(0), cap(0) {}
+    ~ChunkBuffer() {}
+
+    ChunkBuffer(const ChunkBuffer&) = delete;
+    ChunkBuffer& operator=(const ChunkBuffer&) = delete;
+
+    // reset the write position, keep the storage
+    inline void clear() noexcept {
+        used = 0;
+    }
+
+    // make sure the buffer could hold n bytes without growing
+    inline void reserve(size_t n) {
+        if (n > cap) grow(n);
+    }
+
+    inline size_t size() const noexcept {
+        return used;
+    }
+
+    inline size_t capacity() const noexcept {
+        return cap;
+    }
+
+    inline const uint8_t* data() const noexcept {
+        return mem.get();
+    }
+
+    // bump allocate n bytes and return the write pointer
+    inline uint8_t* alloc(size_t n) {
+        if (used + n > cap) grow(std::max(used + n, cap * 2));
+        uint8_t* p = mem.get() + used;
+        used += n;
+        return p;
+    }
+
+    // store a value little-endian
+    template<typename T>
+    inline void put(T v) {
+        store(alloc(sizeof(T)), v);
+    }
+
+    // overwrite a value at a given offset (patch a placeholder)
+    template<typename T>
+    inline void put_at(size_t offset, T v) noexcept {
+        store(mem.get() + offset, v);
+    }
+
+    // store n raw bytes
+    inline void put_bytes(const void* src, size_t n) {
+        std::memcpy(alloc(n), src, n);
+    }
+
+    inline void put_zero(size_t n) {
+        std::memset(alloc(n), 0, n);
+    }
+
+    // store a string as fixed size field, zero padded
+    inline void put_strz(const std::string& s, size_t n) {
+        uint8_t* p = alloc(n);
+        const size_t l = std::min(s.size(), n);
+        std::memcpy(p, s.data(), l);
+        std::memset(p + l, 0, n - l);
+    }
+
+    // start a chunk, return the offset of the size field for end_chunk()
+    inline size_t begin_chunk(const char* id) {
+        put_bytes(id, 4);
+        const size_t at = used;
+        put<uint32_t>(0);
+        return at;
+    }
+
+    // start a LIST like chunk (RIFF, LIST) with its form type
+    inline size_t begin_list(const char* id, const char* type) {
+        const size_t at = begin_chunk(id);
+        put_bytes(type, 4);
+        return at;
+    }
+
+    // patch the size field of a chunk started at offset
+    inline void end_chunk(size_t at) noexcept {
+        put_at<uint32_t>(at, static_cast<uint32_t>(used - at - 4));
+    }
+
+private:
+    std::unique_ptr<uint8_t[]> mem;
+    size_t used;
+    size_t cap;
+
+    template<typename T>
+    static inline void store(uint8_t* p, T v) noexcept {
+        #if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+        uint8_t b[sizeof(T)];
+        std::memcpy(b, &v, sizeof(T));
+        std::reverse(b, b + sizeof(T));
+        std::memcpy(p, b, sizeof(T));
+        #else
+        std::memcpy(p, &v, sizeof(T));
+        #endif
+    }
+
+    void grow(size_t n) {
+        std::unique_ptr<uint8_t[]> m(new uint8_t[n]);
+        if (used) std::memcpy(m.get(), mem.get(), used);
+        mem = std::move(m);
+        cap = n;
+    }
+};
+
+#endif
@@ -0,0 +1,246 @@
+/*
+ * CmdLine.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  CmdLine - parse the command-line options
+
+  options start with "--", all other arguments are collected
+  in order as positional arguments (input, output, SampleRate)
+****************************************************************/
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <algorithm>
+
+#include "CheckResample.h"
+
+#pragma once
+
+#ifndef CMDLINE_H
+#define CMDLINE_H
+
+class CmdLine {
+public:
+    std::vector<std::string> args;
+    std::string cacheDir;
+    std::string batchDir;
+    std::string instrument;
+    std::string daemonSocket;
+    std::string clientSocket;
+    std::string traceFile;
+    std::string device;
+    uint64_t cacheSize;
+    uint32_t sampleRate;
+    uint32_t quality;
+    uint32_t jobs;
+    uint32_t period;
+    uint32_t deviceRate;
+    double latency;
+    double sliceThreshold;
+    double sliceGap;
+    double trimThreshold;
+    double normalizeLevel;
+    bool useCache;
+    bool directIO;
+    bool pinThreads;
+    bool pipeline;
+    bool json;
+    bool rtStats;
+    bool listDevices;
+    bool retune;
+    bool slice;
+    bool trim;
+    bool normalize;
+    bool stereo;
+
+    CmdLine() {
+        cacheSize = 0;
+        sampleRate = 0;
+        quality = CheckResample::STANDARD;
+        jobs = 0;
+        period = 0;
+        deviceRate = 0;
+        latency = 0.0;
+        sliceThreshold = -40.0;
+        sliceGap = 0.15;
+        trimThreshold = -60.0;
+        normalizeLevel = -1.0;
+        useCache = false;
+        directIO = false;
+        pinThreads = false;
+        pipeline = false;
+        json = false;
+        rtStats = false;
+        listDevices = false;
+        retune = false;
+        slice = false;
+        trim = false;
+        normalize = false;
+        stereo = false;
+    }
+
+    // parse argv, return false on a unknown or incomplete option
+    bool parse(int argc, char *argv[]) {
+        for (int i = 1; i < argc; i++) {
+            std::string a = argv[i];
+            if (a.compare(0, 2, "--") != 0 || a.size() == 2) {
+                args.push_back(a);
+            } else if (a == "--cache") {
+                useCache = true;
+            } else if (a == "--cache-dir") {
+                if (!value(argc, argv, i, cacheDir)) return false;
+                useCache = true;
+            } else if (a == "--cache-size") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                cacheSize = std::strtoull(v.c_str(), nullptr, 10) * 1024ull * 1024ull;
+                useCache = true;
+            } else if (a == "--direct-io") {
+                directIO = true;
+            } else if (a == "--rate") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                sampleRate = (uint32_t)std::strtoul(v.c_str(), nullptr, 10);
+            } else if (a == "--quality") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                if (!CheckResample::parseQuality(v, &quality)) {
+                    std::cerr << "Error: unknown quality " << v << std::endl;
+                    return false;
+                }
+            } else if (a == "--retune") {
+                retune = true;
+            } else if (a == "--stereo") {
+                stereo = true;
+            } else if (a == "--trim") {
+                trim = true;
+            } else if (a == "--trim-threshold") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                trimThreshold = std::strtod(v.c_str(), nullptr);
+                trim = true;
+            } else if (a == "--normalize") {
+                normalize = true;
+            } else if (a == "--normalize-level") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                normalizeLevel = std::min(0.0, std::strtod(v.c_str(), nullptr));
+                normalize = true;
+            } else if (a == "--batch") {
+                if (!value(argc, argv, i, batchDir)) return false;
+            } else if (a == "--instrument") {
+                if (!value(argc, argv, i, instrument)) return false;
+            } else if (a == "--slice") {
+                slice = true;
+            } else if (a == "--slice-threshold") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                sliceThreshold = std::strtod(v.c_str(), nullptr);
+                slice = true;
+            } else if (a == "--slice-gap") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                sliceGap = std::strtod(v.c_str(), nullptr) / 1000.0;
+                slice = true;
+            } else if (a == "--jobs") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                jobs = (uint32_t)std::strtoul(v.c_str(), nullptr, 10);
+            } else if (a == "--pin") {
+                pinThreads = true;
+            } else if (a == "--pipeline") {
+                pipeline = true;
+            } else if (a == "--trace") {
+                if (!value(argc, argv, i, traceFile)) return false;
+            } else if (a == "--json") {
+                json = true;
+            } else if (a == "--rt-stats") {
+                rtStats = true;
+            } else if (a == "--list-devices") {
+                listDevices = true;
+            } else if (a == "--device") {
+                if (!value(argc, argv, i, device)) return false;
+            } else if (a == "--period") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                period = (uint32_t)std::strtoul(v.c_str(), nullptr, 10);
+            } else if (a == "--device-rate") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                deviceRate = (uint32_t)std::strtoul(v.c_str(), nullptr, 10);
+            } else if (a == "--latency") {
+                std::string v;
+                if (!value(argc, argv, i, v)) return false;
+                latency = std::strtod(v.c_str(), nullptr) / 1000.0;
+            } else if (a == "--daemon") {
+                if (!value(argc, argv, i, daemonSocket)) return false;
+            } else if (a == "--client") {
+                if (!value(argc, argv, i, clientSocket)) return false;
+            } else if (a == "--help") {
+                args.push_back(a);
+            } else {
+                std::cerr << "Error: unknown option " << a << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // print the option help
+    static void usage() {
+        std::cout << "  Options:" << std::endl;
+        std::cout << "    --rate HZ            resample to Sample Rate" << std::endl;
+        std::cout << "    --quality Q          resampler quality: draft, standard (default)," << std::endl;
+        std::cout << "                         mastering or a filter length between 16 and 96" << std::endl;
+        std::cout << "    --retune             resample to the exact root key, store no pitch correction" << std::endl;
+        std::cout << "    --stereo             keep both channels of a stereo file as linked samples" << std::endl;
+        std::cout << "    --trim               cut the silence at the start and the end of the sample" << std::endl;
+        std::cout << "    --trim-threshold DB  silence level for --trim (default -60 dB)" << std::endl;
+        std::cout << "    --normalize          scale the sample to a peak of --normalize-level" << std::endl;
+        std::cout << "    --normalize-level DB peak level for --normalize (default -1 dBFS)" << std::endl;
+        std::cout << "    --batch DIR          convert all given files into DIR" << std::endl;
+        std::cout << "    --instrument FILE    write the given notes (files or directories) as one" << std::endl;
+        std::cout << "                         multi-zone instrument, split by the root keys" << std::endl;
+        std::cout << "    --slice              cut every file of --instrument into its notes" << std::endl;
+        std::cout << "    --slice-threshold DB onset level for --slice (default -40 dB)" << std::endl;
+        std::cout << "    --slice-gap MS       minimal silence between the notes (default 150 ms)" << std::endl;
+        std::cout << "    --jobs N             worker threads for --batch and --instrument (default all cores)" << std::endl;
+        std::cout << "    --pin                pin the worker threads to CPU cores" << std::endl;
+        std::cout << "    --pipeline           overlap decode, resample, encode and write of a file" << std::endl;
+        std::cout << "    --json               print the results and metrics as JSON, one line per file" << std::endl;
+        std::cout << "    --trace FILE         write a Chrome trace of the hot paths to FILE on exit" << std::endl;
+        std::cout << "    --list-devices       list the audio output devices" << std::endl;
+        std::cout << "    --device DEV         audio output device, index or name (GUI)" << std::endl;
+        std::cout << "    --period FRAMES      frames per audio buffer (GUI)" << std::endl;
+        std::cout << "    --device-rate HZ     Sample Rate of the audio device (GUI)" << std::endl;
+        std::cout << "    --latency MS         suggested output latency in ms (GUI)" << std::endl;
+        std::cout << "    --rt-stats           print the audio callback timing and xruns on exit (GUI)" << std::endl;
+        std::cout << "    --daemon SOCKET      serve JSON jobs on a Unix socket" << std::endl;
+        std::cout << "    --client SOCKET      send JSON jobs from stdin to a daemon" << std::endl;
+        std::cout << "    --cache              cache decoded audio on disk" << std::endl;
+        std::cout << "    --cache-dir DIR      cache directory (default ~/.cache/sf2generate)" << std::endl;
+        std::cout << "    --cache-size MB      maximal cache size in MB (default 1024)" << std::endl;
+        std::cout << "    --direct-io          write large SoundFonts with O_DIRECT" << std::endl;
+    }
+
+private:
+    // fetch the value for a option
+    bool value(int argc, char *argv[], int& i, std::string& v) {
+        if (i + 1 >= argc) {
+            std::cerr << "Error: option " << argv[i] << " needs a value" << std::endl;
+            return false;
+        }
+        v = argv[++i];
+        return true;
+    }
+};
+
+#endif
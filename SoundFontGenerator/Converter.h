@@ -0,0 +1,690 @@
+/*
+ * Converter.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Converter - headless conversion of audio files to sf2
+
+  A conversion is split into the stages decode, analyse (pitch),
+  retune and trim (optional) and write. Every job carries its own AudioFile
+  and PitchTracker, so jobs could run in parallel. runBatch() express
+  the stages of every job as chained tasks in a TaskPool.
+  runInstrument() analyse a set of note recordings the same way and
+  write them as zones of a single instrument, takes of the same note
+  become velocity layers by their loudness. With the cache enabled
+  the analysis of a file is cached next to its decoded audio.
+****************************************************************/
+
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <filesystem>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+#include "AudioFile.h"
+#include "Json.h"
+#include "Loudness.h"
+#include "PitchTracker.h"
+#include "Pipeline.h"
+#include "Retune.h"
+#include "Slicer.h"
+#include "TaskPool.h"
+
+#pragma once
+
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+class Converter {
+public:
+    // a conversion request
+    struct Job {
+        std::string input;
+        std::string output;
+        uint32_t sampleRate = 0;     // 0 = keep the file Sample Rate
+        uint32_t quality = CheckResample::STANDARD;   // resampler filter length
+        uint8_t  rootKey = 0;        // 0 = detect by the pitch tracker
+        int16_t  pitchCorrection = 0;
+        uint16_t chorus = 500;
+        uint16_t reverb = 500;
+        uint32_t loopStart = 0;
+        uint32_t loopEnd = 0;        // 0 = end of file
+        float    gain = 1.0f;
+        bool     retune = false;     // bake the pitch correction into the sample
+        bool     zone = false;       // a zone of a instrument, set by runInstrument()
+        uint32_t sliceStart = 0;     // a note of a long recording (Slicer),
+        uint32_t sliceFrames = 0;    // 0 = the whole file
+        std::string name;            // sample name, empty = the input file name
+        bool     trim = false;       // cut the silence at both ends
+        double   trimThreshold = -60.0;  // dBFS
+        bool     normalize = false;  // scale the peak to normalizeLevel, before the gain
+        double   normalizeLevel = -1.0;  // dBFS
+        bool     stereo = false;     // write both channels of a stereo file as linked samples
+    };
+
+    // error codes
+    enum Error {
+        NONE,
+        READ,      // the input could not be read or resampled
+        PITCH,     // no root key detected
+        WRITE,     // the sf2 file could not be written
+        RETUNE     // the sample could not be retuned
+    };
+
+    // the outcome of a conversion
+    struct Result {
+        bool ok = false;
+        Error code = NONE;
+        std::string error;
+        float frequency = 0.0f;
+        uint8_t rootKey = 0;
+        int16_t pitchCorrection = 0;
+        uint32_t sampleRate = 0;
+        uint32_t sampleSize = 0;
+        uint32_t sourceRate = 0;     // Sample Rate of the input file
+        uint8_t keyLow = 0;          // the key and velocity range of a instrument zone
+        uint8_t keyHigh = 127;
+        uint8_t velLow = 0;
+        uint8_t velHigh = 127;
+        double loudness = Loudness::FLOOR;   // LUFS
+        double rms = Loudness::FLOOR;        // dBFS
+        uint32_t trimStart = 0;      // frames cut at the start and the end
+        uint32_t trimEnd = 0;
+        double peak = Loudness::FLOOR;       // dBFS before normalizing
+        double normalizeGain = 0.0;          // dB
+        bool stereo = false;         // written as left/right sample pair
+        uint64_t bytesWritten = 0;
+        // stage timing in ms
+        double decodeTime = 0.0;
+        double resampleTime = 0.0;
+        double pitchTime = 0.0;
+        double retuneTime = 0.0;
+        double trimTime = 0.0;
+        double convertTime = 0.0;
+        double writeTime = 0.0;
+        double totalTime = 0.0;
+    };
+
+    // the outcome of runInstrument()
+    struct Instrument {
+        bool ok = false;
+        std::string output;
+        std::string error;
+        uint32_t zones = 0;
+        uint64_t bytesWritten = 0;
+        double writeTime = 0.0;
+        double totalTime = 0.0;
+    };
+
+    // the working set of a job
+    struct Context {
+        Job job;
+        Result result;
+        AudioFile af;
+        PitchTracker pt;
+        Pipeline::Stats stats;     // only filled by runPipelined()
+        std::chrono::steady_clock::time_point started;
+
+        // prepare for the next job, keep the buffers of the writer and tracker
+        void reset() {
+            job = Job();
+            result = Result();
+            stats = Pipeline::Stats();
+            delete[] af.samples;
+            af.samples = nullptr;
+            af.buffer.release();
+            af.samplesize = 0;
+        }
+    };
+
+    Converter() {
+        useCache = false;
+        cacheSize = 0;
+        directIO = false;
+        pipelined = false;
+        retuneThreads = 0;
+    }
+
+    ~Converter() {}
+
+    void setCache(bool enable, const std::string& dir = "", uint64_t size = 0) {
+        useCache = enable;
+        cacheDir = dir;
+        cacheSize = size;
+    }
+
+    void setDirectIO(bool enable) {
+        directIO = enable;
+    }
+
+    // threads the retune stage of a job could use, 0 = all cores
+    void setRetuneThreads(uint32_t threads) {
+        retuneThreads = threads;
+    }
+
+    // run the stages of a single file overlapped in a Pipeline
+    void setPipeline(bool enable) {
+        pipelined = enable;
+    }
+
+    // decode (and resample) the input file
+    bool decode(Context& c) {
+        const auto t = Clock::now();
+        if (useCache) {
+            c.af.setCache(true);
+            if (!cacheDir.empty()) c.af.cache.setDirectory(cacheDir);
+            if (cacheSize) c.af.cache.setMaxSize(cacheSize);
+        }
+        c.af.setQuality(c.job.quality);
+        const bool ok = c.job.sliceFrames ?
+                    c.af.getAudioRegion(c.job.input.c_str(), c.job.sliceStart,
+                                            c.job.sliceFrames, c.job.sampleRate) :
+                    c.af.getAudioFile(c.job.input.c_str(), c.job.sampleRate);
+        c.result.resampleTime = c.af.resampleTime;
+        c.result.decodeTime = ms(t) - c.af.resampleTime;
+        if (!ok) return fail(c, READ, "Fail to read: " + c.job.input);
+        c.result.sourceRate = c.af.samplerate;
+        // rates within the tolerance are not resampled and keep the source rate
+        if (CheckResample::needResample(c.af.samplerate, c.job.sampleRate))
+            c.af.samplerate = c.job.sampleRate;
+        c.result.sampleRate = c.af.samplerate;
+        c.result.sampleSize = c.af.samplesize;
+        // the later stages work on the planes
+        if (!c.af.toPlanar()) return fail(c, READ, "Fail to read: " + c.job.input);
+        // the cut edges of a slice
+        if (c.job.sliceFrames)
+            for (uint32_t ch = 0; ch < c.af.buffer.channels(); ch++)
+                Slicer::fade(c.af.buffer.channel(ch), c.af.buffer.frames(), 1, c.af.samplerate);
+        return true;
+    }
+
+    // detect the root key and the pitch correction
+    bool analyse(Context& c) {
+        const auto t = Clock::now();
+        AudioCache::Analysis a;
+        if (useCache && c.af.cache.loadAnalysis(c.af.fileHash, c.job.sampleRate, c.af.getQuality(), a)) {
+            c.result.rootKey = a.rootKey;
+            c.result.pitchCorrection = a.pitchCorrection;
+            c.result.frequency = a.frequency;
+            c.result.loudness = a.loudness;
+            c.result.rms = a.rms;
+        } else {
+            const AudioBuffer& b = c.af.buffer;
+            c.result.rootKey = c.pt.getPitch(b.channel(0), b.frames(), 1,
+                        c.af.samplerate, &c.result.pitchCorrection, &c.result.frequency);
+            // the loudness order the velocity layers of a instrument
+            if (c.job.zone || useCache) {
+                std::vector<const float*> planes(b.channels());
+                for (uint32_t ch = 0; ch < b.channels(); ch++) planes[ch] = b.channel(ch);
+                const Loudness::Level l = Loudness::measure(planes.data(), b.frames(),
+                                                        b.channels(), c.af.samplerate);
+                c.result.loudness = l.lufs;
+                c.result.rms = l.rms;
+            }
+            if (useCache && c.af.fileHash) {
+                a.rootKey = c.result.rootKey;
+                a.pitchCorrection = c.result.pitchCorrection;
+                a.frequency = c.result.frequency;
+                a.loudness = (float)c.result.loudness;
+                a.rms = (float)c.result.rms;
+                c.af.cache.storeAnalysis(c.af.fileHash, c.job.sampleRate, c.af.getQuality(), a);
+            }
+        }
+        c.result.pitchTime = ms(t);
+        if (c.job.rootKey) {
+            c.result.rootKey = c.job.rootKey;
+            c.result.pitchCorrection = c.job.pitchCorrection;
+        }
+        if (!c.result.rootKey) return fail(c, PITCH, "Fail to detect pitch: " + c.job.input);
+        return true;
+    }
+
+    // resample the sample to the exact pitch of the root key,
+    // the sf2 file get a pitch correction of 0
+    bool retune(Context& c) {
+        if (!c.job.retune || !c.af.buffer.frames()) return true;
+        const auto t = Clock::now();
+        // the exact deviation of the detected pitch, or the one given with the root key
+        const double target = 440.0 * std::pow(2.0, (c.result.rootKey - 69) / 12.0);
+        double cents = c.result.pitchCorrection;
+        if (!c.job.rootKey && c.result.frequency > 0.0f)
+            cents = 1200.0 * std::log2(c.result.frequency / target);
+        if (std::fabs(cents) >= 0.01) {
+            const AudioBuffer& in = c.af.buffer;
+            const uint32_t frames = Retune::outputFrames(in.frames(), cents);
+            AudioBuffer out;
+            if (!frames || !out.allocate(in.channels(), frames))
+                return fail(c, RETUNE, "Fail to retune: " + c.job.input);
+            for (uint32_t ch = 0; ch < in.channels(); ch++)
+                Retune::process(in.channel(ch), in.frames(), 1, cents,
+                                    c.af.getQuality(), retuneThreads, out.channel(ch));
+            c.af.buffer = std::move(out);
+            c.af.samplesize = frames;
+            const double r = Retune::ratio(cents);
+            c.job.loopStart = (uint32_t)std::lround(c.job.loopStart * r);
+            c.job.loopEnd = (uint32_t)std::lround(c.job.loopEnd * r);
+            c.result.sampleSize = frames;
+            c.result.frequency = (float)target;
+        }
+        c.result.pitchCorrection = 0;
+        c.result.retuneTime = ms(t);
+        return true;
+    }
+
+    // cut the leading and trailing silence and normalize the peak, in place
+    bool trim(Context& c) {
+        AudioBuffer& b = c.af.buffer;
+        if ((!c.job.trim && !c.job.normalize) || !b.frames()) return true;
+        const auto t = Clock::now();
+        const uint32_t n = b.frames();
+        if (c.job.trim) {
+            const float threshold = (float)std::pow(10.0, c.job.trimThreshold / 20.0);
+            // the first and the last frame with a channel above the threshold
+            size_t first = n;
+            size_t last = 0;
+            for (uint32_t ch = 0; ch < b.channels(); ch++) {
+                const size_t f = Loudness::firstAbove(b.channel(ch), n, threshold);
+                if (f == n) continue;
+                first = std::min(first, f);
+                last = std::max(last, Loudness::lastAbove(b.channel(ch), n, threshold));
+            }
+            // keep silent files as they are
+            if (first < n) {
+                const uint32_t start = (uint32_t)first;
+                const uint32_t end = (uint32_t)last + 1;
+                b.crop(start, end - start);
+                c.result.trimStart = start;
+                c.result.trimEnd = c.af.samplesize - end;
+                c.af.samplesize = end - start;
+                c.result.sampleSize = c.af.samplesize;
+                // the loop points follow the cut, loopEnd 0 stay the end of the sample
+                c.job.loopStart = c.job.loopStart > start ? std::min(c.job.loopStart - start, end - start) : 0;
+                if (c.job.loopEnd) c.job.loopEnd = c.job.loopEnd > start ?
+                                        std::min(c.job.loopEnd - start, end - start) : 0;
+            }
+        }
+        float peak = 0.0f;
+        for (uint32_t ch = 0; ch < b.channels(); ch++)
+            peak = std::max(peak, Loudness::peak(b.channel(ch), b.frames()));
+        c.result.peak = peak > 0.0f ? std::max(Loudness::FLOOR, 20.0 * std::log10(peak)) : Loudness::FLOOR;
+        if (c.job.normalize && peak > 0.0f) {
+            const float g = (float)(std::pow(10.0, c.job.normalizeLevel / 20.0) / peak);
+            for (uint32_t ch = 0; ch < b.channels(); ch++) {
+                float* s = b.channel(ch);
+                for (uint32_t i = 0; i < b.frames(); i++) s[i] *= g;
+            }
+            c.result.normalizeGain = 20.0 * std::log10(g);
+        }
+        c.result.trimTime = ms(t);
+        return true;
+    }
+
+    // write the sf2 file
+    bool write(Context& c) {
+        uint32_t loopEnd = c.job.loopEnd ? std::min(c.job.loopEnd, c.af.samplesize) : c.af.samplesize;
+        uint32_t loopStart = std::min(c.job.loopStart, loopEnd);
+        if (directIO) c.af.swf.setDirectIO(true);
+        c.result.stereo = c.job.stereo && c.af.channels == 2;
+        const bool ok = c.af.savesf2(c.job.output, loopStart, loopEnd, c.af.samplerate, c.job.gain,
+                    c.result.rootKey, c.job.chorus, c.job.reverb, c.result.pitchCorrection,
+                    c.result.stereo);
+        c.result.convertTime = c.af.swf.convertTime;
+        c.result.writeTime = c.af.swf.writeTime;
+        c.result.bytesWritten = c.af.swf.bytesWritten;
+        if (!ok) return fail(c, WRITE, "Fail to write: " + AudioFile::sf2Name(c.job.output));
+        c.result.ok = true;
+        return true;
+    }
+
+    // run all stages in the calling thread
+    bool run(Context& c) {
+        const auto t = Clock::now();
+        const bool ok = pipelined && !sequentialOnly(c.job) ? runPipelined(c) :
+                            decode(c) && analyse(c) && retune(c) && trim(c) && write(c);
+        c.result.totalTime = ms(t);
+        return ok;
+    }
+
+    // run all stages overlapped, the sample data is streamed to disk.
+    // The cache and O_DIRECT are not used here, on platforms without
+    // streaming support, for retune, trim and normalize (they need the
+    // whole sample before the data is written) and for stereo (the stream
+    // is mono) this fall back to the sequential stages
+    bool runPipelined(Context& c) {
+        if (sequentialOnly(c.job)) return decode(c) && analyse(c) && retune(c) && trim(c) && write(c);
+        #if defined(_WIN32)
+        return decode(c) && analyse(c) && write(c);
+        #else
+        Pipeline p;
+        p.setQuality(c.job.quality);
+        const std::string sf2file = AudioFile::sf2Name(c.job.output);
+        const bool ok = p.run(c.job.input, c.job.sampleRate, c.job.gain, c.af.swf, sf2file, c.pt);
+        // the stages overlap, so these are the busy times of the stage threads
+        c.stats = p.stats;
+        c.result.decodeTime = p.stats.stage[Pipeline::DECODE].busy * 1000.0;
+        c.result.resampleTime = p.stats.stage[Pipeline::RESAMPLE].busy * 1000.0;
+        c.result.pitchTime = p.stats.stage[Pipeline::ANALYSE].busy * 1000.0;
+        c.result.convertTime = p.stats.stage[Pipeline::ENCODE].busy * 1000.0;
+        c.result.writeTime = p.stats.stage[Pipeline::WRITE].busy * 1000.0;
+        if (!ok) return fail(c, READ, "Fail to read: " + c.job.input);
+        c.result.sourceRate = p.sourceRate;
+        c.result.sampleRate = p.samplerate;
+        c.result.sampleSize = p.samplesize;
+        c.result.frequency = p.frequency;
+        c.result.rootKey = p.rootKey;
+        c.result.pitchCorrection = p.pitchCorrection;
+        if (c.job.rootKey) {
+            c.result.rootKey = c.job.rootKey;
+            c.result.pitchCorrection = c.job.pitchCorrection;
+        }
+        if (!c.result.rootKey) {
+            c.af.swf.abort_stream();
+            return fail(c, PITCH, "Fail to detect pitch: " + c.job.input);
+        }
+        uint32_t loopEnd = c.job.loopEnd ? std::min(c.job.loopEnd, p.samplesize) : p.samplesize;
+        uint32_t loopStart = std::min(c.job.loopStart, loopEnd);
+        const auto t = Clock::now();
+        if (!c.af.swf.end_stream(p.samplesize, loopStart, loopEnd, p.samplerate, "Sample",
+                    c.result.rootKey, c.job.chorus, c.job.reverb, c.result.pitchCorrection)) {
+            return fail(c, WRITE, "Fail to write: " + sf2file);
+        }
+        c.result.writeTime += ms(t);
+        c.result.bytesWritten = c.af.swf.bytesWritten;
+        c.result.ok = true;
+        return true;
+        #endif
+    }
+
+    // run all jobs in the pool, every stage is a task chained to the stage before
+    void runBatch(TaskPool& pool, std::vector<std::shared_ptr<Context>>& jobs) {
+        std::vector<TaskFuture<bool>> done;
+        done.reserve(jobs.size());
+        for (auto& ctx : jobs) {
+            std::shared_ptr<Context> c = ctx;
+            if (pipelined) {
+                done.push_back(pool.submit([this, c]() {
+                        c->started = Clock::now();
+                        const bool ok = runPipelined(*c);
+                        c->result.totalTime = ms(c->started);
+                        return ok;
+                    }));
+                continue;
+            }
+            done.push_back(pool.submit([this, c]() {
+                    c->started = Clock::now();
+                    return decode(*c);
+                })
+                .then([this, c](bool ok) { return ok && analyse(*c) && retune(*c) && trim(*c); })
+                .then([this, c](bool ok) {
+                    ok = ok && write(*c);
+                    c->result.totalTime = ms(c->started);
+                    return ok;
+                }));
+        }
+        for (auto& f : done) f.get();
+    }
+
+    // decode, analyse and retune all jobs in the pool, every note become a zone
+    // of one instrument. The float buffer of a job is converted to 16 bit and
+    // released as soon as its analysis is done, so a 88 note set is never held
+    // as float. Notes with the same root key become velocity layers
+    bool runInstrument(TaskPool& pool, std::vector<std::shared_ptr<Context>>& jobs,
+                            const std::string& output, Instrument& inst) {
+        const auto t = Clock::now();
+        inst = Instrument();
+        inst.output = AudioFile::sf2Name(output);
+        std::vector<InstrumentWriter::Zone> zones(jobs.size());
+        std::vector<TaskFuture<bool>> done;
+        done.reserve(jobs.size());
+        for (size_t i = 0; i < jobs.size(); i++) {
+            std::shared_ptr<Context> c = jobs[i];
+            InstrumentWriter::Zone* z = &zones[i];
+            c->job.output = inst.output;
+            c->job.zone = true;
+            done.push_back(pool.submit([this, c]() {
+                    c->started = Clock::now();
+                    return decode(*c);
+                })
+                .then([this, c](bool ok) { return ok && analyse(*c) && retune(*c) && trim(*c); })
+                .then([c, z](bool ok) {
+                    ok = ok && zone(*c, *z);
+                    c->result.totalTime = ms(c->started);
+                    return ok;
+                }));
+        }
+        for (auto& f : done) f.get();
+        std::vector<InstrumentWriter::Zone> used;
+        for (size_t i = 0; i < jobs.size(); i++) {
+            if (!jobs[i]->result.ok) continue;
+            zones[i].id = (uint32_t)i;
+            used.push_back(std::move(zones[i]));
+        }
+        zones.clear();
+        InstrumentWriter::splitKeys(used);
+        for (const auto& z : used) {
+            Result& r = jobs[z.id]->result;
+            r.keyLow = z.keyLow;
+            r.keyHigh = z.keyHigh;
+            r.velLow = z.velLow;
+            r.velHigh = z.velHigh;
+        }
+        inst.zones = (uint32_t)used.size();
+        InstrumentWriter iw;
+        if (directIO) iw.setDirectIO(true);
+        const std::string name = std::filesystem::path(inst.output).stem().string();
+        inst.ok = iw.write_sf2(inst.output, name, used,
+                    jobs.empty() ? 500 : jobs[0]->job.chorus, jobs.empty() ? 500 : jobs[0]->job.reverb);
+        if (!inst.ok) inst.error = used.empty() ? "No zones for: " + inst.output :
+                                                  "Fail to write: " + inst.output;
+        inst.bytesWritten = iw.bytesWritten;
+        inst.writeTime = iw.writeTime;
+        inst.totalTime = ms(t);
+        return inst.ok;
+    }
+
+    // print the instrument in human readable form
+    static void print(const Instrument& inst) {
+        if (!inst.ok) {
+            std::cout << inst.error << std::endl;
+            return;
+        }
+        std::cout << "Generated: " << inst.output << " with " << inst.zones << " zones" << std::endl;
+    }
+
+    // the instrument as JSON object
+    static std::string json(const Instrument& inst) {
+        JsonWriter w;
+        w.field("ok", inst.ok);
+        w.field("output", inst.output);
+        if (!inst.ok) w.field("error", inst.error);
+        w.field("zones", inst.zones);
+        w.field("bytes_written", inst.bytesWritten);
+        w.begin("time_ms");
+        w.field("write", inst.writeTime);
+        w.field("total", inst.totalTime);
+        w.end();
+        w.field("peak_rss_kb", peakMemory());
+        return w.str();
+    }
+
+    // print the result in human readable form
+    static void print(const Context& c) {
+        const Result& r = c.result;
+        if (!r.ok) {
+            std::cout << r.error << std::endl;
+            return;
+        }
+        char s[10];
+        snprintf(s, 10, "%.2f Hz", r.frequency);
+        std::string fr = s;
+        std::cout << "  Frequency:  " << fr << std::endl;
+        std::cout << "  SampleRate:  " << std::to_string(r.sampleRate) << " Hz " << std::endl;
+        std::cout << "  Root Key:  " + std::to_string(r.rootKey) << std::endl;
+        std::cout << "  PitchCorrection:  " << std::to_string(r.pitchCorrection) << " Cent" << std::endl;
+        std::cout << "  SampleSize: " << std::to_string(r.sampleSize) << std::endl;
+        if (c.job.zone) {
+            snprintf(s, 10, "%.1f", r.loudness);
+            std::cout << "  Loudness:  " << s << " LUFS" << std::endl;
+            std::cout << "  Key Range:  " << std::to_string(r.keyLow) << " - "
+                                          << std::to_string(r.keyHigh) << std::endl;
+            std::cout << "  Velocity:  " << std::to_string(r.velLow) << " - "
+                                          << std::to_string(r.velHigh) << std::endl;
+            return;
+        }
+        std::cout << "Generated: " << c.job.output  << std::endl;
+    }
+
+    // the result as JSON object
+    static std::string json(const Context& c) {
+        JsonWriter w;
+        json(c, w);
+        return w.str();
+    }
+
+    // add the result fields to a JSON object
+    static void json(const Context& c, JsonWriter& w) {
+        const Result& r = c.result;
+        w.field("ok", r.ok);
+        w.field("input", c.job.input);
+        if (!r.ok) {
+            w.field("code", errorName(r.code));
+            w.field("error", r.error);
+        } else {
+            w.field("output", AudioFile::sf2Name(c.job.output));
+            w.field("frequency", (double)r.frequency, 2);
+            w.field("rootkey", (uint32_t)r.rootKey);
+            w.field("pitchcorrection", (int32_t)r.pitchCorrection);
+            w.field("samplerate", r.sampleRate);
+            w.field("source_rate", r.sourceRate);
+            w.field("quality", CheckResample::qualityName(c.job.quality));
+            w.field("samplesize", r.sampleSize);
+            if (c.job.stereo) w.field("stereo", r.stereo);
+            if (c.job.trim) {
+                w.field("trim_start", r.trimStart);
+                w.field("trim_end", r.trimEnd);
+            }
+            if (c.job.trim || c.job.normalize) w.field("peak_db", r.peak, 2);
+            if (c.job.normalize) w.field("normalize_gain_db", r.normalizeGain, 2);
+            if (c.job.sliceFrames) {
+                w.field("slice_start", c.job.sliceStart);
+                w.field("slice_frames", c.job.sliceFrames);
+            }
+            if (c.job.zone) {
+                w.field("key_low", (uint32_t)r.keyLow);
+                w.field("key_high", (uint32_t)r.keyHigh);
+                w.field("vel_low", (uint32_t)r.velLow);
+                w.field("vel_high", (uint32_t)r.velHigh);
+                w.field("loudness_lufs", r.loudness, 2);
+                w.field("rms_db", r.rms, 2);
+            }
+            w.field("bytes_written", r.bytesWritten);
+        }
+        w.begin("time_ms");
+        w.field("decode", r.decodeTime);
+        w.field("resample", r.resampleTime);
+        w.field("pitch", r.pitchTime);
+        w.field("retune", r.retuneTime);
+        w.field("trim", r.trimTime);
+        w.field("convert", r.convertTime);
+        w.field("write", r.writeTime);
+        w.field("total", r.totalTime);
+        w.end();
+        w.field("peak_rss_kb", peakMemory());
+    }
+
+    static const char* errorName(Error e) {
+        switch (e) {
+            case NONE: return "none";
+            case READ: return "read";
+            case PITCH: return "pitch";
+            case WRITE: return "write";
+            case RETUNE: return "retune";
+        }
+        return "unknown";
+    }
+
+    // peak resident memory of the process in kB
+    static uint64_t peakMemory() {
+        #if !defined(_WIN32)
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+            #if defined(__APPLE__)
+            return (uint64_t)ru.ru_maxrss / 1024;
+            #else
+            return (uint64_t)ru.ru_maxrss;
+            #endif
+        }
+        #endif
+        return 0;
+    }
+
+    // output path for a input file in batch mode
+    static std::string outputFor(const std::string& input, const std::string& dir) {
+        std::filesystem::path p(input);
+        return (std::filesystem::path(dir) / p.stem()).string() + ".sf2";
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static double ms(Clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    }
+
+    // convert the first channel (or with stereo both) of a analysed job
+    // to a instrument zone and release the float buffer
+    static bool zone(Context& c, InstrumentWriter::Zone& z) {
+        const auto t = Clock::now();
+        uint32_t loopEnd = c.job.loopEnd ? std::min(c.job.loopEnd, c.af.samplesize) : c.af.samplesize;
+        uint32_t loopStart = std::min(c.job.loopStart, loopEnd);
+        const AudioBuffer& b = c.af.buffer;
+        c.result.stereo = c.job.stereo && b.channels() == 2;
+        const bool ok = c.result.stereo ?
+                z.sample.convertStereo(b.channel(0), b.channel(1), z.right, c.job.gain,
+                                            c.af.samplerate, b.frames(), loopStart, loopEnd) :
+                z.sample.convert(b.channel(0), 1, c.job.gain, c.af.samplerate,
+                                            b.frames(), loopStart, loopEnd);
+        if (!ok) return fail(c, READ, "Fail to read: " + c.job.input);
+        z.name = c.job.name.empty() ? std::filesystem::path(c.job.input).stem().string() : c.job.name;
+        z.rootKey = c.result.rootKey;
+        z.pitchCorrection = c.result.pitchCorrection;
+        z.loudness = c.result.loudness;
+        c.af.buffer.release();
+        c.af.samplesize = 0;
+        c.result.convertTime = ms(t);
+        c.result.ok = true;
+        return true;
+    }
+
+    // the jobs the pipeline can't stream
+    static bool sequentialOnly(const Job& j) {
+        return j.retune || j.trim || j.normalize || j.stereo;
+    }
+
+    static bool fail(Context& c, Error code, const std::string& msg) {
+        c.result.code = code;
+        c.result.error = msg;
+        return false;
+    }
+
+    std::string cacheDir;
+    uint64_t cacheSize;
+    bool useCache;
+    bool directIO;
+    bool pipelined;
+    uint32_t retuneThreads;
+};
+
+#endif
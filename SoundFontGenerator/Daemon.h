@@ -0,0 +1,471 @@
+/*
+ * Daemon.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Daemon - serve conversion jobs over a Unix domain socket
+
+  Every line a client send is a JSON job, every job get one
+  JSON line back (the order may differ, use "id" to match them):
+
+    {"id":1, "input":"a.wav", "output":"a.sf2", "rate":48000,
+     "rootkey":"auto", "pitchcorrection":0, "chorus":500,
+     "reverb":500, "loop_start":0, "loop_end":0, "gain":0.0}
+
+  only "input" is required, rootkey could be "auto" or 1 - 127,
+  gain is in dB, loop_end 0 means end of the sample.
+  further keys (with the default):
+    "quality":"standard"     "draft", "standard", "mastering" or a filter length
+    "retune":false           bake the pitch correction into the sample
+    "trim":false             cut the silence at both ends,
+    "trim_threshold":-60.0   below this level in dB
+    "normalize":false        scale the peak before the gain is applied,
+    "normalize_level":-1.0   to this level in dBFS
+    "stereo":false           keep both channels of a stereo file
+  {"cmd":"ping"} and {"cmd":"shutdown"} control the daemon,
+  {"cmd":"trace", "file":"t.json"} dump the trace (needs --trace).
+
+  The worker threads, the job contexts (with the FFTW plan of
+  the pitch tracker and the sf2 image buffer) stay alive between
+  jobs, the resampler filter tables of recent rate pairs stay
+  resident (bounded, a job with a odd rate don't pin its table).
+  Daemon::submit() is the matching client.
+****************************************************************/
+
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <filesystem>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <condition_variable>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include <zita-resampler/resampler.h>
+
+#include "Converter.h"
+#include "Json.h"
+#include "TaskPool.h"
+#include "Trace.h"
+
+#pragma once
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#if !defined(_WIN32)
+
+class Daemon {
+public:
+    Daemon(Converter& c, TaskPool& p)
+        : conv(c), pool(p), listenFd(-1), nextId(0), active(0), served(0) {}
+
+    ~Daemon() {
+        closeListen();
+    }
+
+    // create the socket, a stale socket file is replaced
+    bool listen(const std::string& path) {
+        sockaddr_un addr;
+        if (!address(path, addr)) return false;
+        struct stat st;
+        if (lstat(path.c_str(), &st) == 0) {
+            if (!S_ISSOCK(st.st_mode)) {
+                std::cerr << "Error: " << path << " exists and isn't a socket" << std::endl;
+                return false;
+            }
+            int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+            const bool used = probe >= 0 &&
+                        connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+            if (probe >= 0) ::close(probe);
+            if (used) {
+                std::cerr << "Error: a daemon is already listening on " << path << std::endl;
+                return false;
+            }
+            unlink(path.c_str());
+        }
+        listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listenFd < 0 || bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 ||
+                            ::listen(listenFd, 64) != 0) {
+            std::cerr << "Error: could not listen on " << path << ": " << strerror(errno) << std::endl;
+            closeListen();
+            return false;
+        }
+        socketPath = path;
+        return true;
+    }
+
+    // serve until stop() is called or a shutdown command is received
+    int run() {
+        if (listenFd < 0) return 1;
+        if (pipe(stopPipe()) != 0) return 1;
+        std::cout << "listening on " << socketPath << std::endl;
+        while (true) {
+            pollfd fds[2] = {{listenFd, POLLIN, 0}, {stopPipe()[0], POLLIN, 0}};
+            if (poll(fds, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            if (fds[1].revents) break;
+            if (!(fds[0].revents & POLLIN)) continue;
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) continue;
+            startConnection(fd);
+        }
+        closeListen();
+        // wake up the readers, wait for them and for the queued jobs
+        std::unique_lock<std::mutex> lk(lock);
+        for (auto& c : conns) {
+            if (auto conn = c.second.lock()) shutdown(conn->fd, SHUT_RD);
+        }
+        idle.wait(lk, [this]() { return conns.empty() && !active; });
+        lk.unlock();
+        ::close(stopPipe()[0]);
+        ::close(stopPipe()[1]);
+        std::cout << "served " << served.load() << " jobs" << std::endl;
+        return 0;
+    }
+
+    // stop the daemon, this is save to call from a signal handler
+    static void stop() {
+        if (stopPipe()[1] >= 0) {
+            const char c = 'q';
+            ssize_t r = write(stopPipe()[1], &c, 1);
+            (void) r;
+        }
+    }
+
+    // client: send the JSON jobs read from in, print the replies,
+    // return 0 when all jobs succeeded
+    static int submit(const std::string& path, std::istream& in) {
+        sockaddr_un addr;
+        if (!address(path, addr)) return 1;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+            std::cerr << "Error: could not connect to " << path << ": " << strerror(errno) << std::endl;
+            if (fd >= 0) ::close(fd);
+            return 1;
+        }
+        std::string line;
+        size_t sent = 0;
+        while (std::getline(in, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+            line += '\n';
+            if (!sendAll(fd, line)) break;
+            sent++;
+        }
+        shutdown(fd, SHUT_WR);
+        int ret = 0;
+        size_t received = 0;
+        LineReader reader;
+        while (reader.next(fd, line)) {
+            std::cout << line << std::endl;
+            JsonObject o;
+            if (!o.parse(line) || !o.getBool("ok")) ret = 1;
+            received++;
+        }
+        ::close(fd);
+        if (received < sent) ret = 1;
+        return ret;
+    }
+
+private:
+    // one client connection, closed when the reader and all its jobs are done
+    struct Connection {
+        int fd;
+        std::mutex wl;
+
+        explicit Connection(int f) : fd(f) {}
+        ~Connection() {
+            ::close(fd);
+        }
+
+        void send(const std::string& line) {
+            std::lock_guard<std::mutex> lk(wl);
+            sendAll(fd, line + "\n");
+        }
+    };
+
+    // split the stream from a socket into lines
+    class LineReader {
+    public:
+        // return false on EOF or error
+        bool next(int fd, std::string& line) {
+            while (true) {
+                const size_t nl = buf.find('\n');
+                if (nl != std::string::npos) {
+                    line = buf.substr(0, nl);
+                    buf.erase(0, nl + 1);
+                    return true;
+                }
+                if (buf.size() > MAX_LINE) return false;
+                char tmp[4096];
+                const ssize_t r = read(fd, tmp, sizeof(tmp));
+                if (r < 0 && errno == EINTR) continue;
+                if (r <= 0) {
+                    if (buf.empty()) return false;
+                    line.swap(buf);
+                    buf.clear();
+                    return true;
+                }
+                buf.append(tmp, r);
+            }
+        }
+
+    private:
+        std::string buf;
+    };
+
+    static constexpr size_t MAX_LINE = 64 * 1024;
+
+    Converter& conv;
+    TaskPool& pool;
+    int listenFd;
+    std::string socketPath;
+
+    std::mutex lock;
+    std::condition_variable idle;
+    std::map<uint64_t, std::weak_ptr<Connection>> conns;
+    uint64_t nextId;
+    uint32_t active;
+    std::atomic<uint64_t> served;
+
+    // idle job contexts
+    std::mutex contextLock;
+    std::vector<std::unique_ptr<Converter::Context>> contexts;
+
+    typedef std::chrono::steady_clock Clock;
+
+    static double ms(Clock::time_point from, Clock::time_point to) {
+        return std::chrono::duration<double, std::milli>(to - from).count();
+    }
+
+    static int* stopPipe() {
+        static int fds[2] = {-1, -1};
+        return fds;
+    }
+
+    static bool address(const std::string& path, sockaddr_un& addr) {
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+            std::cerr << "Error: invalid socket path " << path << std::endl;
+            return false;
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size());
+        return true;
+    }
+
+    static bool sendAll(int fd, const std::string& s) {
+        const char* p = s.data();
+        size_t left = s.size();
+        while (left) {
+            const ssize_t r = ::send(fd, p, left, MSG_NOSIGNAL);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += r;
+            left -= r;
+        }
+        return true;
+    }
+
+    void closeListen() {
+        if (listenFd < 0) return;
+        ::close(listenFd);
+        listenFd = -1;
+        if (!socketPath.empty()) unlink(socketPath.c_str());
+    }
+
+    void startConnection(int fd) {
+        auto conn = std::make_shared<Connection>(fd);
+        uint64_t id;
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            id = nextId++;
+            conns[id] = conn;
+        }
+        std::thread([this, conn, id]() {
+            LineReader reader;
+            std::string line;
+            while (reader.next(conn->fd, line)) {
+                if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+                handle(conn, line);
+            }
+            std::lock_guard<std::mutex> lk(lock);
+            conns.erase(id);
+            idle.notify_all();
+        }).detach();
+    }
+
+    // copy the "id" of a request into the reply
+    static void replyId(const JsonObject& o, JsonWriter& w) {
+        if (!o.has("id")) return;
+        if (o.isString("id")) w.field("id", o.getString("id"));
+        else w.fieldRaw("id", o.raw("id"));
+    }
+
+    static std::string error(const JsonObject& o, const std::string& msg) {
+        JsonWriter w;
+        replyId(o, w);
+        w.field("ok", false);
+        w.field("error", msg);
+        return w.str();
+    }
+
+    // build a job from the request
+    static bool parseJob(const JsonObject& o, Converter::Job& job, std::string& err) {
+        job.input = o.getString("input");
+        if (job.input.empty()) {
+            err = "missing input";
+            return false;
+        }
+        job.output = o.getString("output");
+        if (job.output.empty()) {
+            std::filesystem::path p(job.input);
+            job.output = Converter::outputFor(job.input, p.parent_path().string());
+        }
+        const double rate = o.getNumber("rate", 0.0);
+        if (rate < 0.0 || rate > 384000.0) {
+            err = "invalid rate";
+            return false;
+        }
+        job.sampleRate = (uint32_t)rate;
+        // a tier name or the filter length, as string or number
+        if (o.has("quality") && !CheckResample::parseQuality(o.raw("quality"), &job.quality)) {
+            err = "invalid quality";
+            return false;
+        }
+        if (o.has("rootkey") && o.getString("rootkey") != "auto") {
+            const double key = o.getNumber("rootkey", -1.0);
+            if (key < 1.0 || key > 127.0) {
+                err = "invalid rootkey";
+                return false;
+            }
+            job.rootKey = (uint8_t)key;
+            job.pitchCorrection = (int16_t)std::clamp(o.getNumber("pitchcorrection", 0.0), -50.0, 50.0);
+        }
+        job.chorus = (uint16_t)std::clamp(o.getNumber("chorus", 500.0), 0.0, 1000.0);
+        job.reverb = (uint16_t)std::clamp(o.getNumber("reverb", 500.0), 0.0, 1000.0);
+        job.loopStart = (uint32_t)std::max(0.0, o.getNumber("loop_start", 0.0));
+        job.loopEnd = (uint32_t)std::max(0.0, o.getNumber("loop_end", 0.0));
+        job.gain = std::pow(1e+01, 0.05 * o.getNumber("gain", 0.0));
+        job.retune = o.getBool("retune", false);
+        job.trim = o.getBool("trim", false);
+        job.trimThreshold = o.getNumber("trim_threshold", -60.0);
+        job.normalize = o.getBool("normalize", false);
+        job.normalizeLevel = std::min(0.0, o.getNumber("normalize_level", -1.0));
+        job.stereo = o.getBool("stereo", false);
+        return true;
+    }
+
+    void handle(const std::shared_ptr<Connection>& conn, const std::string& line) {
+        JsonObject o;
+        if (!o.parse(line)) {
+            conn->send(error(o, "invalid request: " + o.lastError()));
+            return;
+        }
+        const std::string cmd = o.getString("cmd");
+        if (cmd == "ping") {
+            JsonWriter w;
+            replyId(o, w);
+            w.field("ok", true);
+            w.field("workers", pool.size());
+            w.field("served", served.load());
+            conn->send(w.str());
+            return;
+        } else if (cmd == "trace") {
+            // dump the trace recorded so far
+            JsonWriter w;
+            replyId(o, w);
+            const std::string file = o.getString("file");
+            const bool ok = Trace::enabled() && !file.empty() && Trace::dump(file);
+            w.field("ok", ok);
+            if (!ok) w.field("error", Trace::enabled() ? "could not write trace" : "tracing is disabled");
+            conn->send(w.str());
+            return;
+        } else if (cmd == "shutdown") {
+            JsonWriter w;
+            replyId(o, w);
+            w.field("ok", true);
+            conn->send(w.str());
+            stop();
+            return;
+        } else if (!cmd.empty()) {
+            conn->send(error(o, "unknown cmd " + cmd));
+            return;
+        }
+        Converter::Job job;
+        std::string err;
+        if (!parseJob(o, job, err)) {
+            conn->send(error(o, err));
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lk(lock);
+            active++;
+        }
+        const auto received = Clock::now();
+        pool.submit([this, conn, job, o, received]() {
+            auto c = takeContext();
+            c->job = job;
+            const auto start = Clock::now();
+            conv.run(*c);
+            const auto done = Clock::now();
+            JsonWriter w;
+            replyId(o, w);
+            Converter::json(*c, w);
+            w.field("queue_ms", ms(received, start));
+            w.field("total_ms", ms(received, done));
+            giveContext(std::move(c));
+            conn->send(w.str());
+            served++;
+            std::lock_guard<std::mutex> lk(lock);
+            active--;
+            idle.notify_all();
+        });
+    }
+
+    std::unique_ptr<Converter::Context> takeContext() {
+        {
+            std::lock_guard<std::mutex> lk(contextLock);
+            if (!contexts.empty()) {
+                auto c = std::move(contexts.back());
+                contexts.pop_back();
+                return c;
+            }
+        }
+        return std::make_unique<Converter::Context>();
+    }
+
+    void giveContext(std::unique_ptr<Converter::Context> c) {
+        c->reset();
+        std::lock_guard<std::mutex> lk(contextLock);
+        contexts.push_back(std::move(c));
+    }
+};
+
+#endif
+
+#endif
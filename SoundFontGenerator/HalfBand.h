@@ -0,0 +1,177 @@
+/*
+ * HalfBand.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  HalfBand - 2x up/down sampling with a linear phase half-band FIR
+
+  Every second tap of a half-band filter is zero and the center tap
+  is 0.5, so the polyphase form need only the odd taps, mirrored
+  around the center. Upsampling copy the even output frames and
+  filter the odd ones, downsampling filter only the kept frames.
+  The filter is a Kaiser windowed sinc, the length and the window
+  follow the resampler quality (16 - 96) like the zita filter length.
+
+  The filter is centered (no delay), the signal is zero padded at
+  both ends. A stage could be fed block wise, flush() emit the tail,
+  the output is the same as for the whole buffer at once:
+  2 * frames frames up, (frames + 1) / 2 frames down.
+****************************************************************/
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#pragma once
+
+#ifndef HALFBAND_H
+#define HALFBAND_H
+
+class HalfBand {
+public:
+    HalfBand() : up(true), taps(0), channels(0), pos(0), pad(0), reach(0), inFrames(0), outFrames(0) {}
+
+    // up = 2x upsampling, else 2x downsampling
+    void setup(bool up_, uint32_t quality, uint32_t chan) {
+        up = up_;
+        channels = chan;
+        design(quality);
+        // frames needed before and after the center frame
+        pad = up ? taps : 2 * taps - 1;
+        reach = up ? taps : 2 * taps - 1;
+        reset();
+    }
+
+    void reset() {
+        buf.assign((size_t)pad * channels, 0.0f);
+        pos = pad;
+        inFrames = 0;
+        outFrames = 0;
+    }
+
+    // output frames for frames input frames
+    static uint32_t outputSize(bool up, uint32_t frames) {
+        return up ? 2 * frames : (frames + 1) / 2;
+    }
+
+    // append frames input frames, write the ready output to out,
+    // return the number of output frames
+    uint32_t process(const float* in, uint32_t frames, float* out) {
+        buf.insert(buf.end(), in, in + (size_t)frames * channels);
+        inFrames += frames;
+        return run(out, UINT32_MAX);
+    }
+
+    // pad with zeros and emit the remaining output frames
+    uint32_t flush(float* out) {
+        buf.resize(buf.size() + (size_t)(reach + 1) * channels, 0.0f);
+        const uint32_t want = outputSize(up, (uint32_t)inFrames);
+        return run(out, want > outFrames ? want - (uint32_t)outFrames : 0);
+    }
+
+    // input frames not consumed yet (the lookahead of the filter)
+    uint32_t pendingFrames() const {
+        return (uint32_t)(buf.size() / channels) - pos;
+    }
+
+    // upper bound of the output of process() for frames input frames,
+    // or of flush() for the pending frames
+    uint32_t maxOutput(uint32_t frames) const {
+        return outputSize(up, frames);
+    }
+
+private:
+    bool up;
+    uint32_t taps;          // odd taps on each side of the center
+    uint32_t channels;
+    uint32_t pos;           // center frame in buf
+    uint32_t pad;
+    uint32_t reach;
+    uint64_t inFrames;
+    uint64_t outFrames;
+    std::vector<float> coef;
+    std::vector<float> buf;
+
+    static double bessel0(double x) {
+        double sum = 1.0;
+        double term = 1.0;
+        for (int k = 1; k < 50; k++) {
+            term *= (x / (2.0 * k)) * (x / (2.0 * k));
+            sum += term;
+            if (term < sum * 1e-12) break;
+        }
+        return sum;
+    }
+
+    // Kaiser windowed half-band sinc, coef[k] belong to the offsets +-(2k+1)
+    void design(uint32_t quality) {
+        quality = std::clamp<uint32_t>(quality, 16, 96);
+        taps = quality / 2;
+        // stopband attenuation in dB the window aim for
+        const double att = std::min(140.0, 30.0 + 2.0 * quality);
+        const double beta = 0.1102 * (att - 8.7);
+        const double len = 2.0 * taps;
+        coef.resize(taps);
+        double sum = 0.0;
+        for (uint32_t k = 0; k < taps; k++) {
+            const double j = 2.0 * k + 1.0;
+            const double r = j / len;
+            const double w = bessel0(beta * std::sqrt(std::max(0.0, 1.0 - r * r))) / bessel0(beta);
+            coef[k] = std::sin(M_PI * j / 2.0) / (M_PI * j) * w;
+            sum += coef[k];
+        }
+        // unity gain at DC: the odd taps of both sides sum up to 0.5
+        for (auto& c : coef) c = (float)(c * 0.25 / sum);
+    }
+
+    uint32_t run(float* out, uint32_t limit) {
+        const uint32_t ch = channels;
+        const uint32_t frames = (uint32_t)(buf.size() / ch);
+        const float* b = buf.data();
+        uint32_t n = 0;
+        if (up) {
+            // y[2i] = x[i], y[2i+1] = sum g[k] * (x[i-k] + x[i+1+k]), g = 2 * coef
+            while (pos + reach < frames && n < limit) {
+                for (uint32_t c = 0; c < ch; c++) {
+                    float s = 0.0f;
+                    for (uint32_t k = 0; k < taps; k++)
+                        s += coef[k] * (b[(size_t)(pos - k) * ch + c] + b[(size_t)(pos + 1 + k) * ch + c]);
+                    out[(size_t)n * ch + c] = b[(size_t)pos * ch + c];
+                    out[(size_t)(n + 1) * ch + c] = 2.0f * s;
+                }
+                n += 2;
+                pos++;
+            }
+        } else {
+            // y[i] = 0.5 * x[2i] + sum coef[k] * (x[2i-2k-1] + x[2i+2k+1])
+            while (pos + reach < frames && n < limit) {
+                for (uint32_t c = 0; c < ch; c++) {
+                    float s = 0.0f;
+                    for (uint32_t k = 0; k < taps; k++) {
+                        const uint32_t d = 2 * k + 1;
+                        s += coef[k] * (b[(size_t)(pos - d) * ch + c] + b[(size_t)(pos + d) * ch + c]);
+                    }
+                    out[(size_t)n * ch + c] = 0.5f * b[(size_t)pos * ch + c] + s;
+                }
+                n++;
+                pos += 2;
+            }
+        }
+        outFrames += n;
+        // keep the history for the next block
+        const uint32_t drop = std::min(pos, frames) - pad;
+        if (drop) {
+            buf.erase(buf.begin(), buf.begin() + (size_t)drop * ch);
+            pos -= drop;
+        }
+        return n;
+    }
+};
+
+#endif
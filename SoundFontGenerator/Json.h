@@ -0,0 +1,340 @@
+/*
+ * Json.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Json - minimal JSON support for the job API and the metrics output
+
+  JsonObject parse a single flat object (one line of a job stream),
+  the values could be strings, numbers, true/false or null.
+  JsonWriter build a object into a string, nested objects are
+  opened with begin(key) and closed with end().
+****************************************************************/
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cmath>
+
+#pragma once
+
+#ifndef JSON_H
+#define JSON_H
+
+class JsonObject {
+public:
+    enum Type { STRING, NUMBER, BOOL, NUL };
+
+    // parse a flat JSON object, return false and set error on invalid input
+    bool parse(const std::string& s) {
+        values.clear();
+        error.clear();
+        p = s.c_str();
+        end = p + s.size();
+        skipSpace();
+        if (!expect('{')) return fail("expected '{'");
+        skipSpace();
+        if (peek() == '}') {
+            p++;
+            return trailing();
+        }
+        while (true) {
+            skipSpace();
+            std::string key;
+            if (!parseString(key)) return fail("expected a key");
+            skipSpace();
+            if (!expect(':')) return fail("expected ':'");
+            skipSpace();
+            Value v;
+            if (!parseValue(v)) return false;
+            values[key] = v;
+            skipSpace();
+            if (expect(',')) continue;
+            if (expect('}')) break;
+            return fail("expected ',' or '}'");
+        }
+        return trailing();
+    }
+
+    const std::string& lastError() const {
+        return error;
+    }
+
+    bool has(const std::string& key) const {
+        return values.find(key) != values.end();
+    }
+
+    // the value as written, for strings without the quotes
+    std::string raw(const std::string& key) const {
+        auto it = values.find(key);
+        return it == values.end() ? std::string() : it->second.text;
+    }
+
+    bool isString(const std::string& key) const {
+        auto it = values.find(key);
+        return it != values.end() && it->second.type == STRING;
+    }
+
+    std::string getString(const std::string& key, const std::string& def = "") const {
+        auto it = values.find(key);
+        if (it == values.end() || it->second.type != STRING) return def;
+        return it->second.text;
+    }
+
+    double getNumber(const std::string& key, double def = 0.0) const {
+        auto it = values.find(key);
+        if (it == values.end() || it->second.type != NUMBER) return def;
+        return std::strtod(it->second.text.c_str(), nullptr);
+    }
+
+    bool getBool(const std::string& key, bool def = false) const {
+        auto it = values.find(key);
+        if (it == values.end() || it->second.type != BOOL) return def;
+        return it->second.text == "true";
+    }
+
+private:
+    struct Value {
+        Type type = NUL;
+        std::string text;
+    };
+
+    std::map<std::string, Value> values;
+    std::string error;
+    const char* p = nullptr;
+    const char* end = nullptr;
+
+    char peek() const {
+        return p < end ? *p : '\0';
+    }
+
+    bool expect(char c) {
+        if (peek() != c) return false;
+        p++;
+        return true;
+    }
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) p++;
+    }
+
+    bool fail(const char* msg) {
+        error = msg;
+        return false;
+    }
+
+    bool trailing() {
+        skipSpace();
+        if (p != end) return fail("trailing characters");
+        return true;
+    }
+
+    // append a code point as UTF-8
+    static void putUtf8(std::string& s, uint32_t c) {
+        if (c < 0x80) {
+            s += (char)c;
+        } else if (c < 0x800) {
+            s += (char)(0xC0 | (c >> 6));
+            s += (char)(0x80 | (c & 0x3F));
+        } else {
+            s += (char)(0xE0 | (c >> 12));
+            s += (char)(0x80 | ((c >> 6) & 0x3F));
+            s += (char)(0x80 | (c & 0x3F));
+        }
+    }
+
+    bool parseString(std::string& s) {
+        if (!expect('"')) return false;
+        while (p < end && *p != '"') {
+            if (*p != '\\') {
+                s += *p++;
+                continue;
+            }
+            if (++p >= end) return false;
+            switch (*p++) {
+                case '"': s += '"'; break;
+                case '\\': s += '\\'; break;
+                case '/': s += '/'; break;
+                case 'b': s += '\b'; break;
+                case 'f': s += '\f'; break;
+                case 'n': s += '\n'; break;
+                case 'r': s += '\r'; break;
+                case 't': s += '\t'; break;
+                case 'u': {
+                    if (end - p < 4) return false;
+                    char hex[5] = {p[0], p[1], p[2], p[3], 0};
+                    char* e = nullptr;
+                    uint32_t c = (uint32_t)std::strtoul(hex, &e, 16);
+                    if (e != hex + 4) return false;
+                    putUtf8(s, c);
+                    p += 4;
+                    break;
+                }
+                default: return false;
+            }
+        }
+        return expect('"');
+    }
+
+    bool literal(const char* word, Type t, Value& v) {
+        const size_t n = std::char_traits<char>::length(word);
+        if ((size_t)(end - p) < n || std::string(p, n) != word) return fail("invalid value");
+        p += n;
+        v.type = t;
+        v.text = word;
+        return true;
+    }
+
+    bool parseValue(Value& v) {
+        const char c = peek();
+        if (c == '"') {
+            v.type = STRING;
+            if (!parseString(v.text)) return fail("invalid string");
+            return true;
+        }
+        if (c == 't') return literal("true", BOOL, v);
+        if (c == 'f') return literal("false", BOOL, v);
+        if (c == 'n') return literal("null", NUL, v);
+        if (c == '-' || (c >= '0' && c <= '9')) {
+            char* e = nullptr;
+            std::strtod(p, &e);
+            if (e == p || e > end) return fail("invalid number");
+            v.type = NUMBER;
+            v.text.assign(p, (const char*)e);
+            p = e;
+            return true;
+        }
+        if (c == '{' || c == '[') return fail("nested values are not supported");
+        return fail("invalid value");
+    }
+};
+
+class JsonWriter {
+public:
+    JsonWriter() {
+        begin();
+    }
+
+    // open a nested object
+    JsonWriter& begin(const std::string& key) {
+        name(key);
+        out += '{';
+        first.push_back(true);
+        return *this;
+    }
+
+    // close the last opened object
+    JsonWriter& end() {
+        out += '}';
+        first.pop_back();
+        return *this;
+    }
+
+    JsonWriter& field(const std::string& key, const std::string& v) {
+        name(key);
+        quote(v);
+        return *this;
+    }
+
+    JsonWriter& field(const std::string& key, const char* v) {
+        return field(key, std::string(v));
+    }
+
+    JsonWriter& field(const std::string& key, bool v) {
+        name(key);
+        out += v ? "true" : "false";
+        return *this;
+    }
+
+    JsonWriter& field(const std::string& key, double v, int precision = 3) {
+        name(key);
+        if (!std::isfinite(v)) {
+            out += "null";
+            return *this;
+        }
+        char s[64];
+        snprintf(s, sizeof(s), "%.*f", precision, v);
+        out += s;
+        return *this;
+    }
+
+    JsonWriter& field(const std::string& key, int64_t v) {
+        name(key);
+        out += std::to_string(v);
+        return *this;
+    }
+
+    JsonWriter& field(const std::string& key, uint64_t v) {
+        name(key);
+        out += std::to_string(v);
+        return *this;
+    }
+
+    JsonWriter& field(const std::string& key, int32_t v) {
+        return field(key, (int64_t)v);
+    }
+
+    JsonWriter& field(const std::string& key, uint32_t v) {
+        return field(key, (uint64_t)v);
+    }
+
+    // insert a already encoded value (number, true/false, null)
+    JsonWriter& fieldRaw(const std::string& key, const std::string& v) {
+        name(key);
+        out += v;
+        return *this;
+    }
+
+    // close all open objects and return the result
+    std::string str() {
+        while (!first.empty()) end();
+        return out;
+    }
+
+private:
+    std::string out;
+    std::vector<bool> first;
+
+    void begin() {
+        out += '{';
+        first.push_back(true);
+    }
+
+    void name(const std::string& key) {
+        if (!first.back()) out += ',';
+        first.back() = false;
+        quote(key);
+        out += ':';
+    }
+
+    void quote(const std::string& s) {
+        out += '"';
+        for (unsigned char c : s) {
+            switch (c) {
+                case '"': out += "\\\""; break;
+                case '\\': out += "\\\\"; break;
+                case '\n': out += "\\n"; break;
+                case '\r': out += "\\r"; break;
+                case '\t': out += "\\t"; break;
+                default:
+                    if (c < 0x20) {
+                        char e[8];
+                        snprintf(e, sizeof(e), "\\u%04x", c);
+                        out += e;
+                    } else {
+                        out += (char)c;
+                    }
+            }
+        }
+        out += '"';
+    }
+};
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * Loudness.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Loudness - level, loudness and peak scans of a sample
+
+  The loudness follow ITU-R BS.1770: the channels are K-weighted
+  (high shelf + high pass, the coefficients are derived for any
+  Sample Rate), the mean square is taken over 400 ms blocks with
+  75 % overlap and gated at -70 LUFS and 10 LU below the ungated
+  mean. A sample shorter than one block is measured as a whole.
+  The mean squares are summed per 100 ms step in eight independent
+  lanes, so the compiler could keep them in vector registers.
+  The peak and silence scans for trimming and normalizing reduce
+  the same way, a block of eight samples is tested at once.
+****************************************************************/
+
+#include <cmath>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#pragma once
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+class Loudness {
+public:
+    // levels below this are reported as FLOOR
+    static constexpr double FLOOR = -120.0;
+
+    struct Level {
+        double lufs = FLOOR;    // gated integrated loudness
+        double rms = FLOOR;     // unweighted RMS level in dBFS
+    };
+
+    // measure the chan planes of frames frames at rate
+    static Level measure(const float* const* planes, uint32_t frames, uint32_t chan, uint32_t rate) {
+        Level l;
+        if (!planes || !frames || !chan || !rate) return l;
+        const uint32_t step = std::max<uint32_t>(1, rate / 10);
+        const uint32_t steps = (frames + step - 1) / step;
+        std::vector<double> energy(steps, 0.0);
+        std::vector<float> x(frames);
+        double sum = 0.0;
+        for (uint32_t c = 0; c < chan; c++) {
+            std::memcpy(x.data(), planes[c], (size_t)frames * sizeof(float));
+            // reduce a step in float, sum up the steps in double
+            for (uint32_t s = 0; s < steps; s++) {
+                const uint32_t o = s * step;
+                sum += sumSquares(x.data() + o, std::min(step, frames - o));
+            }
+            kWeight(x.data(), frames, rate);
+            for (uint32_t s = 0; s < steps; s++) {
+                const uint32_t o = s * step;
+                energy[s] += sumSquares(x.data() + o, std::min(step, frames - o));
+            }
+        }
+        l.rms = level(sum / ((double)frames * chan));
+        // the mean square of every 400 ms block, advanced by 100 ms
+        const uint32_t span = std::min<uint32_t>(4, steps);
+        std::vector<double> blocks;
+        blocks.reserve(steps - span + 1);
+        for (uint32_t b = 0; b + span <= steps; b++) {
+            double e = 0.0;
+            uint32_t n = 0;
+            for (uint32_t s = b; s < b + span; s++) {
+                e += energy[s];
+                n += std::min(step, frames - s * step);
+            }
+            blocks.push_back(e / n);
+        }
+        // absolute gate, then relative gate 10 LU (a tenth of the power)
+        // below the mean of the remaining blocks
+        const double absolute = power(-70.0);
+        double mean = gatedMean(blocks, absolute);
+        if (mean <= 0.0) return l;
+        mean = gatedMean(blocks, std::max(absolute, mean * 0.1));
+        l.lufs = loudness(mean);
+        return l;
+    }
+
+    // the sum of the squares, reduced in eight float lanes,
+    // meant for short blocks (a 100 ms step)
+    static double sumSquares(const float* x, uint32_t n) {
+        float acc[LANES] = {0.0f};
+        uint32_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            for (uint32_t j = 0; j < LANES; j++) acc[j] += x[i + j] * x[i + j];
+        }
+        double s = 0.0;
+        for (; i < n; i++) s += (double)x[i] * x[i];
+        for (uint32_t j = 0; j < LANES; j++) s += acc[j];
+        return s;
+    }
+
+    // the absolute peak, reduced in eight lanes
+    static float peak(const float* x, size_t n) {
+        float acc[LANES] = {0.0f};
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            for (uint32_t j = 0; j < LANES; j++) acc[j] = std::max(acc[j], std::fabs(x[i + j]));
+        }
+        float p = 0.0f;
+        for (; i < n; i++) p = std::max(p, std::fabs(x[i]));
+        for (uint32_t j = 0; j < LANES; j++) p = std::max(p, acc[j]);
+        return p;
+    }
+
+    // the index of the first sample above threshold, n when there is none
+    static size_t firstAbove(const float* x, size_t n, float threshold) {
+        size_t i = 0;
+        for (; i + LANES <= n; i += LANES) {
+            if (blockPeak(x + i) > threshold) break;
+        }
+        for (; i < n; i++) if (std::fabs(x[i]) > threshold) return i;
+        return n;
+    }
+
+    // the index of the last sample above threshold, n when there is none
+    static size_t lastAbove(const float* x, size_t n, float threshold) {
+        size_t i = n;
+        for (; i >= LANES; i -= LANES) {
+            if (blockPeak(x + i - LANES) > threshold) break;
+        }
+        while (i--) if (std::fabs(x[i]) > threshold) return i;
+        return n;
+    }
+
+private:
+    static constexpr uint32_t LANES = 8;
+
+    static inline float blockPeak(const float* x) {
+        float p[LANES];
+        for (uint32_t j = 0; j < LANES; j++) p[j] = std::fabs(x[j]);
+        for (uint32_t w = LANES / 2; w; w /= 2)
+            for (uint32_t j = 0; j < w; j++) p[j] = std::max(p[j], p[j + w]);
+        return p[0];
+    }
+
+    static double level(double meanSquare) {
+        return meanSquare > 0.0 ? std::max(FLOOR, 10.0 * std::log10(meanSquare)) : FLOOR;
+    }
+
+    static double loudness(double meanSquare) {
+        return meanSquare > 0.0 ? std::max(FLOOR, -0.691 + 10.0 * std::log10(meanSquare)) : FLOOR;
+    }
+
+    // the mean square of a block with the given loudness
+    static double power(double lufs) {
+        return std::pow(10.0, (lufs + 0.691) / 10.0);
+    }
+
+    static double gatedMean(const std::vector<double>& blocks, double gate) {
+        double sum = 0.0;
+        uint32_t n = 0;
+        for (double b : blocks) {
+            if (b > gate) {
+                sum += b;
+                n++;
+            }
+        }
+        return n ? sum / n : 0.0;
+    }
+
+    // the two K-weighting stages in place, direct form II transposed
+    static void kWeight(float* x, uint32_t frames, uint32_t rate) {
+        // high shelf
+        double K = std::tan(M_PI * 1681.974450955533 / rate);
+        double Q = 0.7071752369554196;
+        const double Vh = std::pow(10.0, 3.999843853973347 / 20.0);
+        const double Vb = std::pow(Vh, 0.4996667741545416);
+        double a0 = 1.0 + K / Q + K * K;
+        biquad(x, frames, (Vh + Vb * K / Q + K * K) / a0, 2.0 * (K * K - Vh) / a0,
+                    (Vh - Vb * K / Q + K * K) / a0, 2.0 * (K * K - 1.0) / a0, (1.0 - K / Q + K * K) / a0);
+        // high pass
+        K = std::tan(M_PI * 38.13547087602444 / rate);
+        Q = 0.5003270373238773;
+        a0 = 1.0 + K / Q + K * K;
+        biquad(x, frames, 1.0, -2.0, 1.0, 2.0 * (K * K - 1.0) / a0, (1.0 - K / Q + K * K) / a0);
+    }
+
+    static void biquad(float* x, uint32_t frames, double b0, double b1, double b2,
+                                                            double a1, double a2) {
+        double z1 = 0.0, z2 = 0.0;
+        for (uint32_t i = 0; i < frames; i++) {
+            const double in = x[i];
+            const double out = b0 * in + z1;
+            z1 = b1 * in - a1 * out + z2;
+            z2 = b2 * in - a2 * out;
+            x[i] = (float)out;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,247 @@
+/*
+ * MappedAudio.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  MappedAudio - memory mapped reader for uncompressed audio files
+
+  supports PCM (8/16/24/32 bit) and 32 bit float WAV files
+  and PCM AIFF/AIFC (NONE, sowt) files.
+  Opening a file only parse the header, the sample data get
+  paged in on demand while it's converted. readFloat() convert
+  any frame range, a caller which want to hold only a part of
+  the file read it block wise (like the Slicer does).
+  For anything else open() return false and the caller should
+  fall back to libsndfile.
+****************************************************************/
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#pragma once
+
+#ifndef MAPPEDAUDIO_H
+#define MAPPEDAUDIO_H
+
+class MappedAudio {
+public:
+    uint32_t channels;
+    uint32_t samplerate;
+    uint32_t frames;
+
+    MappedAudio() {
+        reset();
+    }
+
+    ~MappedAudio() {
+        close();
+    }
+
+    // map a file and parse the header, return false when the format isn't supported
+    bool open(const char* file) {
+        close();
+        #if !defined(_WIN32)
+        int fd = ::open(file, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < 12) {
+            ::close(fd);
+            return false;
+        }
+        mapSize = st.st_size;
+        void* m = mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (m == MAP_FAILED) {
+            reset();
+            return false;
+        }
+        map = static_cast<const uint8_t*>(m);
+        bool ret = false;
+        if (std::memcmp(map, "RIFF", 4) == 0 && std::memcmp(map + 8, "WAVE", 4) == 0)
+            ret = parseWav();
+        else if (std::memcmp(map, "FORM", 4) == 0 && (std::memcmp(map + 8, "AIFF", 4) == 0 ||
+                    std::memcmp(map + 8, "AIFC", 4) == 0))
+            ret = parseAiff();
+        if (!ret) {
+            close();
+            return false;
+        }
+        madvise(const_cast<uint8_t*>(map), mapSize, MADV_SEQUENTIAL);
+        return true;
+        #else
+        (void) file;
+        return false;
+        #endif
+    }
+
+    void close() {
+        #if !defined(_WIN32)
+        if (map) munmap(const_cast<uint8_t*>(map), mapSize);
+        #endif
+        reset();
+    }
+
+    // convert count interleaved frames starting at frame start to float
+    uint32_t readFloat(float* dst, uint32_t start, uint32_t count) const {
+        if (!data || start >= frames) return 0;
+        count = std::min(count, frames - start);
+        const uint8_t* src = data + (uint64_t)start * frameBytes;
+        const uint64_t samples = (uint64_t)count * channels;
+        for (uint64_t i = 0; i < samples; i++)
+            dst[i] = sampleToFloat(src + i * bytesPerSample);
+        return count;
+    }
+
+private:
+    const uint8_t* map;
+    const uint8_t* data;
+    uint64_t mapSize;
+    uint32_t bits;
+    uint32_t bytesPerSample;
+    uint32_t frameBytes;
+    bool isFloat;
+    bool bigEndian;
+    bool unsigned8;
+
+    void reset() {
+        map = nullptr;
+        data = nullptr;
+        mapSize = 0;
+        channels = 0;
+        samplerate = 0;
+        frames = 0;
+        bits = 0;
+        bytesPerSample = 0;
+        frameBytes = 0;
+        isFloat = false;
+        bigEndian = false;
+        unsigned8 = false;
+    }
+
+    static uint16_t le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+    static uint32_t le32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+    static uint16_t be16(const uint8_t* p) { return (p[0] << 8) | p[1]; }
+    static uint32_t be32(const uint8_t* p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+
+    // 80 bit IEEE 754 extended (AIFF sample rate)
+    static double extended(const uint8_t* p) {
+        int32_t expon = ((p[0] & 0x7f) << 8) | p[1];
+        uint64_t mant = 0;
+        for (int i = 0; i < 8; i++) mant = (mant << 8) | p[2 + i];
+        if (!expon && !mant) return 0.0;
+        double v = std::ldexp((double)mant, expon - 16383 - 63);
+        return (p[0] & 0x80) ? -v : v;
+    }
+
+    inline float sampleToFloat(const uint8_t* p) const {
+        switch (bits) {
+            case 8:
+                // WAV 8 bit is unsigned, AIFF 8 bit is signed
+                return unsigned8 ? ((int)p[0] - 128) * (1.0f / 128.0f) : (int8_t)p[0] * (1.0f / 128.0f);
+            case 16:
+                return (int16_t)(bigEndian ? be16(p) : le16(p)) * (1.0f / 32768.0f);
+            case 24: {
+                int32_t v = bigEndian ? ((p[0] << 24) | (p[1] << 16) | (p[2] << 8))
+                                      : ((p[2] << 24) | (p[1] << 16) | (p[0] << 8));
+                return (v >> 8) * (1.0f / 8388608.0f);
+            }
+            case 32: {
+                uint32_t u = bigEndian ? be32(p) : le32(p);
+                if (isFloat) {
+                    float f;
+                    std::memcpy(&f, &u, 4);
+                    return f;
+                }
+                return (int32_t)u * (1.0f / 2147483648.0f);
+            }
+            default:
+                return 0.0f;
+        }
+    }
+
+    // check the collected format values and set the frame layout
+    bool setLayout(const uint8_t* d, uint64_t size) {
+        if (!channels || channels > 2 || !samplerate) return false;
+        if (bits != 8 && bits != 16 && bits != 24 && bits != 32) return false;
+        bytesPerSample = bits / 8;
+        frameBytes = bytesPerSample * channels;
+        if (d < map || d >= map + mapSize) return false;
+        if (size > (uint64_t)((map + mapSize) - d)) size = (map + mapSize) - d;
+        frames = static_cast<uint32_t>(std::min<uint64_t>(size / frameBytes, UINT32_MAX));
+        data = d;
+        return frames > 0;
+    }
+
+    bool parseWav() {
+        const uint8_t* p = map + 12;
+        const uint8_t* end = map + mapSize;
+        bool haveFmt = false;
+        while (p + 8 <= end) {
+            const uint32_t sz = le32(p + 4);
+            const uint8_t* body = p + 8;
+            if (std::memcmp(p, "fmt ", 4) == 0 && sz >= 16 && body + 16 <= end) {
+                uint16_t tag = le16(body);
+                channels = le16(body + 2);
+                samplerate = le32(body + 4);
+                bits = le16(body + 14);
+                // WAVE_FORMAT_EXTENSIBLE, take the format from the sub format GUID
+                if (tag == 0xFFFE && sz >= 40 && body + 26 <= end) tag = le16(body + 24);
+                if (tag == 3) isFloat = true;
+                else if (tag != 1) return false;
+                if (isFloat && bits != 32) return false;
+                unsigned8 = true;
+                haveFmt = true;
+            } else if (std::memcmp(p, "data", 4) == 0) {
+                if (!haveFmt) return false;
+                return setLayout(body, sz);
+            }
+            p = body + sz + (sz & 1);
+        }
+        return false;
+    }
+
+    bool parseAiff() {
+        const bool aifc = std::memcmp(map + 8, "AIFC", 4) == 0;
+        const uint8_t* p = map + 12;
+        const uint8_t* end = map + mapSize;
+        bool haveComm = false;
+        bigEndian = true;
+        while (p + 8 <= end) {
+            const uint32_t sz = be32(p + 4);
+            const uint8_t* body = p + 8;
+            if (std::memcmp(p, "COMM", 4) == 0 && sz >= 18 && body + 18 <= end) {
+                channels = be16(body);
+                bits = be16(body + 6);
+                samplerate = static_cast<uint32_t>(extended(body + 8) + 0.5);
+                if (aifc) {
+                    if (sz < 22 || body + 22 > end) return false;
+                    if (std::memcmp(body + 18, "sowt", 4) == 0) bigEndian = false;
+                    else if (std::memcmp(body + 18, "NONE", 4) != 0) return false;
+                }
+                haveComm = true;
+            } else if (std::memcmp(p, "SSND", 4) == 0 && sz >= 8) {
+                if (!haveComm) return false;
+                const uint32_t offset = be32(body);
+                if (offset > sz - 8) return false;
+                return setLayout(body + 8 + offset, sz - 8 - offset);
+            }
+            p = body + sz + (sz & 1);
+        }
+        return false;
+    }
+};
+
+#endif
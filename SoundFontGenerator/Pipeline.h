@@ -0,0 +1,422 @@
+/*
+ * Pipeline.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Pipeline - convert one audio file to sf2 in overlapping stages
+
+  decode -> resample -> encode -> write run each in its own thread,
+  connected by bounded queues of sample blocks. The decoder reads
+  into a fixed pool of block buffers, so it can't run ahead of the
+  resampler for more than the pool size.
+  The pitch tracker needs the whole (resampled) sample, so it runs
+  when the resampler is done, while encode and write finish the tail.
+  The int16 blocks are written with pwrite() to their final position,
+  the headers, the loop sample and the pdta follow in
+  SoundFontWriter::end_stream().
+
+  Every stage count the time it was busy and how often/long it had
+  to wait for input (starved) or for space in the next queue
+  (blocked), every queue record its occupancy. The busiest stage
+  with starving neighbours is the bottleneck.
+****************************************************************/
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <condition_variable>
+#include <sndfile.hh>
+
+#include "CheckResample.h"
+#include "MappedAudio.h"
+#include "PitchTracker.h"
+#include "SoundFontGen.h"
+#include "Trace.h"
+
+#pragma once
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+class Pipeline {
+public:
+    // counters of one stage
+    struct Stage {
+        const char* name = "";
+        uint64_t blocks = 0;
+        double   busy = 0.0;          // seconds
+        uint64_t starved = 0;         // waits for input
+        double   starvedTime = 0.0;
+        uint64_t blocked = 0;         // waits for space downstream
+        double   blockedTime = 0.0;
+    };
+
+    // occupancy of a queue, sampled on every push
+    struct Queue {
+        const char* name = "";
+        size_t   capacity = 0;
+        uint64_t pushes = 0;
+        uint64_t occupancy = 0;       // sum, divide by pushes
+        size_t   maxOccupancy = 0;
+    };
+
+    enum { DECODE, RESAMPLE, ANALYSE, ENCODE, WRITE, STAGES };
+    enum { FREE, DECODED, RESAMPLED, ENCODED, QUEUES };
+
+    struct Stats {
+        Stage stage[STAGES];
+        Queue queue[QUEUES];
+        double total = 0.0;
+    };
+
+    // results of run()
+    uint32_t sourceRate;
+    uint32_t samplerate;
+    uint32_t samplesize;
+    float    frequency;
+    uint8_t  rootKey;
+    int16_t  pitchCorrection;
+    Stats    stats;
+
+    // blockSize in frames, depth is the number of blocks a queue could hold
+    explicit Pipeline(uint32_t blockSize = 65536, uint32_t depth = 8)
+        : bs(blockSize), depth(depth) {
+        quality = CheckResample::STANDARD;
+        sourceRate = 0;
+        samplerate = 0;
+        samplesize = 0;
+        frequency = 0.0f;
+        rootKey = 0;
+        pitchCorrection = 0;
+    }
+
+    ~Pipeline() {}
+
+    // the resampler quality (filter length)
+    void setQuality(uint32_t q) {
+        quality = q;
+    }
+
+    // decode file (first channel), resample to targetRate (0 = keep),
+    // convert with gain to int16 and stream it into sf2file.
+    // On success the caller finish the file with swf.end_stream()
+    bool run(const std::string& file, const uint32_t targetRate, const float gain,
+                    SoundFontWriter& swf, const std::string& sf2file, PitchTracker& pt) {
+        #if defined(_WIN32)
+        // SoundFontWriter support streaming only with pwrite()
+        return false;
+        #else
+        const auto t0 = now();
+        Source src;
+        if (!src.open(file)) return false;
+        sourceRate = src.samplerate;
+        // rates within the tolerance keep the source rate
+        const bool resample = CheckResample::needResample(src.samplerate, targetRate);
+        samplerate = resample ? targetRate : src.samplerate;
+        CheckResample rs;
+        rs.setQuality(quality);
+        uint32_t capacity = src.frames;
+        if (resample) {
+            capacity = rs.beginStream(src.samplerate, samplerate, 1, src.frames);
+            if (!capacity) {
+                std::cerr << "Error: could not setup the resampler" << std::endl;
+                return false;
+            }
+        }
+        std::unique_ptr<float[]> out;
+        std::unique_ptr<float[]> pool;
+        try {
+            out.reset(new float[capacity]);
+            pool.reset(new float[(size_t)bs * depth]);
+        } catch (...) {
+            std::cerr << "Error: could not load file" << std::endl;
+            return false;
+        }
+        if (!swf.begin_stream(sf2file, capacity)) return false;
+
+        stats = Stats();
+        const char* stageNames[STAGES] = {"decode", "resample", "analyse", "encode", "write"};
+        for (int i = 0; i < STAGES; i++) stats.stage[i].name = stageNames[i];
+        BlockQueue spare(depth, stats.queue[FREE], "free");
+        BlockQueue decoded(depth, stats.queue[DECODED], "decoded");
+        BlockQueue resampled(depth, stats.queue[RESAMPLED], "resampled");
+        BlockQueue encoded(depth, stats.queue[ENCODED], "encoded");
+        for (uint32_t i = 0; i < depth; i++) spare.push({i, 0, 0}, stats.stage[DECODE]);
+        std::atomic<bool> failed(false);
+        samplesize = 0;
+        rootKey = 0;
+
+        // decode into the block pool
+        std::thread decoder([&]() {
+            Stage& st = stats.stage[DECODE];
+            for (uint32_t start = 0; start < src.frames; start += bs) {
+                Block b;
+                if (!spare.pop(b, st.blocked, st.blockedTime)) break;
+                const auto t = now();
+                float* buf = pool.get() + (size_t)b.slot * bs;
+                b.start = start;
+                b.count = src.read(buf, start, std::min(bs, src.frames - start));
+                st.busy += seconds(t);
+                if (!b.count || failed) break;
+                st.blocks++;
+                decoded.push(b, st);
+            }
+            decoded.close();
+        });
+
+        // resample into out, then run the pitch tracker on the whole sample
+        std::thread resampler([&]() {
+            Stage& st = stats.stage[RESAMPLE];
+            uint32_t produced = 0;
+            Block b;
+            while (decoded.pop(b, st.starved, st.starvedTime)) {
+                const auto t = now();
+                const float* buf = pool.get() + (size_t)b.slot * bs;
+                uint32_t n = b.count;
+                if (failed) {
+                    n = 0;
+                } else if (resample) {
+                    if (!rs.processBlock(buf, b.count, out.get() + produced, &n)) failed = true;
+                } else {
+                    std::memcpy(out.get() + produced, buf, b.count * sizeof(float));
+                }
+                st.busy += seconds(t);
+                spare.push(b, st);
+                if (!n) continue;
+                st.blocks++;
+                resampled.push({0, produced, n}, st);
+                produced += n;
+            }
+            if (resample && !failed) {
+                const auto t = now();
+                uint32_t n = 0;
+                if (!rs.endStream(out.get() + produced, &n)) failed = true;
+                st.busy += seconds(t);
+                if (n) {
+                    st.blocks++;
+                    resampled.push({0, produced, n}, st);
+                    produced += n;
+                }
+            }
+            resampled.close();
+            samplesize = produced;
+            if (failed || !produced) return;
+            const auto t = now();
+            rootKey = pt.getPitch(out.get(), produced, 1, samplerate, &pitchCorrection, &frequency);
+            stats.stage[ANALYSE].busy += seconds(t);
+            stats.stage[ANALYSE].blocks++;
+        });
+
+        // convert to int16
+        std::thread encoder([&]() {
+            Stage& st = stats.stage[ENCODE];
+            Block b;
+            while (resampled.pop(b, st.starved, st.starvedTime)) {
+                const auto t = now();
+                if (!failed) swf.stream_convert(out.get() + b.start, b.start, b.count, 1, gain);
+                st.busy += seconds(t);
+                st.blocks++;
+                encoded.push(b, st);
+            }
+            encoded.close();
+        });
+
+        // and write it out in the calling thread
+        {
+            Stage& st = stats.stage[WRITE];
+            Block b;
+            while (encoded.pop(b, st.starved, st.starvedTime)) {
+                if (failed) continue;
+                const auto t = now();
+                if (!swf.stream_write(b.start, b.count)) failed = true;
+                st.busy += seconds(t);
+                st.blocks++;
+            }
+        }
+        decoder.join();
+        resampler.join();
+        encoder.join();
+        stats.total = seconds(t0);
+        if (failed || !samplesize) {
+            swf.abort_stream();
+            return false;
+        }
+        return true;
+        #endif
+    }
+
+    // print the stage and queue counters
+    static void printStats(const Stats& s) {
+        char line[128];
+        std::cout << "  Pipeline:  " << s.total * 1000.0 << " ms" << std::endl;
+        std::cout << "    stage       blocks   busy ms   starved (ms)     blocked (ms)" << std::endl;
+        for (int i = 0; i < STAGES; i++) {
+            const Stage& t = s.stage[i];
+            snprintf(line, sizeof(line), "    %-9s %8llu %9.2f %6llu (%7.2f) %6llu (%7.2f)", t.name,
+                (unsigned long long)t.blocks, t.busy * 1000.0,
+                (unsigned long long)t.starved, t.starvedTime * 1000.0,
+                (unsigned long long)t.blocked, t.blockedTime * 1000.0);
+            std::cout << line << std::endl;
+        }
+        std::cout << "    queue       size      avg      max" << std::endl;
+        for (int i = 0; i < QUEUES; i++) {
+            const Queue& q = s.queue[i];
+            snprintf(line, sizeof(line), "    %-9s %6zu %8.2f %8zu", q.name, q.capacity,
+                q.pushes ? (double)q.occupancy / q.pushes : 0.0, q.maxOccupancy);
+            std::cout << line << std::endl;
+        }
+    }
+
+private:
+    uint32_t bs;
+    uint32_t depth;
+    uint32_t quality;
+
+    // a range of frames, slot is the pool buffer of a decoded block
+    struct Block {
+        uint32_t slot;
+        uint32_t start;
+        uint32_t count;
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    static Clock::time_point now() {
+        return Clock::now();
+    }
+
+    static double seconds(Clock::time_point t) {
+        return std::chrono::duration<double>(Clock::now() - t).count();
+    }
+
+    // bounded blocking queue, pop() return false when closed and empty
+    class BlockQueue {
+    public:
+        BlockQueue(size_t capacity, Queue& stats, const char* name)
+            : cap(capacity), closed(false), qs(stats) {
+            qs.name = name;
+            qs.capacity = capacity;
+        }
+
+        void push(const Block& b, Stage& st) {
+            std::unique_lock<std::mutex> lk(m);
+            if (q.size() >= cap) {
+                const auto t = now();
+                st.blocked++;
+                notFull.wait(lk, [this]() { return q.size() < cap; });
+                st.blockedTime += seconds(t);
+            }
+            q.push_back(b);
+            qs.pushes++;
+            qs.occupancy += q.size();
+            qs.maxOccupancy = std::max(qs.maxOccupancy, q.size());
+            lk.unlock();
+            notEmpty.notify_one();
+        }
+
+        bool pop(Block& b, uint64_t& waits, double& waitTime) {
+            std::unique_lock<std::mutex> lk(m);
+            if (q.empty() && !closed) {
+                const auto t = now();
+                waits++;
+                notEmpty.wait(lk, [this]() { return !q.empty() || closed; });
+                waitTime += seconds(t);
+            }
+            if (q.empty()) return false;
+            b = q.front();
+            q.pop_front();
+            lk.unlock();
+            notFull.notify_one();
+            return true;
+        }
+
+        // no more blocks will follow
+        void close() {
+            {
+                std::lock_guard<std::mutex> lk(m);
+                closed = true;
+            }
+            notEmpty.notify_all();
+        }
+
+    private:
+        std::mutex m;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::deque<Block> q;
+        size_t cap;
+        bool closed;
+        Queue& qs;
+    };
+
+    // block wise reader for the first channel of a audio file,
+    // memory mapped when possible, libsndfile else
+    class Source {
+    public:
+        uint32_t channels = 0;
+        uint32_t samplerate = 0;
+        uint32_t frames = 0;
+
+        ~Source() {
+            if (sndfile) sf_close(sndfile);
+        }
+
+        bool open(const std::string& file) {
+            if (mapped.open(file.c_str())) {
+                channels = mapped.channels;
+                samplerate = mapped.samplerate;
+                frames = mapped.frames;
+                return frames > 0;
+            }
+            SF_INFO info;
+            info.format = 0;
+            sndfile = sf_open(file.c_str(), SFM_READ, &info);
+            if (!sndfile) {
+                std::cerr << "Error: could not open file " << sf_error (sndfile) << std::endl;
+                return false;
+            }
+            if (info.channels > 2) {
+                std::cerr << "Error: only two channels maximum are supported!" << std::endl;
+                return false;
+            }
+            channels = info.channels;
+            samplerate = info.samplerate;
+            frames = (uint32_t)info.frames;
+            return frames > 0;
+        }
+
+        // read count frames from start, keep the first channel
+        uint32_t read(float* dst, uint32_t start, uint32_t count) {
+            TRACE_SCOPE("Pipeline::read");
+            if (channels == 1) {
+                return sndfile ? (uint32_t)sf_readf_float(sndfile, dst, count)
+                               : mapped.readFloat(dst, start, count);
+            }
+            if (scratch.size() < (size_t)count * channels) scratch.resize((size_t)count * channels);
+            const uint32_t n = sndfile ? (uint32_t)sf_readf_float(sndfile, scratch.data(), count)
+                                       : mapped.readFloat(scratch.data(), start, count);
+            for (uint32_t i = 0; i < n; i++) dst[i] = scratch[(size_t)i * channels];
+            return n;
+        }
+
+    private:
+        MappedAudio mapped;
+        SNDFILE* sndfile = nullptr;
+        std::vector<float> scratch;
+    };
+};
+
+#endif
@@ -11,6 +11,8 @@
 #include <algorithm>
 #include <vector>
 #include <cstdint>
+#include <mutex>
+#include "Trace.h"
 
 #pragma once
 
@@ -25,6 +27,7 @@ public:
             float sampleRate, int16_t* pitchCorrection = nullptr,
             float* frequency = nullptr, float minFreq = 20.0f,
             float maxFreq = 5000.0f) {
+            TRACE_SCOPE("PitchTracker::getPitch");
 
             if (N < 2 || channels <= 0) {
                 if (pitchCorrection) *pitchCorrection = 0;
@@ -32,10 +35,12 @@ public:
                 return 0;
             }
 
-            // Allocate FFTW buffers
-            fftwf_complex* out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (N/2 + 1));
-            float* in = (float*) fftwf_malloc(sizeof(float) * N);
-            fftwf_plan plan = fftwf_plan_dft_r2c_1d(N, in, out, FFTW_ESTIMATE);
+            // FFTW buffers and plan, kept for the next call with the same size
+            if (!preparePlan(N)) {
+                if (pitchCorrection) *pitchCorrection = 0;
+                if (frequency) *frequency = 0.0f;
+                return 0;
+            }
 
             // Max abs amplitude for normalization (first channel only)
             float maxAbs = 0.0f;
@@ -49,9 +54,6 @@ public:
             if (maxAbs < minLoudness) {
                 if (pitchCorrection) *pitchCorrection = 0;
                 if (frequency) *frequency = 0.0f;
-                fftwf_destroy_plan(plan);
-                fftwf_free(in);
-                fftwf_free(out);
                 return 0;
             }
 
@@ -116,9 +118,6 @@ public:
             // Output frequency
             if (frequency) *frequency = freq;
             if (freq <= 0.0f) {
-                fftwf_destroy_plan(plan);
-                fftwf_free(in);
-                fftwf_free(out);
                 if (pitchCorrection) *pitchCorrection = 0;
                 return 0;
             }
@@ -146,15 +145,63 @@ public:
             correction = std::clamp<int16_t>(correction, -50, 50);
             if (pitchCorrection) *pitchCorrection = correction;
 
-            // Cleanup
-            fftwf_destroy_plan(plan);
-            fftwf_free(in);
-            fftwf_free(out);
-
             return static_cast<uint8_t>(midiNote);
         }
-private:
+    PitchTracker() : plan(nullptr), in(nullptr), out(nullptr), planSize(0) {}
+
+    ~PitchTracker() {
+        releasePlan();
+    }
+
+    PitchTracker(const PitchTracker&) = delete;
+    PitchTracker& operator=(const PitchTracker&) = delete;
 
+private:
+    fftwf_plan plan;
+    float* in;
+    fftwf_complex* out;
+    size_t planSize;
+
+    // (re)create the buffers and the plan when the size change
+    bool preparePlan(size_t N) {
+        if (plan && planSize == N) return true;
+        releasePlan();
+        out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * (N/2 + 1));
+        in = (float*) fftwf_malloc(sizeof(float) * N);
+        if (in && out) plan = createPlan(N, in, out);
+        if (!plan) {
+            releasePlan();
+            return false;
+        }
+        planSize = N;
+        return true;
+    }
+
+    void releasePlan() {
+        if (plan) destroyPlan(plan);
+        if (in) fftwf_free(in);
+        if (out) fftwf_free(out);
+        plan = nullptr;
+        in = nullptr;
+        out = nullptr;
+        planSize = 0;
+    }
+
+    // the FFTW planner isn't thread safe, only fftwf_execute is
+    static std::mutex& plannerLock() {
+        static std::mutex m;
+        return m;
+    }
+
+    static fftwf_plan createPlan(size_t N, float* in, fftwf_complex* out) {
+        std::lock_guard<std::mutex> lk(plannerLock());
+        return fftwf_plan_dft_r2c_1d(N, in, out, FFTW_ESTIMATE);
+    }
+
+    static void destroyPlan(fftwf_plan plan) {
+        std::lock_guard<std::mutex> lk(plannerLock());
+        fftwf_destroy_plan(plan);
+    }
 };
 
 #endif
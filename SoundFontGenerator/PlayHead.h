@@ -0,0 +1,86 @@
+/*
+ * PlayHead.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  PlayHead - the play position published by the audio callback
+
+  The audio callback publish once per period the position and
+  the time (steady clock) at which that frame will be audible.
+  The values are written with a sequence lock, the writer never
+  wait and the reader retry when it raced with a update.
+  estimate() extrapolate the published position to the current
+  time, so the GUI could draw a smooth play head at any rate.
+****************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#pragma once
+
+#ifndef PLAYHEAD_H
+#define PLAYHEAD_H
+
+class PlayHead {
+public:
+    PlayHead() : seq(0), pos(0), stamp(0), running(false) {}
+
+    // audio thread: the frame at position will be audible at time (ns)
+    inline void publish(uint32_t position, uint64_t time, bool playing) noexcept {
+        const uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        pos.store(position, std::memory_order_relaxed);
+        stamp.store(time, std::memory_order_relaxed);
+        running.store(playing, std::memory_order_relaxed);
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    // read a consistent set, false when nothing was published yet
+    bool read(uint32_t& position, uint64_t& time, bool& playing) const noexcept {
+        for (int i = 0; i < 100; i++) {
+            const uint32_t s = seq.load(std::memory_order_acquire);
+            if (s & 1) continue;
+            position = pos.load(std::memory_order_relaxed);
+            time = stamp.load(std::memory_order_relaxed);
+            playing = running.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == s) return s != 0;
+        }
+        return false;
+    }
+
+    // the frame audible at time now, wrapped into the loop (loop_l - loop_r)
+    uint32_t estimate(uint64_t now, uint32_t sampleRate, uint32_t loop_l, uint32_t loop_r,
+                                                        uint32_t fallback) const noexcept {
+        uint32_t position;
+        uint64_t time;
+        bool playing;
+        if (!read(position, time, playing)) return fallback;
+        if (!playing || !sampleRate || loop_r <= loop_l) return position;
+        const int64_t dt = (int64_t)(now - time);
+        const int64_t len = (int64_t)loop_r - loop_l;
+        int64_t p = (int64_t)position - loop_l + dt * (int64_t)sampleRate / 1000000000;
+        p %= len;
+        if (p < 0) p += len;
+        return (uint32_t)(loop_l + p);
+    }
+
+    static inline uint64_t now() noexcept {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    std::atomic<uint32_t> seq;
+    std::atomic<uint32_t> pos;
+    std::atomic<uint64_t> stamp;
+    std::atomic<bool> running;
+};
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Retune.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Retune - bake a pitch correction into the sample data
+
+  A sample which is off by cents get stretched by 2^(cents / 1200),
+  played at the same Sample Rate it hit the root key exactly, so
+  the SoundFont could store a pitch correction of 0.
+
+  The ratio is arbitrary (a few cents are no ratio zita-resampler
+  could handle), so this is a variable ratio resampler like the
+  zita VResampler: a windowed sinc table with PHASES phases, the
+  fractional input position interpolate between two phases.
+  The filter use the zita window and cutoff for the quality (the
+  half filter length). The input position of a output frame is
+  computed from its index, so the output could be cut into chunks
+  which run in parallel and the result don't depend on the threads.
+****************************************************************/
+
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include "Trace.h"
+
+#pragma once
+
+#ifndef RETUNE_H
+#define RETUNE_H
+
+class Retune {
+public:
+    // the output / input length ratio for a sample off by cents
+    static double ratio(double cents) {
+        return std::pow(2.0, cents / 1200.0);
+    }
+
+    // the output frames for frames input frames of a sample off by cents,
+    // 0 when the deviation is out of range
+    static uint32_t outputFrames(uint32_t frames, double cents) {
+        const double r = ratio(cents);
+        if (!frames || !(r > 0.5 && r < 2.0)) return 0;
+        const uint64_t total = (uint64_t)std::ceil(frames * r);
+        return total > UINT32_MAX ? 0 : (uint32_t)total;
+    }
+
+    // resample chan interleaved frames of a sample off by cents,
+    // return the new buffer (nullptr on error) and its size in outFrames.
+    // threads = 0 use all cores
+    static float* process(const float* input, uint32_t frames, uint32_t chan, double cents,
+                    uint32_t quality, uint32_t threads, uint32_t* outFrames) {
+        *outFrames = 0;
+        const uint32_t total = outputFrames(frames, cents);
+        if (!total || !chan) return nullptr;
+        float* out = nullptr;
+        try {
+            out = new float[(uint64_t)total * chan];
+        } catch (...) {
+            return nullptr;
+        }
+        render(input, frames, chan, cents, quality, threads, out, total);
+        *outFrames = total;
+        return out;
+    }
+
+    // the same into out, which hold outputFrames(frames, cents) frames,
+    // used for the planes of a planar buffer (chan = 1)
+    static bool process(const float* input, uint32_t frames, uint32_t chan, double cents,
+                    uint32_t quality, uint32_t threads, float* out) {
+        const uint32_t total = outputFrames(frames, cents);
+        if (!total || !chan || !out) return false;
+        render(input, frames, chan, cents, quality, threads, out, total);
+        return true;
+    }
+
+private:
+    static constexpr uint64_t MIN_CHUNK = 65536;
+    static constexpr uint32_t PHASES = 256;
+
+    // cut the output into chunks and run them in parallel
+    static void render(const float* input, uint32_t frames, uint32_t chan, double cents,
+                    uint32_t quality, uint32_t threads, float* out, uint64_t total) {
+        TRACE_SCOPE("Retune::process");
+        const double r = ratio(cents);
+        Filter flt(std::clamp<uint32_t>(quality, 8, 96), r);
+        if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+        const uint32_t chunks = (uint32_t)std::max<uint64_t>(1,
+                            std::min<uint64_t>(threads, total / MIN_CHUNK));
+        auto run = [&](uint32_t i) {
+            const uint64_t o0 = total * i / chunks;
+            const uint64_t o1 = total * (i + 1) / chunks;
+            flt.run(input, frames, chan, 1.0 / r, out, o0, o1);
+        };
+        std::vector<std::thread> workers;
+        for (uint32_t i = 1; i < chunks; i++) workers.emplace_back(run, i);
+        run(0);
+        for (auto& t : workers) t.join();
+    }
+
+    // the polyphase table, row p hold the 2 * hl taps for the
+    // fractional position p / PHASES, tap m weight the frame i + m - hl + 1
+    class Filter {
+    public:
+        Filter(uint32_t hlen, double r) {
+            double fr = 1.0 - 2.6 / hlen;
+            hl = hlen;
+            // shortening need a lower cutoff
+            if (r < 1.0) {
+                fr *= r;
+                hl = (uint32_t)std::ceil(hl / r);
+            }
+            taps = 2 * hl;
+            table.resize((size_t)(PHASES + 1) * taps);
+            for (uint32_t p = 0; p <= PHASES; p++) {
+                const double a = (double)p / PHASES;
+                for (uint32_t m = 0; m < taps; m++) {
+                    const double t = (double)m - (hl - 1) - a;
+                    table[(size_t)p * taps + m] = (float)(fr * sinc(t * fr) * wind(t / hl));
+                }
+            }
+        }
+
+        // output frames o0 - o1, the output frame k is at the input position k * step
+        void run(const float* in, uint32_t frames, uint32_t chan, double step,
+                                            float* out, uint64_t o0, uint64_t o1) const {
+            std::vector<float> win((size_t)taps * chan);
+            for (uint64_t k = o0; k < o1; k++) {
+                const double t = k * step;
+                const int64_t i = (int64_t)std::floor(t);
+                const double f = (t - i) * PHASES;
+                const uint32_t p = std::min<uint32_t>((uint32_t)f, PHASES - 1);
+                const float a = (float)(f - p);
+                const float* h0 = &table[(size_t)p * taps];
+                const float* h1 = h0 + taps;
+                // the input frames under the filter, zeros outside the sample
+                const int64_t first = i - (int64_t)(hl - 1);
+                const float* x;
+                if (first >= 0 && first + taps <= frames) {
+                    x = in + (size_t)first * chan;
+                } else {
+                    for (uint32_t m = 0; m < taps; m++) {
+                        const int64_t j = first + m;
+                        for (uint32_t c = 0; c < chan; c++)
+                            win[(size_t)m * chan + c] = (j >= 0 && j < frames) ?
+                                            in[(size_t)j * chan + c] : 0.0f;
+                    }
+                    x = win.data();
+                }
+                for (uint32_t c = 0; c < chan; c++) {
+                    float s0 = 0.0f, s1 = 0.0f;
+                    for (uint32_t m = 0; m < taps; m++) {
+                        const float v = x[(size_t)m * chan + c];
+                        s0 += h0[m] * v;
+                        s1 += h1[m] * v;
+                    }
+                    out[(size_t)k * chan + c] = s0 + a * (s1 - s0);
+                }
+            }
+        }
+
+    private:
+        uint32_t hl;
+        uint32_t taps;
+        std::vector<float> table;
+
+        static double sinc(double x) {
+            x = std::fabs(x);
+            if (x < 1e-6) return 1.0;
+            x *= M_PI;
+            return std::sin(x) / x;
+        }
+
+        static double wind(double x) {
+            x = std::fabs(x);
+            if (x >= 1.0) return 0.0;
+            x *= M_PI;
+            return 0.384 + 0.500 * std::cos(x) + 0.116 * std::cos(2 * x);
+        }
+    };
+};
+
+#endif
@@ -0,0 +1,223 @@
+/*
+ * RtStats.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  RtStats - timing statistics for the audio process callback
+
+  The callback record its execution time per period into a
+  histogram and count the xruns reported by the audio server.
+  Only the audio thread write, so the counters are relaxed atomics
+  updated with plain load/store (no locked instructions, no locks,
+  no allocation), every other thread could read them any time.
+
+  The histogram use 4 buckets per octave starting at 64ns, the
+  percentiles are the upper bound of the bucket they fall into.
+  print() report the load against the period budget (frames / rate).
+****************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#pragma once
+
+#ifndef RTSTATS_H
+#define RTSTATS_H
+
+class RtStats {
+public:
+    // xrun flags, the same values as the PortAudio statusFlags
+    enum Flags {
+        INPUT_UNDERFLOW  = 0x01,
+        INPUT_OVERFLOW   = 0x02,
+        OUTPUT_UNDERFLOW = 0x04,
+        OUTPUT_OVERFLOW  = 0x08
+    };
+
+    // time the enclosing callback
+    class Scope {
+    public:
+        Scope(RtStats& s, uint32_t frames, unsigned long flags) noexcept
+            : stats(s), nframes(frames), status(flags), start(now()) {}
+
+        ~Scope() {
+            stats.record(now() - start, nframes, status);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        RtStats& stats;
+        uint32_t nframes;
+        unsigned long status;
+        uint64_t start;
+    };
+
+    RtStats() {
+        sampleRate.store(0, std::memory_order_relaxed);
+        reset();
+    }
+
+    // the period budget is frames / Sample Rate
+    void setSampleRate(uint32_t sr) {
+        sampleRate.store(sr, std::memory_order_relaxed);
+    }
+
+    // only safe while the callback isn't running
+    void reset() {
+        for (auto& b : buckets) b.store(0, std::memory_order_relaxed);
+        callbacks.store(0, std::memory_order_relaxed);
+        totalTime.store(0, std::memory_order_relaxed);
+        maxTime.store(0, std::memory_order_relaxed);
+        maxLoad.store(0, std::memory_order_relaxed);
+        overBudget.store(0, std::memory_order_relaxed);
+        underflows.store(0, std::memory_order_relaxed);
+        overflows.store(0, std::memory_order_relaxed);
+        minFrames.store(UINT32_MAX, std::memory_order_relaxed);
+        maxFrames.store(0, std::memory_order_relaxed);
+    }
+
+    // called from the audio thread only
+    inline void record(uint64_t ns, uint32_t frames, unsigned long flags) noexcept {
+        bump(buckets[bucket(ns)]);
+        bump(callbacks);
+        totalTime.store(totalTime.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+        if (ns > maxTime.load(std::memory_order_relaxed))
+            maxTime.store(ns, std::memory_order_relaxed);
+        if (frames < minFrames.load(std::memory_order_relaxed))
+            minFrames.store(frames, std::memory_order_relaxed);
+        if (frames > maxFrames.load(std::memory_order_relaxed))
+            maxFrames.store(frames, std::memory_order_relaxed);
+        const uint32_t sr = sampleRate.load(std::memory_order_relaxed);
+        if (sr && frames) {
+            const uint64_t budget = (uint64_t)frames * 1000000000ull / sr;
+            // load in 1/10 percent
+            const uint64_t load = ns * 1000 / budget;
+            if (load > maxLoad.load(std::memory_order_relaxed))
+                maxLoad.store(load, std::memory_order_relaxed);
+            if (ns > budget) bump(overBudget);
+        }
+        if (flags & (INPUT_UNDERFLOW | OUTPUT_UNDERFLOW)) bump(underflows);
+        if (flags & (INPUT_OVERFLOW | OUTPUT_OVERFLOW)) bump(overflows);
+    }
+
+    uint64_t getCallbacks() const {
+        return callbacks.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getUnderflows() const {
+        return underflows.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getOverflows() const {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+    uint64_t getOverBudget() const {
+        return overBudget.load(std::memory_order_relaxed);
+    }
+
+    // execution time in ns below which fall p percent of the callbacks
+    uint64_t percentile(double p) const {
+        uint64_t h[BUCKETS];
+        uint64_t n = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++) n += h[i] = buckets[i].load(std::memory_order_relaxed);
+        if (!n) return 0;
+        const uint64_t want = std::max<uint64_t>(1, (uint64_t)(n * p / 100.0 + 0.5));
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            sum += h[i];
+            if (sum >= want) return std::min(upperBound(i), maxTime.load(std::memory_order_relaxed));
+        }
+        return maxTime.load(std::memory_order_relaxed);
+    }
+
+    // print the summary and the histogram
+    void print(FILE* fp) const {
+        const uint64_t n = getCallbacks();
+        fprintf(fp, "audio callback statistics:\n");
+        if (!n) {
+            fprintf(fp, "  no callbacks recorded\n");
+            return;
+        }
+        const uint32_t sr = sampleRate.load(std::memory_order_relaxed);
+        const uint32_t fmin = minFrames.load(std::memory_order_relaxed);
+        const uint32_t fmax = maxFrames.load(std::memory_order_relaxed);
+        fprintf(fp, "  callbacks     %llu\n", (unsigned long long)n);
+        if (fmin == fmax) fprintf(fp, "  period        %u frames", fmax);
+        else fprintf(fp, "  period        %u - %u frames", fmin, fmax);
+        if (sr && fmin) fprintf(fp, " at %u Hz, budget %.1f us\n", sr, fmin * 1e6 / sr);
+        else fprintf(fp, "\n");
+        fprintf(fp, "  time us       mean %.2f  p50 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+                    totalTime.load(std::memory_order_relaxed) / 1000.0 / n,
+                    percentile(50.0) / 1000.0, percentile(99.0) / 1000.0,
+                    percentile(99.9) / 1000.0, maxTime.load(std::memory_order_relaxed) / 1000.0);
+        if (sr) fprintf(fp, "  max load      %.1f%% of the period\n",
+                    maxLoad.load(std::memory_order_relaxed) / 10.0);
+        fprintf(fp, "  over budget   %llu\n", (unsigned long long)getOverBudget());
+        fprintf(fp, "  underflows    %llu\n", (unsigned long long)getUnderflows());
+        fprintf(fp, "  overflows     %llu\n", (unsigned long long)getOverflows());
+        fprintf(fp, "  histogram (us):\n");
+        for (uint32_t i = 0; i < BUCKETS; i++) {
+            const uint64_t c = buckets[i].load(std::memory_order_relaxed);
+            if (!c) continue;
+            fprintf(fp, "    %10.2f - %10.2f  %12llu  %6.2f%%\n", lowerBound(i) / 1000.0,
+                        upperBound(i) / 1000.0, (unsigned long long)c, c * 100.0 / n);
+        }
+    }
+
+private:
+    static constexpr uint32_t BUCKETS = 96;
+    static constexpr uint32_t SHIFT = 6;    // the first bucket is 64ns wide
+
+    std::atomic<uint64_t> buckets[BUCKETS];
+    std::atomic<uint64_t> callbacks;
+    std::atomic<uint64_t> totalTime;
+    std::atomic<uint64_t> maxTime;
+    std::atomic<uint64_t> maxLoad;
+    std::atomic<uint64_t> overBudget;
+    std::atomic<uint64_t> underflows;
+    std::atomic<uint64_t> overflows;
+    std::atomic<uint32_t> minFrames;
+    std::atomic<uint32_t> maxFrames;
+    std::atomic<uint32_t> sampleRate;
+
+    static inline uint64_t now() noexcept {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // single writer, a plain load/store is enough
+    static inline void bump(std::atomic<uint64_t>& a) noexcept {
+        a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // 4 buckets per power of two
+    static inline uint32_t bucket(uint64_t ns) noexcept {
+        const uint64_t v = ns >> SHIFT;
+        if (v < 4) return (uint32_t)v;
+        const uint32_t msb = 63 - __builtin_clzll(v);
+        const uint32_t i = (msb - 1) * 4 + (uint32_t)((v >> (msb - 2)) & 3);
+        return std::min(i, BUCKETS - 1);
+    }
+
+    static uint64_t lowerBound(uint32_t i) {
+        if (i < 4) return (uint64_t)i << SHIFT;
+        const uint32_t msb = i / 4 + 1;
+        return ((uint64_t)(4 + i % 4) << (msb - 2)) << SHIFT;
+    }
+
+    static uint64_t upperBound(uint32_t i) {
+        return lowerBound(i + 1);
+    }
+};
+
+#endif
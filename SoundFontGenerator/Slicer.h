@@ -0,0 +1,173 @@
+/*
+ * Slicer.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Slicer - find the notes in one long multisample recording
+
+  The recording is read once block wise (memory mapped when
+  possible, libsndfile else), so only one block is held at a time.
+  A note start when the peak of a frame (over all channels) rise
+  above the threshold and end when the level stay below the
+  release threshold (threshold - 12 dB) for the minimal gap.
+  The regions are trimmed to the last frame above the release
+  threshold and start a short pre-roll before the onset.
+  fade() shape the edges of a loaded region, so the cuts don't click.
+****************************************************************/
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <sndfile.hh>
+
+#include "MappedAudio.h"
+#include "Trace.h"
+
+#pragma once
+
+#ifndef SLICER_H
+#define SLICER_H
+
+class Slicer {
+public:
+    // a note in the recording, in frames
+    struct Region {
+        uint32_t start;
+        uint32_t frames;
+    };
+
+    struct Settings {
+        double threshold = -40.0;   // onset level in dBFS
+        double gap = 0.15;          // minimal silence between notes in seconds
+        double minNote = 0.05;      // shorter regions are dropped, in seconds
+    };
+
+    // kept before the onset and faded in, faded out at the end, in seconds
+    static constexpr double PRE_ROLL = 0.005;
+    static constexpr double FADE_OUT = 0.01;
+
+    uint32_t channels;
+    uint32_t samplerate;
+    uint32_t frames;
+
+    Slicer() {
+        channels = 0;
+        samplerate = 0;
+        frames = 0;
+        sndfile = nullptr;
+    }
+
+    ~Slicer() {
+        close();
+    }
+
+    // scan the file and collect the regions of the notes
+    bool detect(const std::string& file, const Settings& s, std::vector<Region>& regions) {
+        TRACE_SCOPE("Slicer::detect");
+        regions.clear();
+        if (!open(file)) return false;
+        const float on = (float)std::pow(10.0, s.threshold / 20.0);
+        const float off = on * 0.25f;
+        const uint32_t gap = (uint32_t)(s.gap * samplerate);
+        const uint32_t minNote = (uint32_t)(s.minNote * samplerate);
+        const uint32_t preRoll = (uint32_t)(PRE_ROLL * samplerate);
+        std::vector<float> block((size_t)BLOCK * channels);
+        bool note = false;
+        uint32_t start = 0;
+        uint32_t lastLoud = 0;
+        uint32_t lastEnd = 0;
+        auto emit = [&]() {
+            const uint32_t end = lastLoud + 1;
+            if (end - start >= minNote) regions.push_back({start, end - start});
+            lastEnd = end;
+            note = false;
+        };
+        for (uint32_t pos = 0; pos < frames; ) {
+            const uint32_t n = read(block.data(), pos, std::min(BLOCK, frames - pos));
+            if (!n) break;
+            for (uint32_t i = 0; i < n; i++) {
+                float peak = 0.0f;
+                for (uint32_t c = 0; c < channels; c++)
+                    peak = std::max(peak, std::fabs(block[(size_t)i * channels + c]));
+                const uint32_t f = pos + i;
+                if (!note) {
+                    if (peak > on) {
+                        note = true;
+                        start = std::max(lastEnd, f > preRoll ? f - preRoll : 0);
+                        lastLoud = f;
+                    }
+                } else if (peak > off) {
+                    lastLoud = f;
+                } else if (f - lastLoud > gap) {
+                    emit();
+                }
+            }
+            pos += n;
+        }
+        if (note) emit();
+        close();
+        return true;
+    }
+
+    // fade in over the pre-roll and out over the last FADE_OUT seconds
+    static void fade(float* samples, uint32_t frames, uint32_t chan, uint32_t rate) {
+        const uint32_t in = std::min<uint32_t>((uint32_t)(PRE_ROLL * rate), frames / 4);
+        const uint32_t out = std::min<uint32_t>((uint32_t)(FADE_OUT * rate), frames / 4);
+        for (uint32_t i = 0; i < in; i++) {
+            const float g = (float)i / in;
+            for (uint32_t c = 0; c < chan; c++) samples[(size_t)i * chan + c] *= g;
+        }
+        for (uint32_t i = 0; i < out; i++) {
+            const float g = (float)i / out;
+            for (uint32_t c = 0; c < chan; c++) samples[(size_t)(frames - 1 - i) * chan + c] *= g;
+        }
+    }
+
+private:
+    static constexpr uint32_t BLOCK = 65536;
+
+    MappedAudio mapped;
+    SNDFILE* sndfile;
+
+    bool open(const std::string& file) {
+        close();
+        if (mapped.open(file.c_str())) {
+            channels = mapped.channels;
+            samplerate = mapped.samplerate;
+            frames = mapped.frames;
+            return frames > 0;
+        }
+        SF_INFO info;
+        info.format = 0;
+        sndfile = sf_open(file.c_str(), SFM_READ, &info);
+        if (!sndfile) {
+            std::cerr << "Error: could not open file " << sf_error (sndfile) << std::endl;
+            return false;
+        }
+        channels = info.channels;
+        samplerate = info.samplerate;
+        frames = (uint32_t)std::min<sf_count_t>(info.frames, UINT32_MAX);
+        return frames > 0;
+    }
+
+    void close() {
+        mapped.close();
+        if (sndfile) sf_close(sndfile);
+        sndfile = nullptr;
+    }
+
+    // read count interleaved frames, the file is read in order
+    uint32_t read(float* dst, uint32_t start, uint32_t count) {
+        return sndfile ? (uint32_t)sf_readf_float(sndfile, dst, count)
+                       : mapped.readFloat(dst, start, count);
+    }
+};
+
+#endif
@@ -10,10 +10,13 @@
 
 #ifndef JACKAPI
 #include <portaudio.h>
+#else
+#include "xjack.h"
 #endif
 #include <algorithm>
 #include <cctype>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <mutex>
 #include <set>
@@ -27,6 +30,7 @@
 #include "SupportedFormats.h"
 #include "AudioFile.h"
 #include "PitchTracker.h"
+#include "PlayHead.h"
 
 #include "xwidgets.h"
 #include "xfile-dialog.h"
@@ -48,6 +52,8 @@ public:
     ParallelThread pa;
     AudioFile af;
     PitchTracker pt;
+    PlayHead playHead;
+    PreviewSwap preview;
     
     uint32_t jack_sr;
     uint32_t position;
@@ -91,6 +97,8 @@ public:
         rootkey = 60;
         chorus = 500;
         reverb = 500;
+        activeDevice = -1;
+        playHeadPixel = -1;
         generateKeys();
     };
 
@@ -113,9 +121,12 @@ public:
         #endif
     }
     
-    // receive Sample Rate from audio back-end
+    // receive Sample Rate from audio back-end,
+    // the loaded file keep its rate, only the preview follow
     void setJackSampleRate(uint32_t sr) {
-        jack_sr = sr;        
+        if (sr == jack_sr) return;
+        jack_sr = sr;
+        setupPreview();
     }
 
     // receive stream object from portaudio to check 
@@ -124,6 +135,19 @@ public:
         stream = stream_;
     }
 
+    // receive the output devices of the audio back-end for the device selector,
+    // select() is called with the index of the chosen entry
+    void setDevices(const std::vector<std::string>& names, int active,
+                                    std::function<bool(int)> select) {
+        selectDevice = select;
+        activeDevice = active;
+        for (auto & element : names) {
+            combobox_add_entry(deviceBox, element.c_str());
+        }
+        combobox_set_menu_size(deviceBox, std::min<int>(12, names.size()));
+        combobox_set_active_entry(deviceBox, active);
+    }
+
     // receive a file name from the File Browser or the command-line
     static void dialog_response(void *w_, void* user_data) {
         Widget_t *w = (Widget_t*)w_;
@@ -220,6 +244,13 @@ public:
         add_tooltip(e_save, "Save settings to sf2");
         e_save->func.value_changed_callback = button_esave_callback;
 
+        deviceBox = add_combobox(w, "", 100, 150, 155, 30);
+        deviceBox->scale.gravity = SOUTHEAST;
+        deviceBox->parent_struct = (void*)this;
+        deviceBox->flags |= HAS_TOOLTIP;
+        add_tooltip(deviceBox, "Audio device");
+        deviceBox->func.value_changed_callback = set_device;
+
         volume = add_knob(w, "dB",265,150,28,28);
         volume->parent_struct = (void*)this;
         volume->scale.gravity = SOUTHWEST;
@@ -255,7 +286,8 @@ public:
 
         widget_show_all(w_top);
 
-        pa.startTimeout(60);
+        // the play head follow at display refresh rate (~60Hz)
+        pa.startTimeout(16);
         pa.set<SoundEditUi, &SoundEditUi::updateUI>(this);
 
     }
@@ -267,11 +299,11 @@ public:
 
         float freq = 0.0;
         pitchCorrection = 0;
-        if (af.samples) rootkey = pt.getPitch(af.samples, af.samplesize , af.channels, (float)jack_sr, &pitchCorrection, &freq);
+        if (af.samples) rootkey = pt.getPitch(af.samples, af.samplesize , af.channels, (float)af.samplerate, &pitchCorrection, &freq);
         char s[10];
         snprintf(s, 10, "%.2f Hz", freq);
         std::string fr = s;
-        info0 = "  Frequency:  " + fr + "  SampleRate:  " + std::to_string(jack_sr) + " Hz ";
+        info0 = "  Frequency:  " + fr + "  SampleRate:  " + std::to_string(af.samplerate) + " Hz ";
         info =  "  Root Key:  " + std::to_string(rootkey);
         info3 = "  PitchCorrection:  " + std::to_string(pitchCorrection) + " Cent";
         info1 = "  SampleSize: " + std::to_string(af.samplesize);
@@ -359,8 +391,12 @@ private:
     Widget_t *Reverb;
     Widget_t *e_save;
     Widget_t *e_quit;
+    Widget_t *deviceBox;
 
     SupportedFormats supportedFormats;
+    std::function<bool(int)> selectDevice;
+    int activeDevice;
+    int playHeadPixel;
 
     PaStream* stream;
 
@@ -380,18 +416,9 @@ private:
         play = false;
         ready = false;
         uint32_t new_size = (loopPoint_r-loopPoint_l) * af.channels;
-        delete[] af.saveBuffer;
-        af.saveBuffer = nullptr;
-        af.saveBuffer = new float[new_size];
-        std::memset(af.saveBuffer, 0, new_size * sizeof(float));
-        for (uint32_t i = 0; i<new_size; i++) {
-            af.saveBuffer[i] = af.samples[i+loopPoint_l];
-        }
-        delete[] af.samples;
-        af.samples = nullptr;
-        af.samples =  new float[new_size];
-        std::memset(af.samples, 0, new_size * sizeof(float));
-        memcpy(af.samples, af.saveBuffer, new_size * sizeof(float));
+        // move the clipped range to the buffer start, in place
+        std::memmove(af.samples, af.samples + (size_t)loopPoint_l * af.channels,
+                                            new_size * sizeof(float));
 
         af.samplesize = new_size / af.channels;
         position = 0;
@@ -401,8 +428,6 @@ private:
         adj_set_state(loopMark_R->adj,1.0);
         loopPoint_r = af.samplesize;
 
-        delete[] af.saveBuffer;
-        af.saveBuffer = nullptr;
         loadNew = true;
         update_waveview(wview, af.samples, af.samplesize);
         if (adj_get_value(playbutton->adj))
@@ -429,8 +454,17 @@ private:
         position = 0;
 
         ready = false;
-        is_loaded = af.getAudioFile(file, jack_sr);
+        is_loaded = af.getAudioFile(file);
         if (!is_loaded) failToLoad();
+        setupPreview();
+    }
+
+    // resample the preview from the file rate to the server rate,
+    // the audio callback switch to the new resampler on its next cycle
+    void setupPreview() {
+        if (!preview.setup(af.samplerate, jack_sr, 2))
+            std::cerr << "Error: could not resample the preview from " << af.samplerate
+                << "hz to " << jack_sr << "hz" << std::endl;
     }
 
     // load Sound File data into memory
@@ -473,7 +507,7 @@ private:
             self->lname = lname;
            // destroy_widget(self->exportWindow, self->w->app);
             self->af.savesf2(self->lname, self->loopPoint_l, self->loopPoint_r,
-                            self->jack_sr, self->gain, self->rootkey,
+                            self->af.samplerate, self->gain, self->rootkey,
                             self->chorus, self->reverb, self->pitchCorrection);
         }
     }
@@ -531,24 +565,43 @@ private:
 
     static void dummy_callback(void *w_, void* user_data) {}
 
-    // frequently (60ms) update the wave view widget for playhead position
-    // triggered from the timeout background thread 
+    // frequently (16ms) update the wave view widget for playhead position
+    // triggered from the timeout background thread. The position is
+    // the one published by the audio callback, extrapolated to now.
+    // Only when the play head moved to a other pixel the strip
+    // between the old and the new pixel get redrawn.
     void updateUI() {
         static int waitOne = 0;
-        #if defined(__linux__) || defined(__FreeBSD__) || \
-            defined(__NetBSD__) || defined(__OpenBSD__)
-        XLockDisplay(w->app->dpy);
-        #endif
-        wview->func.adj_callback = dummy_callback;
-        if (ready) adj_set_value(wview->adj, (float) position);
-        else {
-            waitOne++;
-            if (waitOne > 2) {
+        if (ready) {
+            const uint32_t pos = playHead.estimate(PlayHead::now(), af.samplerate,
+                                        loopPoint_l, loopPoint_r, position);
+            const float max = adj_get_max_value(wview->adj);
+            const int x = max > 0.0 ? (int)(wview->width * ((float)pos / max)) : 0;
+            if (x == playHeadPixel) return;
+            #if defined(__linux__) || defined(__FreeBSD__) || \
+                defined(__NetBSD__) || defined(__OpenBSD__)
+            XLockDisplay(w->app->dpy);
+            #endif
+            wview->func.adj_callback = dummy_callback;
+            adj_set_value(wview->adj, (float) pos);
+            if (playHeadPixel < 0 || !draw_playhead_strip(wview, playHeadPixel, x))
+                expose_widget(wview);
+            playHeadPixel = x;
+        } else {
+            // the spinning wheel, like before at ~60ms
+            playHeadPixel = -1;
+            if (++waitOne % 4) return;
+            #if defined(__linux__) || defined(__FreeBSD__) || \
+                defined(__NetBSD__) || defined(__OpenBSD__)
+            XLockDisplay(w->app->dpy);
+            #endif
+            wview->func.adj_callback = dummy_callback;
+            if (waitOne >= 12) {
                 transparent_draw(wview, nullptr);
                 waitOne = 0;
             }
+            expose_widget(wview);
         }
-        expose_widget(wview);
         #if defined(__linux__) || defined(__FreeBSD__) || \
             defined(__NetBSD__) || defined(__OpenBSD__)
         XFlush(w->app->dpy);
@@ -846,6 +899,19 @@ private:
         self->gain = std::pow(1e+01, 0.05 * adj_get_value(w->adj));
     }
 
+    // switch the audio device, stay with the old one when that fail
+    static void set_device(void *w_, void* user_data) {
+        Widget_t *w = (Widget_t*)w_;
+        SoundEditUi *self = static_cast<SoundEditUi*>(w->parent_struct);
+        int d = static_cast<int>(adj_get_value(w->adj));
+        if (d == self->activeDevice || !self->selectDevice) return;
+        const bool playing = self->play;
+        self->play = false;
+        if (self->selectDevice(d)) self->activeDevice = d;
+        else combobox_set_active_entry(w, self->activeDevice);
+        self->play = playing;
+    }
+
     // Root Key 
     static void set_root_key(void *w_, void* user_data) {
         Widget_t *w = (Widget_t*)w_;
@@ -1047,30 +1113,52 @@ private:
             self->create_waveview_image(w, width_t, height_t);
             os_get_surface_size(w->image, &width, &height);
         }
-        cairo_set_source_surface (w->crb, w->image, 0, 0);
-        cairo_rectangle(w->crb,0, 0, width, height);
-        cairo_fill(w->crb);
+        paint_wview(w, w->crb, width, height);
+        if (!self->ready) 
+            show_spinning_wheel(w, nullptr);
+
+    }
+
+    // the wave image, the play head and the loop marks
+    static void paint_wview(Widget_t *w, cairo_t *cr, int width, int height) {
+        SoundEditUi *self = static_cast<SoundEditUi*>(w->parent_struct);
+        cairo_set_source_surface (cr, w->image, 0, 0);
+        cairo_rectangle(cr,0, 0, width, height);
+        cairo_fill(cr);
 
         double state = adj_get_state(w->adj);
-        cairo_set_source_rgba(w->crb, 0.55, 0.05, 0.05, 1);
-        cairo_rectangle(w->crb, (width * state) - 1.5,2,3, height-4);
-        cairo_fill(w->crb);
+        cairo_set_source_rgba(cr, 0.55, 0.05, 0.05, 1);
+        cairo_rectangle(cr, (width * state) - 1.5,2,3, height-4);
+        cairo_fill(cr);
 
         //int halfWidth = width*0.5;
 
         double state_l = adj_get_state(self->loopMark_L->adj);
-        cairo_set_source_rgba(w->crb, 0.25, 0.25, 0.05, 0.666);
-        cairo_rectangle(w->crb, 0, 2, (width*state_l), height-4);
-        cairo_fill(w->crb);
+        cairo_set_source_rgba(cr, 0.25, 0.25, 0.05, 0.666);
+        cairo_rectangle(cr, 0, 2, (width*state_l), height-4);
+        cairo_fill(cr);
 
         double state_r = adj_get_state(self->loopMark_R->adj);
-        cairo_set_source_rgba(w->crb, 0.25, 0.25, 0.05, 0.666);
+        cairo_set_source_rgba(cr, 0.25, 0.25, 0.05, 0.666);
         int point = (width*state_r);
-        cairo_rectangle(w->crb, point, 2 , width - point, height-4);
-        cairo_fill(w->crb);
-        if (!self->ready) 
-            show_spinning_wheel(w, nullptr);
+        cairo_rectangle(cr, point, 2 , width - point, height-4);
+        cairo_fill(cr);
+    }
 
+    // repaint only the strip from the old to the new play head pixel straight
+    // on the window, return false when the wave image needs a full redraw
+    bool draw_playhead_strip(Widget_t *w, int from, int to) {
+        if (!w->image || loadNew) return false;
+        int width, height;
+        os_get_surface_size(w->image, &width, &height);
+        if (width != w->width || height != w->height) return false;
+        const int x = min(from, to) - 3;
+        cairo_save(w->cr);
+        cairo_rectangle(w->cr, x, 0, std::abs(to - from) + 6, height);
+        cairo_clip(w->cr);
+        paint_wview(w, w->cr, width, height);
+        cairo_restore(w->cr);
+        return true;
     }
 
     static void drawWheel(Widget_t *w, float di, int x, int y, int radius, float s) {
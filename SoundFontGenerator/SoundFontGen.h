@@ -20,11 +20,29 @@
 #include <cstdint>
 #include <cstring>
 #include <cmath>
+#include <chrono>
+#include <algorithm>
 
 #include <cassert>
 
+#if !defined(_WIN32)
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include <sndfile.hh>
 
+#include "ChunkBuffer.h"
+#include "MappedAudio.h"
+#include "Trace.h"
+
 #pragma once
 
 #ifndef SOUNDFONTGEN_H
@@ -33,7 +51,8 @@
 class AudioConvert {
 public:
     std::vector<int16_t> data;
-    std::vector<int16_t> loop_data;
+    uint32_t loop_start;
+    uint32_t loop_end;
     uint32_t channels;
     uint32_t samplesize;
     uint32_t sampleRate;
@@ -42,13 +61,25 @@ public:
         channels   = 0;
         samplesize = 0;
         sampleRate = 0;
+        loop_start = 0;
+        loop_end   = 0;
         data.clear();
     }
     
     ~AudioConvert() {}
 
+    // the loop sample is a view into data, no copy is made
+    inline const int16_t* loop_data() const {
+        return data.data() + loop_start;
+    }
+
+    inline uint32_t loop_size() const {
+        return loop_end - loop_start;
+    }
+
     // load a Audio File into the buffer
     inline bool load(const std::string& file) {
+        TRACE_SCOPE("AudioConvert::load");
         SF_INFO info;
         info.format = 0;
 
@@ -56,6 +87,29 @@ public:
         samplesize = 0;
         sampleRate = 0;
         float *samples = nullptr;
+        data.clear();
+        // uncompressed WAV/AIFF, convert the first channel block wise from the
+        // mapped file, through the same float path (and scale) as libsndfile below
+        MappedAudio mapped;
+        if (mapped.open(file.c_str())) {
+            if (mapped.channels > 1) {
+                std::cerr << "Warning: only the first channel is used!" << std::endl;
+            }
+            data.resize(mapped.frames);
+            std::vector<float> block((size_t)LOAD_BLOCK * mapped.channels);
+            while (samplesize < mapped.frames) {
+                const uint32_t n = mapped.readFloat(block.data(), samplesize,
+                                        std::min(LOAD_BLOCK, mapped.frames - samplesize));
+                if (!n) break;
+                convertRange(block.data(), samplesize, n, mapped.channels, 1.0f);
+                samplesize += n;
+            }
+            data.resize(samplesize);
+            channels = mapped.channels;
+            sampleRate = mapped.samplerate;
+            setLoop(0, data.size());
+            return !data.empty();
+        }
         // Open the wave file for reading
         SNDFILE *sndfile = sf_open(file.c_str(), SFM_READ, &info);
 
@@ -77,52 +131,356 @@ public:
         channels = info.channels;
         sampleRate = info.samplerate;
         sf_close(sndfile);
-        for (uint32_t i = 0; i<samplesize; i++) {
-            data.push_back(floatToInt16(samples[i * info.channels]));
-        }
+        convertStrided(samples, samplesize, info.channels, 1.0f);
         delete[] samples;
-        if (!data.empty()) {
-            loop_data.assign(data.begin(), data.end());
-            //croosfade();
-        }
+        setLoop(0, data.size());
         return !data.empty();
     }
     
     inline bool convert(const float *samples, const uint32_t samplerate,
             const uint32_t samplesize, const uint32_t loop_l, const uint32_t loop_r) {
-        data.clear();
+        return convert(samples, 1, 1.0f, samplerate, samplesize, loop_l, loop_r);
+    }
+
+    // convert every stride'th sample (one channel of a interleaved buffer)
+    // with the given gain in a single pass
+    inline bool convert(const float *samples, const uint32_t stride, const float gain,
+            const uint32_t samplerate, const uint32_t samplesize,
+            const uint32_t loop_l, const uint32_t loop_r) {
+        TRACE_SCOPE("AudioConvert::convert");
         sampleRate = samplerate;
-        for (uint32_t i = 0; i<samplesize; i++) {
-            data.push_back(floatToInt16(samples[i]));
+        convertStrided(samples, samplesize, stride, gain);
+        setLoop(loop_l, loop_r);
+        return !data.empty();
+    }
+
+    // convert count samples into data[start], data must be sized already.
+    // used to convert block wise while the rest of the buffer is written
+    inline void convertRange(const float *samples, const uint32_t start, const uint32_t count,
+                                const uint32_t stride, const float gain) {
+        int16_t* d = data.data() + start;
+        if (stride == 1) {
+            convertBlocks<1>(samples, d, count, gain);
+            return;
+        } else if (stride == 2) {
+            convertBlocks<2>(samples, d, count, gain);
+            return;
         }
-        if (!data.empty()) {
-            loop_data.assign(data.begin() + loop_l, data.begin() + loop_r);
-            //croosfade();
+        for (uint32_t i = 0; i < count; i++) {
+            d[i] = floatToInt16(samples[(size_t)i * stride] * gain);
         }
+    }
+
+    // convert the two planes of a planar stereo buffer with gain, unit stride,
+    // the left channel into this buffer, the right one into right
+    inline bool convertStereo(const float *left, const float *rightPlane, AudioConvert& right,
+            const float gain, const uint32_t samplerate, const uint32_t samplesize,
+            const uint32_t loop_l, const uint32_t loop_r) {
+        TRACE_SCOPE("AudioConvert::convertStereo");
+        sampleRate = samplerate;
+        right.sampleRate = samplerate;
+        data.resize(samplesize);
+        right.data.resize(samplesize);
+        int16_t* l = data.data();
+        int16_t* r = right.data.data();
+        convertBlocks<1>(left, l, samplesize, gain);
+        convertBlocks<1>(rightPlane, r, samplesize, gain);
+        setLoop(loop_l, loop_r);
+        right.setLoop(loop_l, loop_r);
         return !data.empty();
     }
 
+    // set the final size and the loop of a block wise converted buffer
+    inline void setSize(const uint32_t size, const uint32_t samplerate,
+                                const uint32_t loop_l, const uint32_t loop_r) {
+        data.resize(size);
+        samplesize = size;
+        sampleRate = samplerate;
+        setLoop(loop_l, loop_r);
+    }
+
 private:
-    // convert float to short (16 bit) 
-    inline int16_t floatToInt16(float x) {
+    // frames load() convert at once from a mapped file
+    static constexpr uint32_t LOAD_BLOCK = 65536;
+
+    // NaN (all exponent bits and a mantissa) tested on the bits, -ffast-math
+    // (-ffinite-math-only) fold std::isnan() and x != x to false
+    static inline bool isNaN(float x) {
+        uint32_t u;
+        std::memcpy(&u, &x, sizeof(u));
+        return (u & 0x7fffffffu) > 0x7f800000u;
+    }
+
+    // convert float to short (16 bit), NaN end as full scale
+    static inline int16_t floatToInt16(float x) {
+        if (isNaN(x)) return 32767;
         x = std::fmax(-1.0f, std::fmin(1.0f, x));
         return static_cast<int16_t>(std::lrintf(x * 32767.0f));
     }
 
-    inline void croosfade() {
-        size_t fadeLen = std::min<size_t>(256, loop_data.size() / 10);
+    #if defined(__SSE2__)
+    // four samples, every Stride'th one
+    template <uint32_t Stride>
+    static inline __m128 load4(const float *s) {
+        if constexpr (Stride == 1) return _mm_loadu_ps(s);
+        else return _mm_set_ps(s[3 * Stride], s[2 * Stride], s[Stride], s[0]);
+    }
+
+    // clamp to -1 - 1 and scale, NaN is replaced by 1.0 first (like
+    // floatToInt16() does), minps/maxps alone don't give that under -ffast-math
+    static inline __m128 scale4(__m128 x) {
+        const __m128i nanMask = _mm_cmpgt_epi32(
+                    _mm_and_si128(_mm_castps_si128(x), _mm_set1_epi32(0x7fffffff)),
+                    _mm_set1_epi32(0x7f800000));
+        const __m128 nan = _mm_castsi128_ps(nanMask);
+        const __m128 one = _mm_set1_ps(1.0f);
+        x = _mm_or_ps(_mm_andnot_ps(nan, x), _mm_and_ps(nan, one));
+        x = _mm_max_ps(_mm_min_ps(x, one), _mm_set1_ps(-1.0f));
+        return _mm_mul_ps(x, _mm_set1_ps(32767.0f));
+    }
+    #endif
+
+    // convert every Stride'th sample, with Stride 2 one channel of a interleaved pair.
+    // With SSE2 eight samples at once, cvtps2dq round in the current rounding
+    // mode like lrintf() in floatToInt16() (nearest even by default), so the
+    // result is the same as the scalar loop, whatever -ffast-math reorder
+    template <uint32_t Stride>
+    static inline void convertBlocks(const float *s, int16_t* d, const uint32_t n, const float gain) {
+        uint32_t i = 0;
+        #if defined(__SSE2__)
+        const __m128 g = _mm_set1_ps(gain);
+        for (; i + 8 <= n; i += 8) {
+            const __m128 a = scale4(_mm_mul_ps(load4<Stride>(s + (size_t)i * Stride), g));
+            const __m128 b = scale4(_mm_mul_ps(load4<Stride>(s + (size_t)(i + 4) * Stride), g));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(d + i),
+                            _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+        }
+        #endif
+        for (; i < n; i++) d[i] = floatToInt16(s[(size_t)i * Stride] * gain);
+    }
+
+    inline void convertStrided(const float *samples, const uint32_t size,
+                                const uint32_t stride, const float gain) {
+        data.resize(size);
+        convertRange(samples, 0, size, stride, gain);
+    }
+
+    inline void setLoop(uint32_t loop_l, uint32_t loop_r) {
+        loop_end = std::min<uint32_t>(loop_r, data.size());
+        loop_start = std::min<uint32_t>(loop_l, loop_end);
+        //croosfade(data.data() + loop_start, loop_size());
+    }
+
+    inline void croosfade(int16_t* loop, size_t size) {
+        size_t fadeLen = std::min<size_t>(256, size / 10);
         if (fadeLen == 0) return;
         // fade in at loop start
         for (size_t i = 0; i < fadeLen; ++i) {
             float gain = static_cast<float>(i) / static_cast<float>(fadeLen);
-            loop_data[i] *= gain;
+            loop[i] *= gain;
         }
         // fade out at loop end - fade length 
-        for (size_t i = loop_data.size() - fadeLen; i < loop_data.size(); ++i) {
+        for (size_t i = size - fadeLen; i < size; ++i) {
             float gain = 1.0f - static_cast<float>(i) / static_cast<float>(fadeLen);
-            loop_data[i] *= gain;
+            loop[i] *= gain;
+        }
+    }
+};
+
+/****************************************************************
+  SF2File - write a sf2 file from a list of buffers
+
+  The writers build the RIFF image without the sample data (INFO,
+  the sdta headers and the pdta) in a ChunkBuffer, the sample data
+  is written straight from the AudioConvert buffers. write() send
+  the slices with writev() into a preallocated file, large files
+  with O_DIRECT when enabled, on Windows (or with setPortableIO)
+  through a ofstream.
+****************************************************************/
+
+class SF2File {
+public:
+    // a part of the output file
+    struct Slice {
+        const void* data;
+        size_t size;
+    };
+
+    SF2File() {
+        directIO = false;
+        directThreshold = 64 * 1024 * 1024;
+        portableIO = false;
+    }
+
+    // write files larger than threshold bytes with O_DIRECT (bypass the page cache)
+    // only used on linux, everywhere else this is a no-op
+    void setDirectIO(bool enable, size_t threshold = 64 * 1024 * 1024) {
+        directIO = enable;
+        directThreshold = threshold;
+    }
+
+    // write through the portable ofstream fallback on every platform,
+    // the baseline the benchmark compare writev and O_DIRECT against
+    void setPortableIO(bool enable) {
+        portableIO = enable;
+    }
+
+    // write the n slices, total is the file size
+    bool write(const std::string& sf2file, const Slice* s, size_t n, size_t total) {
+        if (portableIO) return write_stream(sf2file, s, n);
+        #if !defined(_WIN32)
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        #if defined(O_DIRECT)
+        const bool direct = directIO && total >= directThreshold;
+        if (direct) flags |= O_DIRECT;
+        #else
+        const bool direct = false;
+        #endif
+        int fd = open(sf2file.c_str(), flags, 0644);
+        // the file system may not support O_DIRECT, try again without
+        if (fd < 0 && direct) fd = open(sf2file.c_str(), flags & ~O_DIRECT, 0644);
+        if (fd < 0) return false;
+        // preallocate the target size, ignore when not supported by the file system
+        posix_fallocate(fd, 0, total);
+        bool ret = false;
+        #if defined(O_DIRECT)
+        if (direct && (fcntl(fd, F_GETFL) & O_DIRECT)) ret = write_direct(fd, s, n);
+        else
+        #endif
+        ret = writev_all(fd, s, n);
+        if (close(fd) != 0) ret = false;
+        return ret;
+        #else
+        (void)total;
+        return write_stream(sf2file, s, n);
+        #endif
+    }
+
+    // the INFO list, the same for every bank
+    static void write_info(ChunkBuffer& riff, const std::string& name) {
+        TRACE_SCOPE("SF2File::write_info");
+        const size_t list = riff.begin_list("LIST", "INFO");
+        riff.put_bytes("ifil", 4); riff.put<uint32_t>(4); riff.put<uint16_t>(2); riff.put<uint16_t>(1);
+        riff.put_bytes("isng", 4); riff.put<uint32_t>(10); riff.put_strz("EMU8000", 10);
+        riff.put_bytes("INAM", 4); riff.put<uint32_t>(20); riff.put_strz(name, 20);
+        riff.put_bytes("ICRD", 4); riff.put<uint32_t>(10); riff.put_strz("2025", 10);
+        riff.end_chunk(list);
+    }
+
+    // only the sdta headers, smpl bytes of sample data follow them
+    static void write_sdta(ChunkBuffer& riff, size_t smpl) {
+        TRACE_SCOPE("SF2File::write_sdta");
+        riff.put_bytes("LIST", 4); riff.put<uint32_t>(static_cast<uint32_t>(4 + 8 + smpl));
+        riff.put_bytes("sdta", 4);
+        riff.put_bytes("smpl", 4); riff.put<uint32_t>(static_cast<uint32_t>(smpl));
+    }
+
+    #if !defined(_WIN32)
+    // write size bytes at offset, handle partial writes
+    static bool pwrite_all(int fd, const uint8_t* p, size_t size, off_t offset) {
+        while (size) {
+            const ssize_t r = pwrite(fd, p, size, offset);
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += r;
+            size -= r;
+            offset += r;
         }
+        return true;
     }
+    #endif
+
+private:
+    bool directIO;
+    size_t directThreshold;
+    bool portableIO;
+
+    // IOV_MAX on linux
+    static constexpr size_t IOV_BATCH = 1024;
+
+    // fallback, write the slices through a ofstream
+    bool write_stream(const std::string& sf2file, const Slice* s, size_t n) {
+        TRACE_SCOPE("SF2File::write_stream");
+        std::ofstream outf(sf2file, std::ios::binary);
+        if (!outf) return false;
+        for (size_t i = 0; i < n; i++)
+            outf.write(static_cast<const char*>(s[i].data), s[i].size);
+        outf.close();
+        return !outf.fail();
+    }
+
+    #if !defined(_WIN32)
+    // gather the slices into a aligned staging buffer and write it with O_DIRECT,
+    // the unaligned tail is written after O_DIRECT got switched off again
+    bool write_direct(int fd, const Slice* s, size_t n) {
+        TRACE_SCOPE("SF2File::write_direct");
+        const size_t align = 4096;
+        const size_t stage = 4 * 1024 * 1024;
+        void* m = nullptr;
+        if (posix_memalign(&m, align, stage) != 0) return false;
+        std::unique_ptr<uint8_t, decltype(&free)> buf(static_cast<uint8_t*>(m), &free);
+        size_t fill = 0;
+        off_t offset = 0;
+        for (size_t i = 0; i < n; i++) {
+            const uint8_t* src = static_cast<const uint8_t*>(s[i].data);
+            size_t left = s[i].size;
+            while (left) {
+                const size_t c = std::min(left, stage - fill);
+                std::memcpy(buf.get() + fill, src, c);
+                fill += c;
+                src += c;
+                left -= c;
+                if (fill == stage) {
+                    if (!pwrite_all(fd, buf.get(), stage, offset)) return false;
+                    offset += stage;
+                    fill = 0;
+                }
+            }
+        }
+        const size_t aligned = fill & ~(align - 1);
+        if (aligned) {
+            if (!pwrite_all(fd, buf.get(), aligned, offset)) return false;
+            offset += aligned;
+        }
+        if (fill > aligned) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            if (!pwrite_all(fd, buf.get() + aligned, fill - aligned, offset)) return false;
+        }
+        return true;
+    }
+
+    // write the slices with writev(), at most IOV_BATCH at once, handle partial writes
+    static bool writev_all(int fd, const Slice* s, size_t n) {
+        TRACE_SCOPE("SF2File::writev_all");
+        std::vector<struct iovec> iov;
+        iov.reserve(n);
+        for (size_t i = 0; i < n; i++) {
+            if (!s[i].size) continue;
+            iov.push_back({const_cast<void*>(s[i].data), s[i].size});
+        }
+        struct iovec* v = iov.data();
+        size_t cnt = iov.size();
+        while (cnt) {
+            ssize_t r = writev(fd, v, (int)std::min(cnt, IOV_BATCH));
+            if (r < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            while (cnt && static_cast<size_t>(r) >= v->iov_len) {
+                r -= v->iov_len;
+                v++;
+                cnt--;
+            }
+            if (cnt) {
+                v->iov_base = static_cast<uint8_t*>(v->iov_base) + r;
+                v->iov_len -= r;
+            }
+        }
+        return true;
+    }
+    #endif
 };
 
 class SoundFontWriter {
@@ -133,10 +491,13 @@ public:
                             const std::string& name, uint8_t rootNote = 60,
                             const uint16_t Chorus = 500, const uint16_t Reverb = 500,
                             const int16_t pitchCorrection = 0) {
+        const auto t = Clock::now();
         if (!sample.load(filename)) {
             std::cerr << "Failed to read wav file or unsupported format!\n";
             return false;
         }
+        convertTime = ms(t);
+        stereo = false;
         loop_left = 0;
         loop_right = sample.data.size();
         rootKey = rootNote;
@@ -156,22 +517,146 @@ public:
                     const std::string& sf2file, const std::string& name,
                     const uint8_t rootNote = 60, const uint16_t Chorus = 500,
                     const uint16_t Reverb = 500, const int16_t pitchCorrection = 0) {
+        return generate_sf2(samples, 1, 1.0f, loop_l, loop_r, samplesize, samplerate,
+                    sf2file, name, rootNote, Chorus, Reverb, pitchCorrection);
+    }
 
-        if (!sample.convert(samples, samplerate, samplesize, loop_l, loop_r)) {
+
+    // takes one channel of a interleaved audio float buffer as OneShoot instrument,
+    // the conversion to int16_t (with gain) is done in place, without a intermediate copy.
+    bool generate_sf2(const float *samples, const uint32_t stride, const float gain,
+                    const uint32_t loop_l, const uint32_t loop_r,
+                    const uint32_t samplesize, const uint32_t samplerate,
+                    const std::string& sf2file, const std::string& name,
+                    const uint8_t rootNote = 60, const uint16_t Chorus = 500,
+                    const uint16_t Reverb = 500, const int16_t pitchCorrection = 0) {
+
+        const auto t = Clock::now();
+        stereo = false;
+        right.data.clear();
+        if (!sample.convert(samples, stride, gain, samplerate, samplesize, loop_l, loop_r)) {
+            std::cerr << "Failed to read audio buffer or unsupported format!\n";
+            return false;
+        }
+        return write_zone(t, sf2file, name, loop_l, loop_r, rootNote, Chorus, Reverb, pitchCorrection);
+    }
+
+    // takes the planes of a planar buffer, a right plane is written as linked
+    // stereo sample, without it the left plane is written as mono sample
+    bool generate_sf2(const float *left, const float *rightPlane, const float gain,
+                    const uint32_t loop_l, const uint32_t loop_r,
+                    const uint32_t samplesize, const uint32_t samplerate,
+                    const std::string& sf2file, const std::string& name,
+                    const uint8_t rootNote = 60, const uint16_t Chorus = 500,
+                    const uint16_t Reverb = 500, const int16_t pitchCorrection = 0) {
+
+        if (!rightPlane)
+            return generate_sf2(left, 1, gain, loop_l, loop_r, samplesize, samplerate,
+                    sf2file, name, rootNote, Chorus, Reverb, pitchCorrection);
+        const auto t = Clock::now();
+        stereo = true;
+        if (!sample.convertStereo(left, rightPlane, right, gain, samplerate, samplesize, loop_l, loop_r)) {
             std::cerr << "Failed to read audio buffer or unsupported format!\n";
             return false;
         }
+        return write_zone(t, sf2file, name, loop_l, loop_r, rootNote, Chorus, Reverb, pitchCorrection);
+    }
+
+    // write banks larger than threshold bytes with O_DIRECT (bypass the page cache)
+    // only used on linux, everywhere else this is a no-op
+    void setDirectIO(bool enable, size_t threshold = 64 * 1024 * 1024) {
+        file.setDirectIO(enable, threshold);
+    }
+
+    // write through the portable ofstream fallback on every platform
+    void setPortableIO(bool enable) {
+        file.setPortableIO(enable);
+    }
+
+    #if !defined(_WIN32)
+    // streaming: the sample data is converted and written block wise while
+    // it's produced, the headers, the loop sample and the pdta follow in end_stream().
+    // capacity is the maximal sample size
+    bool begin_stream(const std::string& sf2file, const uint32_t capacity) {
+        abort_stream();
+        streamFd = open(sf2file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (streamFd < 0) return false;
+        streamFile = sf2file;
+        stereo = false;
+        sample.data.resize(capacity);
+        // preallocate for the worst case, end_stream() truncate to the final size
+        posix_fallocate(streamFd, 0, HEADER_SIZE + (8 + PDTA_SIZE) + ((uint64_t)capacity * 2 + 48) * 2);
+        return true;
+    }
+
+    // convert count samples (one channel) with gain to data[start]
+    void stream_convert(const float *samples, const uint32_t start, const uint32_t count,
+                                const uint32_t stride, const float gain) {
+        TRACE_SCOPE("AudioConvert::convertRange");
+        sample.convertRange(samples, start, count, stride, gain);
+    }
+
+    // write data[start] - data[start+count] to its final position in the file
+    bool stream_write(const uint32_t start, const uint32_t count) {
+        TRACE_SCOPE("SoundFontWriter::stream_write");
+        return SF2File::pwrite_all(streamFd, reinterpret_cast<const uint8_t*>(sample.data.data() + start),
+                    (size_t)count * sizeof(int16_t), HEADER_SIZE + sizeof(pad) + (off_t)start * sizeof(int16_t));
+    }
+
+    // write all what's left, when the sample data is complete
+    bool end_stream(const uint32_t size, const uint32_t loop_l, const uint32_t loop_r,
+                    const uint32_t samplerate, const std::string& name,
+                    const uint8_t rootNote = 60, const uint16_t Chorus = 500,
+                    const uint16_t Reverb = 500, const int16_t pitchCorrection = 0) {
+        TRACE_SCOPE("SoundFontWriter::end_stream");
+        if (streamFd < 0) return false;
+        sample.setSize(size, samplerate, loop_l, loop_r);
         loop_left = loop_l;
         loop_right = loop_r;
         rootKey = rootNote;
         chorus = Chorus;
         reverb = Reverb;
         chPitchCorrection = pitchCorrection;
-        return write_sf2(sf2file, name);
+        build_riff(name);
+        assert(sdta_end == HEADER_SIZE);
+        Slice s[NSLICES];
+        const size_t n = get_slices(s);
+        // the headers and the first pad before the data, the rest behind it
+        bool ret = SF2File::pwrite_all(streamFd, static_cast<const uint8_t*>(s[0].data), s[0].size, 0) &&
+                   SF2File::pwrite_all(streamFd, static_cast<const uint8_t*>(s[1].data), s[1].size, s[0].size);
+        off_t offset = s[0].size + s[1].size + s[2].size;
+        for (size_t i = 3; i < n && ret; i++) {
+            ret = SF2File::pwrite_all(streamFd, static_cast<const uint8_t*>(s[i].data), s[i].size, offset);
+            offset += s[i].size;
+        }
+        if (ret && ftruncate(streamFd, offset) != 0) ret = false;
+        if (close(streamFd) != 0) ret = false;
+        streamFd = -1;
+        bytesWritten = ret ? offset : 0;
+        return ret;
+    }
+
+    // close and remove a unfinished stream
+    void abort_stream() {
+        if (streamFd < 0) return;
+        close(streamFd);
+        streamFd = -1;
+        unlink(streamFile.c_str());
     }
+    #endif
 
+    // statistics of the last written file, times in ms
+    double convertTime;
+    double writeTime;
+    uint64_t bytesWritten;
 
     SoundFontWriter() {
+        convertTime = 0.0;
+        writeTime = 0.0;
+        bytesWritten = 0;
+        streamFd = -1;
+        sdta_end = 0;
+        stereo = false;
         loop_left = 0;
         loop_right = 0;
         rootKey = 60;
@@ -179,16 +664,53 @@ public:
         reverb = 500;
         chPitchCorrection = 0;
     };
-    ~SoundFontWriter(){};
+    ~SoundFontWriter(){
+        #if !defined(_WIN32)
+        abort_stream();
+        #endif
+    };
 
 private:
     AudioConvert sample;
+    // the right channel of a stereo sample, sample hold the left one
+    AudioConvert right;
+    bool stereo;
+
+    typedef std::chrono::steady_clock Clock;
 
-    std::vector<uint8_t> info;
-    std::vector<uint8_t> sdta;
-    std::vector<uint8_t> pdta;
-    std::vector<uint8_t> riff;
-    std::vector<std::vector<uint8_t>> pdta_chunks;
+    static double ms(Clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    }
+
+    // set up the zone of the converted sample and write the bank,
+    // t is the start of the conversion
+    bool write_zone(Clock::time_point t, const std::string& sf2file, const std::string& name,
+                    const uint32_t loop_l, const uint32_t loop_r, const uint8_t rootNote,
+                    const uint16_t Chorus, const uint16_t Reverb, const int16_t pitchCorrection) {
+        convertTime = ms(t);
+        loop_left = loop_l;
+        loop_right = loop_r;
+        rootKey = rootNote;
+        chorus = Chorus;
+        reverb = Reverb;
+        chPitchCorrection = pitchCorrection;
+        return write_sf2(sf2file, name);
+    }
+
+    // the RIFF image without the sample data, built in place into one reused buffer.
+    // The sample data is written straight from the AudioConvert buffers.
+    ChunkBuffer riff;
+    size_t sdta_end;
+
+    SF2File file;
+
+    // the open file while streaming
+    int streamFd;
+    std::string streamFile;
+
+    typedef SF2File::Slice Slice;
+    static constexpr size_t NSLICES = 11;
+    static inline const int16_t pad[16] = {0};
 
     uint32_t loop_left;
     uint32_t loop_right;
@@ -197,253 +719,260 @@ private:
     uint16_t reverb;
     int16_t chPitchCorrection;
 
+    // chunk sizes of the fixed two preset bank (without the 8 byte chunk header)
+    static constexpr size_t INFO_SIZE = 4 + (8+4) + (8+10) + (8+20) + (8+10);
+    static constexpr size_t PDTA_SIZE = 4 + (8+38*3) + (8+4*3) + (8+10) + (8+4*3)
+                                + (8+22*3) + (8+4*3) + (8+10) + (8+4*9) + (8+46*3);
+    // the stereo bank, two panned zones per instrument and four samples
+    static constexpr size_t STEREO_PDTA_SIZE = 4 + (8+38*3) + (8+4*3) + (8+10) + (8+4*3)
+                                + (8+22*3) + (8+4*5) + (8+10) + (8+4*21) + (8+46*5);
+    // RIFF, INFO and the sdta headers in front of the sample data
+    static constexpr size_t HEADER_SIZE = 12 + (8 + INFO_SIZE) + 12 + 8;
+
     // Buffer helpers for little-endian binary writing
     template<typename T>
-    void write(std::vector<uint8_t>& buf, T v) {
-        for (size_t i=0; i<sizeof(T); ++i) buf.push_back(uint8_t((reinterpret_cast<uint8_t*>(&v))[i]));
+    void write(ChunkBuffer& buf, T v) {
+        buf.put<T>(v);
     }
 
-    void write_str(std::vector<uint8_t>& buf, const char* s, size_t n) {
-        for (size_t i=0; i<n; ++i) buf.push_back(s[i]);
+    void write_str(ChunkBuffer& buf, const char* s, size_t n) {
+        buf.put_bytes(s, n);
     }
 
-    void write_strz(std::vector<uint8_t>& buf, const std::string& s, size_t n) {
-        for (size_t i=0; i<n; ++i) buf.push_back(i<s.size()?s[i]:0);
+    void write_strz(ChunkBuffer& buf, const std::string& s, size_t n) {
+        buf.put_strz(s, n);
     }
 
-    void write_info(const std::string& name) {
-        info.clear();
-        write_str(info, "LIST", 4); write<uint32_t>(info, 0); // placeholder
-        write_str(info, "INFO", 4);
-        write_str(info, "ifil", 4); write<uint32_t>(info, 4); write<uint16_t>(info, 2); write<uint16_t>(info, 1);
-        write_str(info, "isng", 4); write<uint32_t>(info, 10); write_strz(info, "EMU8000", 10);
-        write_str(info, "INAM", 4); write<uint32_t>(info, 20); write_strz(info, name, 20);
-        write_str(info, "ICRD", 4); write<uint32_t>(info, 10); write_strz(info, "2025", 10);
-        uint32_t info_size = static_cast<uint32_t>(info.size()) - 8;
-        std::memcpy(&info[4], &info_size, 4);
+    // pre-compute the size of the RIFF image
+    size_t riff_size() const {
+        return 12 + (8 + INFO_SIZE) + (8 + 4 + 8 + smpl_size()) +
+                                        (8 + (stereo ? STEREO_PDTA_SIZE : PDTA_SIZE));
     }
 
-    void write_sdta() {
-        sdta.clear();
-        write_str(sdta, "LIST", 4); write<uint32_t>(sdta, 0); // placeholder
-        write_str(sdta, "sdta", 4);
-        write_str(sdta, "smpl", 4); write<uint32_t>(sdta, 0); // placeholder
-        size_t smpl_offset = sdta.size();
-
-        for (int i=0; i<16; ++i) write<int16_t>(sdta, 0);
-        sdta.insert(sdta.end(), reinterpret_cast<const uint8_t*>(sample.data.data()),
-            reinterpret_cast<const uint8_t*>(sample.data.data()) + sample.data.size()*2);
-
-        for (int i=0; i<16; ++i) write<int16_t>(sdta, 0);
-
-        sdta.insert(sdta.end(), reinterpret_cast<const uint8_t*>(sample.loop_data.data()),
-            reinterpret_cast<const uint8_t*>(sample.loop_data.data()) + sample.loop_data.size()*2);
-
-        for (int i=0; i<16; ++i) write<int16_t>(sdta, 0);
+    // size of the smpl chunk data, the samples get 16 zero samples padding each
+    size_t smpl_size() const {
+        const size_t ch = stereo ? 2 : 1;
+        return ((sample.data.size() + sample.loop_size()) * ch + 16 * (1 + 2 * ch)) * sizeof(int16_t);
+    }
 
-        uint32_t smpl_len = static_cast<uint32_t>(sdta.size() - smpl_offset);
-        std::memcpy(&sdta[sdta.size() - smpl_len - 4], &smpl_len, 4);
-        uint32_t sdta_size = static_cast<uint32_t>(sdta.size()) - 8;
-        std::memcpy(&sdta[4], &sdta_size, 4);
+    // the output file as list of buffers: headers, sample data (zero copy), pdta.
+    // A stereo sample is stored as left, right, left loop, right loop
+    size_t get_slices(Slice* s) const {
+        size_t n = 0;
+        s[n++] = {riff.data(), sdta_end};
+        s[n++] = {pad, sizeof(pad)};
+        s[n++] = {sample.data.data(), sample.data.size() * sizeof(int16_t)};
+        s[n++] = {pad, sizeof(pad)};
+        if (stereo) {
+            s[n++] = {right.data.data(), right.data.size() * sizeof(int16_t)};
+            s[n++] = {pad, sizeof(pad)};
+        }
+        s[n++] = {sample.loop_data(), sample.loop_size() * sizeof(int16_t)};
+        s[n++] = {pad, sizeof(pad)};
+        if (stereo) {
+            s[n++] = {right.loop_data(), right.loop_size() * sizeof(int16_t)};
+            s[n++] = {pad, sizeof(pad)};
+        }
+        s[n++] = {riff.data() + sdta_end, riff.size() - sdta_end};
+        return n;
     }
 
     void write_phdr() {
+        TRACE_SCOPE("SoundFontWriter::write_phdr");
         // phdr (38*3)
-        std::vector<uint8_t> phdr;
-        write_str(phdr, "phdr", 4); write<uint32_t>(phdr, 38*3);
+        write_str(riff, "phdr", 4); write<uint32_t>(riff, 38*3);
         // Preset 0: OneShot
-        write_strz(phdr, "OneShot", 20);   // preset name
-        write<uint16_t>(phdr, 0);          // wPreset
-        write<uint16_t>(phdr, 0);          // wBank
-        write<uint16_t>(phdr, 0);          // wPresetBagNdx
-        write<uint32_t>(phdr, 0);          // dwLibrary
-        write<uint32_t>(phdr, 0);          // dwGenre
-        write<uint32_t>(phdr, 0);          // dwMorphology
+        write_strz(riff, "OneShot", 20);   // preset name
+        write<uint16_t>(riff, 0);          // wPreset
+        write<uint16_t>(riff, 0);          // wBank
+        write<uint16_t>(riff, 0);          // wPresetBagNdx
+        write<uint32_t>(riff, 0);          // dwLibrary
+        write<uint32_t>(riff, 0);          // dwGenre
+        write<uint32_t>(riff, 0);          // dwMorphology
         // Preset 1: Looped
-        write_strz(phdr, "Looped", 20);    // preset name
-        write<uint16_t>(phdr, 1);          // wPreset
-        write<uint16_t>(phdr, 0);          // wBank
-        write<uint16_t>(phdr, 1);          // wPresetBagNdx
-        write<uint32_t>(phdr, 0);          // dwLibrary
-        write<uint32_t>(phdr, 0);          // dwGenre
-        write<uint32_t>(phdr, 0);          // dwMorphology
+        write_strz(riff, "Looped", 20);    // preset name
+        write<uint16_t>(riff, 1);          // wPreset
+        write<uint16_t>(riff, 0);          // wBank
+        write<uint16_t>(riff, 1);          // wPresetBagNdx
+        write<uint32_t>(riff, 0);          // dwLibrary
+        write<uint32_t>(riff, 0);          // dwGenre
+        write<uint32_t>(riff, 0);          // dwMorphology
         // Terminator EOP
-        write_strz(phdr, "EOP", 20);       // preset name
-        write<uint16_t>(phdr, 0);          // wPreset
-        write<uint16_t>(phdr, 0);          // wBank
-        write<uint16_t>(phdr, 2);          // wPresetBagNdx (should point past end)
-        write<uint32_t>(phdr, 0);          // dwLibrary
-        write<uint32_t>(phdr, 0);          // dwGenre
-        write<uint32_t>(phdr, 0);          // dwMorphology
-        //assert(phdr.size() == 8 + 38*3);
-        pdta_chunks.push_back(std::move(phdr));
+        write_strz(riff, "EOP", 20);       // preset name
+        write<uint16_t>(riff, 0);          // wPreset
+        write<uint16_t>(riff, 0);          // wBank
+        write<uint16_t>(riff, 2);          // wPresetBagNdx (should point past end)
+        write<uint32_t>(riff, 0);          // dwLibrary
+        write<uint32_t>(riff, 0);          // dwGenre
+        write<uint32_t>(riff, 0);          // dwMorphology
     }
 
     void write_pbag() {
+        TRACE_SCOPE("SoundFontWriter::write_pbag");
         // pbag (4*3)
-        std::vector<uint8_t> pbag;
-        write_str(pbag, "pbag", 4); write<uint32_t>(pbag, 4*3);
+        write_str(riff, "pbag", 4); write<uint32_t>(riff, 4*3);
         // preset 0 bag (points to pgen index 0)
-        write<uint16_t>(pbag, 0); write<uint16_t>(pbag, 0);
+        write<uint16_t>(riff, 0); write<uint16_t>(riff, 0);
         // preset 1 bag (points to pgen index 1)
-        write<uint16_t>(pbag, 1); write<uint16_t>(pbag, 0);
+        write<uint16_t>(riff, 1); write<uint16_t>(riff, 0);
         // preset 2 bag (points to pgen index 2)
-        write<uint16_t>(pbag, 2); write<uint16_t>(pbag, 0);
-        //assert(pbag.size() == 8 + 12);
-        pdta_chunks.push_back(std::move(pbag));
+        write<uint16_t>(riff, 2); write<uint16_t>(riff, 0);
     }
 
     void write_pmod() {
+        TRACE_SCOPE("SoundFontWriter::write_pmod");
         // pmod (10 bytes)
-        std::vector<uint8_t> pmod;
-        write_str(pmod, "pmod", 4); write<uint32_t>(pmod, 10);
-        for (int i=0; i<10; ++i) write<uint8_t>(pmod, 0);
-        //assert(pmod.size() == 8 + 10);
-        pdta_chunks.push_back(std::move(pmod));
+        write_str(riff, "pmod", 4); write<uint32_t>(riff, 10);
+        riff.put_zero(10);
     }
 
     void write_pgen() {
+        TRACE_SCOPE("SoundFontWriter::write_pgen");
         // pgen (4*3)
-        std::vector<uint8_t> pgen;
-        write_str(pgen, "pgen", 4); write<uint32_t>(pgen, 4*3);
+        write_str(riff, "pgen", 4); write<uint32_t>(riff, 4*3);
         // preset 0 -> instrument 0
-        write<uint16_t>(pgen, 41); write<uint16_t>(pgen, 0);
+        write<uint16_t>(riff, 41); write<uint16_t>(riff, 0);
         // preset 1 -> instrument 1
-        write<uint16_t>(pgen, 41); write<uint16_t>(pgen, 1);
+        write<uint16_t>(riff, 41); write<uint16_t>(riff, 1);
         // terminator
-        write<uint16_t>(pgen, 0); write<uint16_t>(pgen, 0);
-        //assert(pgen.size() == 8 + 12);
-        pdta_chunks.push_back(std::move(pgen));
+        write<uint16_t>(riff, 0); write<uint16_t>(riff, 0);
     }
 
     void write_inst() {
-        // inst (22*3)
-        std::vector<uint8_t> inst;
-        write_str(inst, "inst", 4); write<uint32_t>(inst, 22*3);
-        write_strz(inst, "OneShot", 20); write<uint16_t>(inst, 0);
-        write_strz(inst, "Looped", 20); write<uint16_t>(inst, 1);
-        write_strz(inst, "EOI", 20); write<uint16_t>(inst, 2);
-        //assert(inst.size() == 8 + 66);
-        pdta_chunks.push_back(std::move(inst));
+        TRACE_SCOPE("SoundFontWriter::write_inst");
+        // inst (22*3), a stereo instrument has two zones
+        const uint16_t zones = stereo ? 2 : 1;
+        write_str(riff, "inst", 4); write<uint32_t>(riff, 22*3);
+        write_strz(riff, "OneShot", 20); write<uint16_t>(riff, 0);
+        write_strz(riff, "Looped", 20); write<uint16_t>(riff, zones);
+        write_strz(riff, "EOI", 20); write<uint16_t>(riff, 2 * zones);
     }
 
     void write_ibag() {
+        TRACE_SCOPE("SoundFontWriter::write_ibag");
+        if (stereo) {
+            // ibag (4*5), five generators per zone, the last entry is the terminator
+            write_str(riff, "ibag", 4); write<uint32_t>(riff, 4*5);
+            for (uint16_t b = 0; b < 5; b++) { write<uint16_t>(riff, b * 5); write<uint16_t>(riff, 0); }
+            return;
+        }
         // ibag (4*3)
-        std::vector<uint8_t> ibag;
-        write_str(ibag, "ibag", 4); write<uint32_t>(ibag, 4*3);
+        write_str(riff, "ibag", 4); write<uint32_t>(riff, 4*3);
         // instrument 0 (OneShot) uses igen records starting at index 0
-        write<uint16_t>(ibag, 0); write<uint16_t>(ibag, 0);
+        write<uint16_t>(riff, 0); write<uint16_t>(riff, 0);
         // instrument 1 (Looped) uses igen records starting at index 2
-        write<uint16_t>(ibag, 4); write<uint16_t>(ibag, 0);
+        write<uint16_t>(riff, 4); write<uint16_t>(riff, 0);
         // terminator: points to igen index 4 (end)
-        write<uint16_t>(ibag, 8); write<uint16_t>(ibag, 0);
-        //assert(ibag.size() == 8 + 12);
-        pdta_chunks.push_back(std::move(ibag));
+        write<uint16_t>(riff, 8); write<uint16_t>(riff, 0);
     }
 
     void write_imod() {
+        TRACE_SCOPE("SoundFontWriter::write_imod");
         // imod (10 bytes)
-        std::vector<uint8_t> imod;
-        write_str(imod, "imod", 4); write<uint32_t>(imod, 10);
-        for (int i=0; i<10; ++i) write<uint8_t>(imod, 0);
-        //assert(imod.size() == 8 + 10);
-        pdta_chunks.push_back(std::move(imod));
+        write_str(riff, "imod", 4); write<uint32_t>(riff, 10);
+        riff.put_zero(10);
     }
 
     void write_igen() {
-        // igen (4*5)
-        std::vector<uint8_t> igen;
-        write_str(igen, "igen", 4); write<uint32_t>(igen, 4*9);
+        TRACE_SCOPE("SoundFontWriter::write_igen");
+        if (stereo) {
+            // igen (4*21), the left and right zone of both instruments, panned hard
+            write_str(riff, "igen", 4); write<uint32_t>(riff, 4*21);
+            for (uint16_t id = 0; id < 4; id++) {
+                write<uint16_t>(riff, 15); write<uint16_t>(riff, chorus);           // Chorus send
+                write<uint16_t>(riff, 16); write<uint16_t>(riff, reverb);           // Reverb send
+                write<uint16_t>(riff, 17); write<int16_t>(riff, id & 1 ? 500 : -500);  // Pan
+                write<uint16_t>(riff, 54); write<uint16_t>(riff, id / 2);           // SampleModes
+                write<uint16_t>(riff, 53); write<uint16_t>(riff, id);               // SampleID
+            }
+            write<uint16_t>(riff, 0); write<uint16_t>(riff, 0);
+            return;
+        }
+        // igen (4*9)
+        write_str(riff, "igen", 4); write<uint32_t>(riff, 4*9);
         // Instrument 0 (OneShot)
-        write<uint16_t>(igen, 15); write<uint16_t>(igen, chorus);  // Chorus send 50%
-        write<uint16_t>(igen, 16); write<uint16_t>(igen, reverb);  // Reverb send 50%
-        write<uint16_t>(igen, 54); write<uint16_t>(igen, 0);    // SampleModes = OneShoot
-        write<uint16_t>(igen, 53); write<uint16_t>(igen, 0);    // SampleID, 0
+        write<uint16_t>(riff, 15); write<uint16_t>(riff, chorus);  // Chorus send 50%
+        write<uint16_t>(riff, 16); write<uint16_t>(riff, reverb);  // Reverb send 50%
+        write<uint16_t>(riff, 54); write<uint16_t>(riff, 0);    // SampleModes = OneShoot
+        write<uint16_t>(riff, 53); write<uint16_t>(riff, 0);    // SampleID, 0
         // Instrument 1 (Looped)
-        write<uint16_t>(igen, 15); write<uint16_t>(igen, chorus);  // Chorus send 50%
-        write<uint16_t>(igen, 16); write<uint16_t>(igen, reverb);  // Reverb send 50%
-        write<uint16_t>(igen, 54); write<uint16_t>(igen, 1);    // SampleModes = Standard Loop
-        write<uint16_t>(igen, 53); write<uint16_t>(igen, 1);    // SampleID, 1
+        write<uint16_t>(riff, 15); write<uint16_t>(riff, chorus);  // Chorus send 50%
+        write<uint16_t>(riff, 16); write<uint16_t>(riff, reverb);  // Reverb send 50%
+        write<uint16_t>(riff, 54); write<uint16_t>(riff, 1);    // SampleModes = Standard Loop
+        write<uint16_t>(riff, 53); write<uint16_t>(riff, 1);    // SampleID, 1
         // global terminator
-        write<uint16_t>(igen, 0); write<uint16_t>(igen, 0);
-        //assert(igen.size() == 8 + 44);
-        pdta_chunks.push_back(std::move(igen));
+        write<uint16_t>(riff, 0); write<uint16_t>(riff, 0);
+    }
+
+    // one sample header (46 bytes), the loop cover the whole sample.
+    // dwEnd and dwEndLoop are the first sample behind, like the sf2 spec
+    // define them (and the InstrumentWriter write them)
+    void write_sample(const char* name, uint32_t start, uint32_t size, uint16_t link, uint16_t type) {
+        write_strz(riff, name, 20);
+        write<uint32_t>(riff, start);                                 // dwStart
+        write<uint32_t>(riff, start + size);                          // dwEnd
+        write<uint32_t>(riff, start);                                 // dwStartLoop
+        write<uint32_t>(riff, start + size);                          // dwEndLoop
+        write<uint32_t>(riff, sample.sampleRate);                     // dwSampleRate
+        write<uint8_t>(riff, rootKey);                                // byOriginalPitch
+        write<int8_t>(riff, chPitchCorrection);                       // chPitchCorrection
+        write<uint16_t>(riff, link);                                  // wSampleLink
+        write<uint16_t>(riff, type);                                  // sfSampleType
     }
 
     void write_shdr(const std::string& name) {
-        // shdr (46*2)
-        std::vector<uint8_t> shdr;
-        write_str(shdr, "shdr", 4); write<uint32_t>(shdr, 46*3);
+        TRACE_SCOPE("SoundFontWriter::write_shdr");
+        if (stereo) {
+            // shdr (46*5), left (4) and right (2) sample linked to each other
+            const uint32_t size = (uint32_t)sample.data.size();
+            const uint32_t loop = sample.loop_size();
+            write_str(riff, "shdr", 4); write<uint32_t>(riff, 46*5);
+            write_sample("OneShootL", 16, size, 1, 4);
+            write_sample("OneShootR", 32 + size, size, 0, 2);
+            write_sample("LoopL", 48 + 2 * size, loop, 3, 4);
+            write_sample("LoopR", 64 + 2 * size + loop, loop, 2, 2);
+            write_strz(riff, "EOS", 20);
+            riff.put_zero(26);
+            return;
+        }
+        // shdr (46*3)
+        write_str(riff, "shdr", 4); write<uint32_t>(riff, 46*3);
         // Real sample header (46 bytes)
-        write_strz(shdr, "OneShoot", 20);                             // 20
-        write<uint32_t>(shdr, 16);                                    // dwStart
-        write<uint32_t>(shdr, 16 + (uint32_t)sample.data.size()-1);   // dwEnd
-        write<uint32_t>(shdr, 16);                                    // dwStartLoop
-        write<uint32_t>(shdr, 16 + (uint32_t)sample.data.size()-1);   // dwEndLoop
-        write<uint32_t>(shdr, sample.sampleRate);                     // dwSampleRate
-        write<uint8_t>(shdr, rootKey);                                // byOriginalPitch
-        write<int8_t>(shdr, chPitchCorrection);                       // chPitchCorrection
-        write<uint16_t>(shdr, 0);                                     // wSampleLink
-        write<uint16_t>(shdr, 1);                                     // sfSampleType (mono)
+        write_strz(riff, "OneShoot", 20);                             // 20
+        write<uint32_t>(riff, 16);                                    // dwStart
+        write<uint32_t>(riff, 16 + (uint32_t)sample.data.size());     // dwEnd
+        write<uint32_t>(riff, 16);                                    // dwStartLoop
+        write<uint32_t>(riff, 16 + (uint32_t)sample.data.size());     // dwEndLoop
+        write<uint32_t>(riff, sample.sampleRate);                     // dwSampleRate
+        write<uint8_t>(riff, rootKey);                                // byOriginalPitch
+        write<int8_t>(riff, chPitchCorrection);                       // chPitchCorrection
+        write<uint16_t>(riff, 0);                                     // wSampleLink
+        write<uint16_t>(riff, 1);                                     // sfSampleType (mono)
         // Real sample header (46 bytes)
-        write_strz(shdr, "Loop", 20);                                   // 20
-        write<uint32_t>(shdr, 32 +  (uint32_t)sample.data.size());     // dwStart
-        write<uint32_t>(shdr, 32 + (uint32_t)sample.data.size() + sample.loop_data.size()-1);     // dwEnd
-        write<uint32_t>(shdr, 32 + (uint32_t)sample.data.size());     // dwStartLoop
-        write<uint32_t>(shdr, 32 + (uint32_t)sample.data.size() + sample.loop_data.size()-1);    // dwEndLoop
-        write<uint32_t>(shdr, sample.sampleRate);                     // dwSampleRate
-        write<uint8_t>(shdr, rootKey);                                // byOriginalPitch
-        write<int8_t>(shdr, chPitchCorrection);                       // chPitchCorrection
-        write<uint16_t>(shdr, 0);                                     // wSampleLink
-        write<uint16_t>(shdr, 1);                                     // sfSampleType (mono)
+        write_strz(riff, "Loop", 20);                                   // 20
+        write<uint32_t>(riff, 32 +  (uint32_t)sample.data.size());     // dwStart
+        write<uint32_t>(riff, 32 + (uint32_t)sample.data.size() + sample.loop_size());     // dwEnd
+        write<uint32_t>(riff, 32 + (uint32_t)sample.data.size());     // dwStartLoop
+        write<uint32_t>(riff, 32 + (uint32_t)sample.data.size() + sample.loop_size());    // dwEndLoop
+        write<uint32_t>(riff, sample.sampleRate);                     // dwSampleRate
+        write<uint8_t>(riff, rootKey);                                // byOriginalPitch
+        write<int8_t>(riff, chPitchCorrection);                       // chPitchCorrection
+        write<uint16_t>(riff, 0);                                     // wSampleLink
+        write<uint16_t>(riff, 1);                                     // sfSampleType (mono)
         // Terminal sample header (46 bytes)
-        write_strz(shdr, "EOS", 20);
-        for (int i=0; i<4; ++i) write<uint32_t>(shdr, 0);             // start, end, startLoop, endLoop
-        write<uint32_t>(shdr, 0);                                     // dwSampleRate
-        write<uint8_t>(shdr, 0);                                      // byOriginalPitch
-        write<int8_t>(shdr, 0);                                       // chPitchCorrection
-        write<uint16_t>(shdr, 0);                                     // wSampleLink
-        write<uint16_t>(shdr, 1);                                     // sfSampleType
-        //assert(shdr.size() == 8 + 138);
-        pdta_chunks.push_back(std::move(shdr));
+        write_strz(riff, "EOS", 20);
+        for (int i=0; i<4; ++i) write<uint32_t>(riff, 0);             // start, end, startLoop, endLoop
+        write<uint32_t>(riff, 0);                                     // dwSampleRate
+        write<uint8_t>(riff, 0);                                      // byOriginalPitch
+        write<int8_t>(riff, 0);                                       // chPitchCorrection
+        write<uint16_t>(riff, 0);                                     // wSampleLink
+        write<uint16_t>(riff, 1);                                     // sfSampleType
     }
 
     void write_pdta() {
-        // pdta LIST chunk (buffer and patch size after)
-        pdta.clear();
-        write_str(pdta, "LIST", 4); write<uint32_t>(pdta, 0); // placeholder
-        write_str(pdta, "pdta", 4);
-        for (const auto& chunk : pdta_chunks)
-            pdta.insert(pdta.end(), chunk.begin(), chunk.end());
-        uint32_t pdta_size = static_cast<uint32_t>(pdta.size()) - 8;
-        std::memcpy(&pdta[4], &pdta_size, 4);
-    }
-
-    void write_riff() {
-        // --- Build the full RIFF file in memory
-        riff.clear();
-        write_str(riff, "RIFF", 4); write<uint32_t>(riff, 0); // placeholder
-        write_str(riff, "sfbk", 4);
-        riff.insert(riff.end(), info.begin(), info.end());
-        riff.insert(riff.end(), sdta.begin(), sdta.end());
-        riff.insert(riff.end(), pdta.begin(), pdta.end());
-        uint32_t riff_size = static_cast<uint32_t>(riff.size()) - 8;
-        std::memcpy(&riff[4], &riff_size, 4);
-    }
-
-    bool write_to_disk(const std::string& sf2file) {
-        // Write to disk
-        std::ofstream outf(sf2file, std::ios::binary);
-        if (!outf) return false;
-        outf.write(reinterpret_cast<const char*>(riff.data()), riff.size());
-        outf.close();
-        return true;
-    }
-
-    bool write_sf2(const std::string& sf2file, const std::string& name) {
-        pdta_chunks.clear();
-        write_info(name);
-        write_sdta();
+        TRACE_SCOPE("SoundFontWriter::write_pdta");
+        // pdta LIST chunk, the sub chunks are written in place
+        const size_t list = riff.begin_list("LIST", "pdta");
         write_phdr();
         write_pbag();
         write_pmod();
@@ -452,10 +981,337 @@ private:
         write_ibag();
         write_imod();
         write_igen();
-        write_shdr(name);
+        write_shdr("");
+        riff.end_chunk(list);
+        //assert(riff.size() - list - 4 == PDTA_SIZE);
+    }
+
+    bool write_to_disk(const std::string& sf2file) {
+        TRACE_SCOPE("SoundFontWriter::write_to_disk");
+        Slice s[NSLICES];
+        const size_t n = get_slices(s);
+        return file.write(sf2file, s, n, riff_size());
+    }
+
+    bool write_sf2(const std::string& sf2file, const std::string& name) {
+        TRACE_SCOPE("SoundFontWriter::write_sf2");
+        const auto t = Clock::now();
+        build_riff(name);
+        bytesWritten = 0;
+        const bool ret = write_to_disk(sf2file);
+        if (ret) bytesWritten = riff_size();
+        writeTime = ms(t);
+        return ret;
+    }
+
+    // Build the RIFF headers and pdta in memory
+    void build_riff(const std::string& name) {
+        riff.clear();
+        riff.reserve(riff_size() - smpl_size());
+        write_str(riff, "RIFF", 4); write<uint32_t>(riff, static_cast<uint32_t>(riff_size() - 8));
+        write_str(riff, "sfbk", 4);
+        SF2File::write_info(riff, name);
+        // the sample data is added by get_slices()
+        SF2File::write_sdta(riff, smpl_size());
+        sdta_end = riff.size();
         write_pdta();
-        write_riff();
-        return write_to_disk(sf2file);
+    }
+};
+
+/****************************************************************
+  InstrumentWriter - a multi-zone sf2 from one sample per note
+
+  Every zone is one recorded note with its own root key and pitch
+  correction, splitKeys() spread the zones over the keyboard, the
+  split points are halfway between the neighbouring root keys.
+  Takes of the same root key become velocity layers, ordered by
+  their loudness. The split between two layers is their mean
+  loudness, placed on the velocity scale by the loudness range of
+  the whole instrument, so a layer cover the same dynamic on every key.
+  Like the single sample bank it hold two presets, OneShot and
+  Looped, both instruments share the samples, the loop is set in
+  the sample header. A stereo zone is a linked left/right sample
+  pair, played by two zones panned hard left and right.
+****************************************************************/
+
+class InstrumentWriter {
+public:
+    struct Zone {
+        AudioConvert sample;
+        AudioConvert right;         // the right channel of a stereo zone, empty for mono
+        std::string name;
+        uint8_t rootKey = 60;
+        int16_t pitchCorrection = 0;
+        uint8_t keyLow = 0;
+        uint8_t keyHigh = 127;
+        uint8_t velLow = 0;
+        uint8_t velHigh = 127;
+        double loudness = 0.0;      // LUFS, orders the velocity layers
+        uint32_t id = 0;            // free for the caller, not written
+    };
+
+    // statistics of the last written file, time in ms
+    double writeTime;
+    uint64_t bytesWritten;
+
+    InstrumentWriter() {
+        writeTime = 0.0;
+        bytesWritten = 0;
+        chorus = 500;
+        reverb = 500;
+    }
+
+    ~InstrumentWriter() {}
+
+    // sort the zones by root key and loudness, set the key and velocity ranges
+    static void splitKeys(std::vector<Zone>& zones) {
+        std::sort(zones.begin(), zones.end(), [](const Zone& a, const Zone& b) {
+            return a.rootKey != b.rootKey ? a.rootKey < b.rootKey : a.loudness < b.loudness;
+        });
+        double quiet = 0.0, loud = 0.0;
+        for (size_t i = 0; i < zones.size(); i++) {
+            quiet = i ? std::min(quiet, zones[i].loudness) : zones[i].loudness;
+            loud = i ? std::max(loud, zones[i].loudness) : zones[i].loudness;
+        }
+        uint8_t keyLow = 0;
+        for (size_t first = 0; first < zones.size(); ) {
+            size_t last = first;
+            while (last + 1 < zones.size() && zones[last + 1].rootKey == zones[first].rootKey) last++;
+            const uint8_t keyHigh = last + 1 < zones.size() ?
+                            (zones[last].rootKey + zones[last + 1].rootKey) / 2 : 127;
+            for (size_t i = first; i <= last; i++) {
+                zones[i].keyLow = keyLow;
+                zones[i].keyHigh = keyHigh;
+            }
+            splitVelocity(&zones[first], last - first + 1, quiet, loud);
+            keyLow = keyHigh + 1;
+            first = last + 1;
+        }
+    }
+
+    // write the zones (sorted, with key ranges) as one instrument
+    bool write_sf2(const std::string& sf2file, const std::string& name,
+                    const std::vector<Zone>& zones, const uint16_t Chorus = 500,
+                    const uint16_t Reverb = 500) {
+        TRACE_SCOPE("InstrumentWriter::write_sf2");
+        const auto t = Clock::now();
+        bytesWritten = 0;
+        if (zones.empty() || zones.size() > MAX_ZONES || gens(zones) > UINT16_MAX) return false;
+        chorus = Chorus;
+        reverb = Reverb;
+        build_riff(name, zones);
+        // headers, every sample (zero copy) with its pad, pdta
+        slices.clear();
+        slices.push_back({riff.data(), sdta_end});
+        for (const auto& z : zones) {
+            slices.push_back({z.sample.data.data(), z.sample.data.size() * sizeof(int16_t)});
+            slices.push_back({pad, sizeof(pad)});
+            if (!isStereo(z)) continue;
+            slices.push_back({z.right.data.data(), z.right.data.size() * sizeof(int16_t)});
+            slices.push_back({pad, sizeof(pad)});
+        }
+        slices.push_back({riff.data() + sdta_end, riff.size() - sdta_end});
+        const size_t total = riff.size() + smpl_size(zones);
+        if (!file.write(sf2file, slices.data(), slices.size(), total)) return false;
+        bytesWritten = total;
+        writeTime = ms(t);
+        return true;
+    }
+
+    // write instruments larger than threshold bytes with O_DIRECT, like SoundFontWriter
+    void setDirectIO(bool enable, size_t threshold = 64 * 1024 * 1024) {
+        file.setDirectIO(enable, threshold);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static double ms(Clock::time_point t) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+    }
+
+    // the sf2 spec want 46 zero samples behind every sample
+    static inline const int16_t pad[46] = {0};
+    // the pdta index fields are 16 bit, two bags and six generators per zone,
+    // a stereo zone need four bags with a pan generator each
+    static constexpr size_t MAX_ZONES = 5000;
+    static constexpr uint32_t GENS = 6;
+
+    static bool isStereo(const Zone& z) {
+        return !z.right.data.empty();
+    }
+
+    // the generators of both instruments
+    static size_t gens(const std::vector<Zone>& zones) {
+        size_t n = 0;
+        for (const auto& z : zones) n += isStereo(z) ? 4 * (GENS + 1) : 2 * GENS;
+        return n;
+    }
+
+    // the velocity ranges of n layers (sorted by loudness) of one key,
+    // quiet - loud is the loudness range of the instrument
+    static void splitVelocity(Zone* layers, size_t n, double quiet, double loud) {
+        uint32_t low = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t next = 128;
+            if (i + 1 < n) {
+                // fall back to equal ranges when the takes are (nearly) equally loud
+                if (loud - quiet >= 1.0) {
+                    const double mid = 0.5 * (layers[i].loudness + layers[i + 1].loudness);
+                    next = 1 + (uint32_t)std::lround(126.0 * (mid - quiet) / (loud - quiet));
+                } else {
+                    next = (uint32_t)(128 * (i + 1) / n);
+                }
+                // every layer keep at least one velocity
+                next = std::clamp<uint32_t>(next, low + 1, 128 - (uint32_t)(n - 1 - i));
+            }
+            layers[i].velLow = (uint8_t)low;
+            layers[i].velHigh = (uint8_t)(next - 1);
+            low = next;
+        }
+    }
+
+    ChunkBuffer riff;
+    size_t sdta_end = 0;
+    SF2File file;
+    std::vector<SF2File::Slice> slices;
+    uint16_t chorus;
+    uint16_t reverb;
+
+    template<typename T>
+    void write(T v) {
+        riff.put<T>(v);
+    }
+
+    static size_t smpl_size(const std::vector<Zone>& zones) {
+        size_t n = 0;
+        for (const auto& z : zones) {
+            n += z.sample.data.size() + 46;
+            if (isStereo(z)) n += z.right.data.size() + 46;
+        }
+        return n * sizeof(int16_t);
+    }
+
+    // the RIFF image without the sample data, sdta_end mark where the samples go
+    void build_riff(const std::string& name, const std::vector<Zone>& zones) {
+        const size_t smpl = smpl_size(zones);
+        riff.clear();
+        const size_t r = riff.begin_list("RIFF", "sfbk");
+        SF2File::write_info(riff, name);
+        SF2File::write_sdta(riff, smpl);
+        sdta_end = riff.size();
+        write_pdta(zones);
+        // the RIFF size include the sample data, which is not in the buffer
+        riff.put_at<uint32_t>(r, (uint32_t)(riff.size() + smpl - r - 4));
+    }
+
+    void write_pdta(const std::vector<Zone>& zones) {
+        TRACE_SCOPE("InstrumentWriter::write_pdta");
+        // the first sample of every zone, n is the number of samples
+        // and of the bags of one instrument
+        uint16_t n = 0;
+        std::vector<uint16_t> first(zones.size());
+        for (size_t i = 0; i < zones.size(); i++) {
+            first[i] = n;
+            n += isStereo(zones[i]) ? 2 : 1;
+        }
+        const size_t list = riff.begin_list("LIST", "pdta");
+        // two presets, each point to its instrument
+        size_t c = riff.begin_chunk("phdr");
+        const char* presets[3] = {"OneShot", "Looped", "EOP"};
+        for (uint16_t p = 0; p < 3; p++) {
+            riff.put_strz(presets[p], 20);
+            write<uint16_t>(p < 2 ? p : 0);     // wPreset
+            write<uint16_t>(0);                 // wBank
+            write<uint16_t>(p);                 // wPresetBagNdx
+            riff.put_zero(12);                  // dwLibrary, dwGenre, dwMorphology
+        }
+        riff.end_chunk(c);
+        c = riff.begin_chunk("pbag");
+        for (uint16_t p = 0; p < 3; p++) { write<uint16_t>(p); write<uint16_t>(0); }
+        riff.end_chunk(c);
+        c = riff.begin_chunk("pmod");
+        riff.put_zero(10);
+        riff.end_chunk(c);
+        c = riff.begin_chunk("pgen");
+        write<uint16_t>(41); write<uint16_t>(0);    // instrument 0
+        write<uint16_t>(41); write<uint16_t>(1);    // instrument 1
+        write<uint16_t>(0); write<uint16_t>(0);
+        riff.end_chunk(c);
+        // two instruments with one bag per zone, two for a stereo zone
+        c = riff.begin_chunk("inst");
+        riff.put_strz("OneShot", 20); write<uint16_t>(0);
+        riff.put_strz("Looped", 20); write<uint16_t>(n);
+        riff.put_strz("EOI", 20); write<uint16_t>(2 * n);
+        riff.end_chunk(c);
+        c = riff.begin_chunk("ibag");
+        uint32_t g = 0;
+        for (uint16_t mode = 0; mode < 2; mode++) {
+            for (const auto& z : zones) {
+                const uint32_t bags = isStereo(z) ? 2 : 1;
+                const uint32_t zoneGens = isStereo(z) ? GENS + 1 : GENS;
+                for (uint32_t b = 0; b < bags; b++) {
+                    write<uint16_t>((uint16_t)g); write<uint16_t>(0);
+                    g += zoneGens;
+                }
+            }
+        }
+        write<uint16_t>((uint16_t)g); write<uint16_t>(0);
+        riff.end_chunk(c);
+        c = riff.begin_chunk("imod");
+        riff.put_zero(10);
+        riff.end_chunk(c);
+        // keyRange must be the first, velRange the second and SampleID the last generator of a zone
+        c = riff.begin_chunk("igen");
+        for (uint16_t mode = 0; mode < 2; mode++) {
+            for (size_t i = 0; i < zones.size(); i++) {
+                const bool stereo = isStereo(zones[i]);
+                for (uint16_t ch = 0; ch < (stereo ? 2 : 1); ch++) {
+                    write<uint16_t>(43); write<uint8_t>(zones[i].keyLow); write<uint8_t>(zones[i].keyHigh);
+                    write<uint16_t>(44); write<uint8_t>(zones[i].velLow); write<uint8_t>(zones[i].velHigh);
+                    write<uint16_t>(15); write<uint16_t>(chorus);
+                    write<uint16_t>(16); write<uint16_t>(reverb);
+                    if (stereo) { write<uint16_t>(17); write<int16_t>(ch ? 500 : -500); }   // Pan
+                    write<uint16_t>(54); write<uint16_t>(mode);             // SampleModes, OneShot or Loop
+                    write<uint16_t>(53); write<uint16_t>(first[i] + ch);    // SampleID
+                }
+            }
+        }
+        write<uint16_t>(0); write<uint16_t>(0);
+        riff.end_chunk(c);
+        c = riff.begin_chunk("shdr");
+        uint32_t start = 0;
+        for (size_t i = 0; i < zones.size(); i++) {
+            const Zone& z = zones[i];
+            // mono (1), or left (4) and right (2) linked to each other
+            if (!isStereo(z)) {
+                write_sample(z, z.sample, z.name, start, 0, 1);
+                continue;
+            }
+            write_sample(z, z.sample, z.name.substr(0, 18) + "-L", start, first[i] + 1, 4);
+            write_sample(z, z.right, z.name.substr(0, 18) + "-R", start, first[i], 2);
+        }
+        riff.put_strz("EOS", 20);
+        riff.put_zero(26);
+        riff.end_chunk(c);
+        riff.end_chunk(list);
+    }
+
+    // one sample header, start is advanced behind the sample and its pad
+    void write_sample(const Zone& z, const AudioConvert& a, const std::string& name,
+                                    uint32_t& start, uint16_t link, uint16_t type) {
+        const uint32_t size = (uint32_t)a.data.size();
+        riff.put_strz(name, 20);
+        write<uint32_t>(start);                             // dwStart
+        write<uint32_t>(start + size);                      // dwEnd
+        write<uint32_t>(start + a.loop_start);              // dwStartLoop
+        write<uint32_t>(start + a.loop_end);                // dwEndLoop
+        write<uint32_t>(a.sampleRate);                      // dwSampleRate
+        write<uint8_t>(z.rootKey);                          // byOriginalPitch
+        write<int8_t>((int8_t)z.pitchCorrection);           // chPitchCorrection
+        write<uint16_t>(link);                              // wSampleLink
+        write<uint16_t>(type);                              // sfSampleType
+        start += size + 46;
     }
 };
 
@@ -0,0 +1,358 @@
+/*
+ * TaskPool.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+ ** TaskPool - a work stealing thread pool for offline (non-rt) jobs
+ *             requires minimum c++17
+ *
+ *  TaskPool is the companion of ParallelThread for batch work.
+ *  ParallelThread runs one function in one thread with
+ *  time guarded handshakes for real-time usage,
+ *  TaskPool runs a queue of independent tasks on all cores.
+ *
+ *  Every worker own a deque, it push and pop new tasks at the back,
+ *  idle workers steal the oldest task from the front of a other deque.
+ *
+ *  usage:
+ *      // create a pool with one worker per core,
+ *         optional pin every worker to a CPU
+ *      TaskPool pool(0, true);
+ *      // submit a task, get a future for the result
+ *      TaskFuture<int> f = pool.submit([](){ return 42; });
+ *      // add a continuation, it runs in the pool when f is ready
+ *      TaskFuture<void> g = f.then([](int v){ printf("%i\n", v); });
+ *      // wait for the result, the waiting thread help to run tasks
+ *      g.get();
+ *      // the pool stops and joins the workers on destruction
+ */
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <optional>
+#include <exception>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#pragma once
+
+#ifndef TASKPOOL_H_
+#define TASKPOOL_H_
+
+class TaskPool;
+
+template <typename T>
+class TaskFuture;
+
+namespace taskpool_detail {
+
+// shared state between a task and its future(s)
+template <typename T>
+struct State {
+    typedef std::conditional_t<std::is_void_v<T>, char, T> Value;
+
+    std::mutex m;
+    std::condition_variable cv;
+    bool done = false;
+    std::optional<Value> value;
+    std::exception_ptr error;
+    std::vector<std::function<void()>> continuations;
+
+    // store the result and release the continuations
+    void finish() {
+        std::vector<std::function<void()>> c;
+        {
+            std::lock_guard<std::mutex> lk(m);
+            done = true;
+            c.swap(continuations);
+        }
+        cv.notify_all();
+        for (auto& f : c) f();
+    }
+
+    bool isDone() {
+        std::lock_guard<std::mutex> lk(m);
+        return done;
+    }
+};
+
+// run f (with arg) and store the result in st
+template <typename T, typename F, typename... A>
+inline void invoke(State<T>& st, F& f, A&&... a) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            f(std::forward<A>(a)...);
+            st.value.emplace(0);
+        } else {
+            st.value.emplace(f(std::forward<A>(a)...));
+        }
+    } catch (...) {
+        st.error = std::current_exception();
+    }
+    st.finish();
+}
+
+} // namespace taskpool_detail
+
+class TaskPool {
+public:
+    // threads = 0 use one worker per core
+    explicit TaskPool(uint32_t threads = 0, bool pinThreads = false)
+        : running(true), pending(0), next(0) {
+        if (!threads) threads = std::max(1u, std::thread::hardware_concurrency());
+        queues.reserve(threads);
+        for (uint32_t i = 0; i < threads; i++)
+            queues.emplace_back(new Queue());
+        workers.reserve(threads);
+        for (uint32_t i = 0; i < threads; i++) {
+            workers.emplace_back([this, i]() { work(i); });
+            setThreadName(workers.back(), "taskpool-" + std::to_string(i));
+            if (pinThreads) pin(workers.back(), i);
+        }
+    }
+
+    ~TaskPool() {
+        stop();
+    }
+
+    // number of worker threads
+    uint32_t size() const noexcept {
+        return static_cast<uint32_t>(queues.size());
+    }
+
+    // stop the workers, pending tasks are run before
+    void stop() noexcept {
+        if (!running.exchange(false)) return;
+        {
+            std::lock_guard<std::mutex> lk(sleepLock);
+        }
+        sleepCond.notify_all();
+        for (auto& t : workers)
+            if (t.joinable()) t.join();
+    }
+
+    // queue a task, return a future for its result
+    template <typename F>
+    auto submit(F&& f) -> TaskFuture<std::invoke_result_t<std::decay_t<F>>> {
+        typedef std::invoke_result_t<std::decay_t<F>> R;
+        auto st = std::make_shared<taskpool_detail::State<R>>();
+        push([st, fn = std::forward<F>(f)]() mutable {
+            taskpool_detail::invoke(*st, fn);
+        });
+        return TaskFuture<R>(st, this);
+    }
+
+    // run one queued task in the calling thread, return false when nothing is queued
+    bool runOne() {
+        std::function<void()> task;
+        const int self = workerIndex();
+        if (!take(self < 0 ? 0 : self, task)) return false;
+        task();
+        return true;
+    }
+
+    // queue a plain job (used by the futures for continuations)
+    void push(std::function<void()> task) {
+        int self = workerIndex();
+        // tasks created inside a worker stay local, others get distributed
+        const size_t q = self >= 0 ? self : next.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            std::lock_guard<std::mutex> lk(queues[q]->m);
+            queues[q]->tasks.push_back(std::move(task));
+        }
+        pending.fetch_add(1, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lk(sleepLock);
+        }
+        sleepCond.notify_one();
+    }
+
+private:
+    struct Queue {
+        std::mutex m;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<bool> running;
+    std::atomic<uint32_t> pending;
+    std::atomic<uint32_t> next;
+    std::mutex sleepLock;
+    std::condition_variable sleepCond;
+
+    // the queue index of the calling worker or -1 for foreign threads
+    int workerIndex() const noexcept {
+        return (tlsPool() == this) ? tlsIndex() : -1;
+    }
+
+    static const TaskPool*& tlsPool() noexcept {
+        static thread_local const TaskPool* p = nullptr;
+        return p;
+    }
+
+    static int& tlsIndex() noexcept {
+        static thread_local int i = -1;
+        return i;
+    }
+
+    // pop from the own queue (LIFO), or steal from a other one (FIFO)
+    bool take(uint32_t self, std::function<void()>& task) {
+        if (!pending.load(std::memory_order_acquire)) return false;
+        {
+            Queue& q = *queues[self];
+            std::lock_guard<std::mutex> lk(q.m);
+            if (!q.tasks.empty()) {
+                task = std::move(q.tasks.back());
+                q.tasks.pop_back();
+                pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        const uint32_t n = size();
+        for (uint32_t k = 1; k < n; k++) {
+            Queue& q = *queues[(self + k) % n];
+            std::unique_lock<std::mutex> lk(q.m, std::try_to_lock);
+            if (!lk.owns_lock() || q.tasks.empty()) continue;
+            task = std::move(q.tasks.front());
+            q.tasks.pop_front();
+            pending.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    void work(uint32_t self) {
+        tlsPool() = this;
+        tlsIndex() = static_cast<int>(self);
+        std::function<void()> task;
+        while (true) {
+            if (take(self, task)) {
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(sleepLock);
+            if (!running.load(std::memory_order_acquire) &&
+                !pending.load(std::memory_order_acquire)) break;
+            // a missed steal (try_lock) is caught by the timeout
+            sleepCond.wait_for(lk, std::chrono::milliseconds(2), [this]() {
+                return pending.load(std::memory_order_acquire) ||
+                        !running.load(std::memory_order_acquire);
+            });
+        }
+        tlsPool() = nullptr;
+        tlsIndex() = -1;
+    }
+
+    // set a name for the thread (may help on diagnostics)
+    static void setThreadName(std::thread& t, const std::string& name) noexcept {
+        #if defined(__linux__)
+        pthread_setname_np(t.native_handle(), name.substr(0, 15).c_str());
+        #else
+        (void) t;
+        (void) name;
+        #endif
+    }
+
+    // pin a worker thread to one CPU, this may fail silent
+    static void pin(std::thread& t, uint32_t i) noexcept {
+        #if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &set);
+        if (pthread_setaffinity_np(t.native_handle(), sizeof(cpu_set_t), &set)) {
+            fprintf(stderr, "TaskPool: fail to pin worker %u\n", i);
+        }
+        #else
+        (void) t;
+        (void) i;
+        #endif
+    }
+};
+
+template <typename T>
+class TaskFuture {
+public:
+    TaskFuture() : pool(nullptr) {}
+    TaskFuture(std::shared_ptr<taskpool_detail::State<T>> s, TaskPool* p)
+        : st(std::move(s)), pool(p) {}
+
+    bool valid() const noexcept {
+        return st != nullptr;
+    }
+
+    bool ready() const {
+        return st && st->isDone();
+    }
+
+    // wait for the result, run queued tasks meanwhile to avoid dead locks
+    // when called from inside a task
+    void wait() const {
+        while (!st->isDone()) {
+            if (pool && pool->runOne()) continue;
+            std::unique_lock<std::mutex> lk(st->m);
+            st->cv.wait_for(lk, std::chrono::milliseconds(1), [this]() { return st->done; });
+        }
+    }
+
+    // wait and return the result, rethrow when the task has thrown
+    T get() const {
+        wait();
+        if (st->error) std::rethrow_exception(st->error);
+        if constexpr (!std::is_void_v<T>) return *st->value;
+    }
+
+    // queue f(result) when this future is ready, return a future for its result
+    template <typename F>
+    auto then(F&& f) const {
+        typedef std::conditional_t<std::is_void_v<T>,
+                    std::invoke_result<std::decay_t<F>>,
+                    std::invoke_result<std::decay_t<F>, T>> Result;
+        typedef typename Result::type R;
+        auto next = std::make_shared<taskpool_detail::State<R>>();
+        auto src = st;
+        TaskPool* p = pool;
+        std::function<void()> cont = [next, src, fn = std::forward<F>(f)]() mutable {
+            if (src->error) {
+                next->error = src->error;
+                next->finish();
+                return;
+            }
+            if constexpr (std::is_void_v<T>) taskpool_detail::invoke(*next, fn);
+            else taskpool_detail::invoke(*next, fn, *src->value);
+        };
+        std::function<void()> schedule = [p, cont]() { p->push(cont); };
+        bool done;
+        {
+            std::lock_guard<std::mutex> lk(st->m);
+            done = st->done;
+            if (!done) st->continuations.push_back(schedule);
+        }
+        if (done) schedule();
+        return TaskFuture<R>(next, pool);
+    }
+
+private:
+    std::shared_ptr<taskpool_detail::State<T>> st;
+    TaskPool* pool;
+};
+
+#endif
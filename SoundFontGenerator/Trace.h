@@ -0,0 +1,182 @@
+/*
+ * Trace.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  Trace - scoped timers for the hot paths, exported as Chrome trace
+
+  TRACE_SCOPE("name") at the top of a block records the time spent
+  in that block. Every thread writes into its own ring buffer
+  (no locks, the oldest events get overwritten), the rings are
+  only allocated when tracing is enabled. When disabled a scope
+  cost one relaxed atomic load.
+
+  Trace::enable(true) start recording, Trace::dump(file) write
+  all rings as Chrome/Perfetto JSON (chrome://tracing, ui.perfetto.dev).
+  A dump while threads are still recording may miss the newest events.
+  The name must be a string literal (only the pointer is stored).
+****************************************************************/
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <mutex>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+#pragma once
+
+#ifndef TRACE_H
+#define TRACE_H
+
+class Trace {
+public:
+    // switch recording on/off
+    static void enable(bool on) {
+        if (on) epoch();
+        enabledFlag().store(on, std::memory_order_relaxed);
+    }
+
+    static inline bool enabled() noexcept {
+        return enabledFlag().load(std::memory_order_relaxed);
+    }
+
+    // store a finished scope in the ring of the calling thread
+    static inline void record(const char* name, uint64_t start, uint64_t end) noexcept {
+        Ring* r = ring();
+        if (!r) return;
+        const uint64_t h = r->head.load(std::memory_order_relaxed);
+        Event& e = r->events[h & (RING_SIZE - 1)];
+        e.name = name;
+        e.start = start;
+        e.dur = end - start;
+        r->head.store(h + 1, std::memory_order_release);
+    }
+
+    // nanoseconds since the trace got enabled
+    static inline uint64_t now() noexcept {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - epoch()).count();
+    }
+
+    // write all recorded events as Chrome trace JSON
+    static bool dump(const std::string& file) {
+        FILE* fp = fopen(file.c_str(), "w");
+        if (!fp) {
+            std::cerr << "Error: could not write trace " << file << std::endl;
+            return false;
+        }
+        fprintf(fp, "{\"traceEvents\":[\n");
+        bool first = true;
+        std::lock_guard<std::mutex> lk(registry().m);
+        for (const auto& r : registry().rings) {
+            fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                        "\"args\":{\"name\":\"%s\"}}", first ? "" : ",\n", r->tid, r->name);
+            first = false;
+            const uint64_t h = r->head.load(std::memory_order_acquire);
+            const uint64_t from = h > RING_SIZE ? h - RING_SIZE : 0;
+            for (uint64_t i = from; i < h; i++) {
+                const Event& e = r->events[i & (RING_SIZE - 1)];
+                fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                            "\"ts\":%.3f,\"dur\":%.3f}", e.name, r->tid,
+                            e.start / 1000.0, e.dur / 1000.0);
+            }
+        }
+        fprintf(fp, "\n],\"displayTimeUnit\":\"ms\"}\n");
+        return fclose(fp) == 0;
+    }
+
+private:
+    static constexpr uint64_t RING_SIZE = 1 << 14;
+
+    struct Event {
+        const char* name;
+        uint64_t start;
+        uint64_t dur;
+    };
+
+    // written by the owning thread only
+    struct Ring {
+        std::atomic<uint64_t> head{0};
+        uint32_t tid = 0;
+        char name[16] = {0};
+        Event events[RING_SIZE];
+    };
+
+    struct Registry {
+        std::mutex m;
+        std::vector<std::shared_ptr<Ring>> rings;
+    };
+
+    static std::atomic<bool>& enabledFlag() noexcept {
+        static std::atomic<bool> e(false);
+        return e;
+    }
+
+    static std::chrono::steady_clock::time_point epoch() noexcept {
+        static const std::chrono::steady_clock::time_point t = std::chrono::steady_clock::now();
+        return t;
+    }
+
+    static Registry& registry() {
+        static Registry r;
+        return r;
+    }
+
+    // the ring of the calling thread, created on first use,
+    // kept in the registry after the thread has finished
+    static Ring* ring() noexcept {
+        static thread_local Ring* r = nullptr;
+        if (r) return r;
+        try {
+            auto n = std::make_shared<Ring>();
+            #if defined(__linux__)
+            pthread_getname_np(pthread_self(), n->name, sizeof(n->name));
+            #endif
+            std::lock_guard<std::mutex> lk(registry().m);
+            n->tid = (uint32_t)registry().rings.size() + 1;
+            if (!n->name[0]) snprintf(n->name, sizeof(n->name), "thread-%u", n->tid);
+            registry().rings.push_back(n);
+            r = n.get();
+        } catch (...) {
+            return nullptr;
+        }
+        return r;
+    }
+};
+
+// time the enclosing scope
+class TraceScope {
+public:
+    explicit TraceScope(const char* n) noexcept
+        : name(n), active(Trace::enabled()), start(active ? Trace::now() : 0) {}
+
+    ~TraceScope() {
+        if (active) Trace::record(name, start, Trace::now());
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    bool active;
+    uint64_t start;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,755 @@
+/*
+ * bench.c
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  bench - benchmarks for the offline conversion path
+
+  Every case work on synthetic signals generated in memory (sines,
+  harmonic tones, noise), so the results don't depend on a sample
+  collection. The cases cover decode, resample (each quality tier),
+  pitch detection, float -> int16 conversion, SF2 writing and the
+  batch conversion in the TaskPool. The stereo cases run on the
+  interleaved and on the planar (AudioBuffer) layout.
+  --accuracy measure the passband and stopband error of every
+  quality tier and ratio with test tones instead.
+
+  A case runs in its own process, so the peak memory is measured
+  per case. The results are written as CSV, --compare check a run
+  against a saved baseline and exit with 1 on a regression.
+****************************************************************/
+
+#include <cmath>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <functional>
+#include <algorithm>
+#include <filesystem>
+#include <thread>
+#include <vector>
+#include <string>
+#include <map>
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#endif
+
+#include "CheckResample.h"
+#include "Converter.h"
+
+namespace fs = std::filesystem;
+
+/****************************************************************
+        Signal - synthetic test signals
+****************************************************************/
+
+class Signal {
+public:
+    enum Type { SINE, HARMONIC, NOISE };
+
+    static const char* name(Type t) {
+        switch (t) {
+            case SINE: return "sine";
+            case HARMONIC: return "harmonic";
+            case NOISE: return "noise";
+        }
+        return "unknown";
+    }
+
+    // interleaved float buffer, the channels get the same signal
+    static std::vector<float> make(Type t, uint32_t rate, uint32_t frames,
+                                    uint32_t channels, float freq = 220.0f) {
+        std::vector<float> s((size_t)frames * channels);
+        uint32_t seed = 0x12345678;
+        for (uint32_t i = 0; i < frames; i++) {
+            const double ph = 2.0 * M_PI * freq * i / rate;
+            float v = 0.0f;
+            switch (t) {
+                case SINE:
+                    v = 0.5f * (float)std::sin(ph);
+                    break;
+                case HARMONIC:
+                    // decaying partials like a plucked string
+                    for (int h = 1; h <= 8; h++)
+                        v += 0.5f / h * (float)std::sin(ph * h);
+                    v *= (float)std::exp(-2.0 * i / rate);
+                    break;
+                case NOISE:
+                    // deterministic, so every run measure the same data
+                    seed = seed * 1664525u + 1013904223u;
+                    v = ((int32_t)seed / 2147483648.0f) * 0.5f;
+                    break;
+            }
+            for (uint32_t c = 0; c < channels; c++) s[(size_t)i * channels + c] = v;
+        }
+        return s;
+    }
+
+    // write a buffer as WAV file, PCM 16 bit or IEEE float
+    static bool writeWav(const std::string& file, const std::vector<float>& s,
+                            uint32_t rate, uint32_t channels, bool pcm16) {
+        FILE* fp = fopen(file.c_str(), "wb");
+        if (!fp) return false;
+        const uint16_t bits = pcm16 ? 16 : 32;
+        const uint32_t dataSize = (uint32_t)(s.size() * bits / 8);
+        const uint16_t format = pcm16 ? 1 : 3;
+        const uint16_t align = channels * bits / 8;
+        const uint32_t byteRate = rate * align;
+        const uint32_t riffSize = 36 + dataSize;
+        const uint32_t fmtSize = 16;
+        const uint16_t chan = channels;
+        fwrite("RIFF", 1, 4, fp);
+        fwrite(&riffSize, 4, 1, fp);
+        fwrite("WAVEfmt ", 1, 8, fp);
+        fwrite(&fmtSize, 4, 1, fp);
+        fwrite(&format, 2, 1, fp);
+        fwrite(&chan, 2, 1, fp);
+        fwrite(&rate, 4, 1, fp);
+        fwrite(&byteRate, 4, 1, fp);
+        fwrite(&align, 2, 1, fp);
+        fwrite(&bits, 2, 1, fp);
+        fwrite("data", 1, 4, fp);
+        fwrite(&dataSize, 4, 1, fp);
+        if (pcm16) {
+            std::vector<int16_t> d(s.size());
+            for (size_t i = 0; i < s.size(); i++)
+                d[i] = (int16_t)std::lrintf(std::clamp(s[i], -1.0f, 1.0f) * 32767.0f);
+            fwrite(d.data(), 2, d.size(), fp);
+        } else {
+            fwrite(s.data(), 4, s.size(), fp);
+        }
+        return fclose(fp) == 0;
+    }
+};
+
+/****************************************************************
+        Bench - run the cases and collect the results
+****************************************************************/
+
+class Bench {
+public:
+    // a case prepare its data and return the timed function
+    struct Case {
+        std::string name;
+        double items;    // samples (or jobs) processed per iteration
+        std::function<std::function<void()>()> prepare;
+    };
+
+    struct Row {
+        std::string name;
+        uint32_t iterations = 0;
+        double minTime = 0.0;       // ms
+        double medianTime = 0.0;    // ms
+        double throughput = 0.0;    // items per second, based on the median
+        uint64_t peakRss = 0;       // kB
+    };
+
+    std::string tmpDir;
+    std::string filter;
+    bool quick;
+
+    Bench() {
+        quick = false;
+    }
+
+    // create all cases, quick use shorter signals
+    void build() {
+        const uint32_t len[] = {1, quick ? 5u : 10u, quick ? 10u : 60u};
+        const uint32_t rates[] = {44100, 48000, 96000};
+
+        // decode: mapped WAV PCM 16 and float
+        for (uint32_t s : len) {
+            for (uint32_t rate : rates) {
+                for (bool pcm16 : {true, false}) {
+                    const uint32_t frames = rate * s;
+                    add(std::string("decode/") + (pcm16 ? "pcm16" : "float") + "/stereo/" +
+                            std::to_string(rate) + "/" + std::to_string(s) + "s", frames,
+                        [this, rate, frames, pcm16]() {
+                            const std::string file = tmpFile("decode.wav");
+                            Signal::writeWav(file, Signal::make(Signal::HARMONIC, rate, frames, 2),
+                                                rate, 2, pcm16);
+                            auto af = std::make_shared<AudioFile>();
+                            return std::function<void()>([af, file]() {
+                                af->getAudioFile(file.c_str());
+                            });
+                        });
+                }
+            }
+        }
+
+        // resample, every quality tier, the generic and the half-band ratios
+        for (uint32_t q : tiers) {
+            for (const auto& r : ratios) {
+                const uint32_t from = r.first;
+                const uint32_t to = r.second;
+                const uint32_t frames = from * 10;
+                add("resample/" + CheckResample::qualityName(q) + "/" + std::to_string(from) + "-" +
+                        std::to_string(to) + "/10s", frames,
+                    [q, from, to, frames]() {
+                        auto in = std::make_shared<std::vector<float>>(
+                                    Signal::make(Signal::HARMONIC, from, frames, 1));
+                        auto rs = std::make_shared<CheckResample>();
+                        rs->setQuality(q);
+                        auto out = std::make_shared<std::vector<float>>(
+                                    (size_t)frames * to / from + 256);
+                        return std::function<void()>([in, rs, out, from, to, frames]() {
+                            uint32_t n = rs->beginStream(from, to, 1, frames);
+                            uint32_t a = 0, b = 0;
+                            rs->processBlock(in->data(), frames, out->data(), &a);
+                            rs->endStream(out->data() + a, &b);
+                            (void)n;
+                        });
+                    });
+            }
+        }
+
+        // pitch detection
+        for (Signal::Type t : {Signal::SINE, Signal::HARMONIC, Signal::NOISE}) {
+            for (uint32_t s : {1u, 5u}) {
+                const uint32_t frames = 44100 * s;
+                add(std::string("pitch/") + Signal::name(t) + "/" + std::to_string(s) + "s", frames,
+                    [t, frames]() {
+                        auto in = std::make_shared<std::vector<float>>(
+                                    Signal::make(t, 44100, frames, 1));
+                        auto pt = std::make_shared<PitchTracker>();
+                        return std::function<void()>([in, pt, frames]() {
+                            int16_t corr = 0;
+                            pt->getPitch(in->data(), frames, 1, 44100.0f, &corr);
+                        });
+                    });
+            }
+        }
+
+        // pitch detection on the first channel of a stereo signal
+        for (bool planar : {false, true}) {
+            const uint32_t frames = 44100 * 5;
+            add(std::string("pitch/harmonic/stereo/") + (planar ? "planar" : "interleaved") + "/5s", frames,
+                [planar, frames]() {
+                    auto in = std::make_shared<std::vector<float>>(
+                                Signal::make(Signal::HARMONIC, 44100, frames, 2));
+                    auto buf = std::make_shared<AudioBuffer>();
+                    buf->deinterleave(in->data(), frames, 2);
+                    auto pt = std::make_shared<PitchTracker>();
+                    return std::function<void()>([in, buf, pt, planar, frames]() {
+                        int16_t corr = 0;
+                        if (planar) pt->getPitch(buf->channel(0), frames, 1, 44100.0f, &corr);
+                        else pt->getPitch(in->data(), frames, 2, 44100.0f, &corr);
+                    });
+                });
+        }
+
+        // split a interleaved stereo buffer into the planes
+        for (uint32_t s : len) {
+            const uint32_t frames = 44100 * s;
+            add("deinterleave/stereo/" + std::to_string(s) + "s", frames,
+                [frames]() {
+                    auto in = std::make_shared<std::vector<float>>(
+                                Signal::make(Signal::NOISE, 44100, frames, 2));
+                    auto buf = std::make_shared<AudioBuffer>();
+                    return std::function<void()>([in, buf, frames]() {
+                        buf->deinterleave(in->data(), frames, 2);
+                    });
+                });
+        }
+
+        // float -> int16 conversion (one channel of a stereo buffer)
+        for (uint32_t s : len) {
+            const uint32_t frames = 44100 * s;
+            add("convert/stereo/" + std::to_string(s) + "s", frames,
+                [frames]() {
+                    auto in = std::make_shared<std::vector<float>>(
+                                Signal::make(Signal::NOISE, 44100, frames, 2));
+                    auto ac = std::make_shared<AudioConvert>();
+                    return std::function<void()>([in, ac, frames]() {
+                        ac->convert(in->data(), 2, 0.8f, 44100, frames, 0, frames);
+                    });
+                });
+        }
+
+        // the same from a plane, and both channels of a stereo export
+        for (uint32_t s : len) {
+            const uint32_t frames = 44100 * s;
+            add("convert/planar/" + std::to_string(s) + "s", frames,
+                [frames]() {
+                    auto buf = std::make_shared<AudioBuffer>();
+                    buf->deinterleave(Signal::make(Signal::NOISE, 44100, frames, 2).data(), frames, 2);
+                    auto ac = std::make_shared<AudioConvert>();
+                    return std::function<void()>([buf, ac, frames]() {
+                        ac->convert(buf->channel(0), 1, 0.8f, 44100, frames, 0, frames);
+                    });
+                });
+            for (bool planar : {false, true}) {
+                add(std::string("convert/stereo-pair/") + (planar ? "planar" : "interleaved") + "/" +
+                        std::to_string(s) + "s", 2.0 * frames,
+                    [planar, frames]() {
+                        auto in = std::make_shared<std::vector<float>>(
+                                    Signal::make(Signal::NOISE, 44100, frames, 2));
+                        auto buf = std::make_shared<AudioBuffer>();
+                        buf->deinterleave(in->data(), frames, 2);
+                        auto l = std::make_shared<AudioConvert>();
+                        auto r = std::make_shared<AudioConvert>();
+                        return std::function<void()>([in, buf, l, r, planar, frames]() {
+                            if (planar) l->convertStereo(buf->channel(0), buf->channel(1), *r, 0.8f,
+                                                            44100, frames, 0, frames);
+                            else {
+                                l->convert(in->data(), 2, 0.8f, 44100, frames, 0, frames);
+                                r->convert(in->data() + 1, 2, 0.8f, 44100, frames, 0, frames);
+                            }
+                        });
+                    });
+            }
+        }
+
+        // sf2 export of the first channel of a stereo file, through a full length
+        // gain copy like the old saveBuffer path and straight from the interleaved buffer
+        for (uint32_t s : len) {
+            for (bool copy : {true, false}) {
+                const uint32_t frames = 44100 * s;
+                add(std::string("export/stereo/") + (copy ? "copy" : "stride") + "/" +
+                        std::to_string(s) + "s", frames,
+                    [this, frames, copy]() {
+                        auto in = std::make_shared<std::vector<float>>(
+                                    Signal::make(Signal::HARMONIC, 44100, frames, 2));
+                        auto swf = std::make_shared<SoundFontWriter>();
+                        const std::string file = tmpFile("export.sf2");
+                        return std::function<void()>([in, swf, file, frames, copy]() {
+                            if (!copy) {
+                                swf->generate_sf2(in->data(), 2, 0.8f, 0, frames, frames, 44100, file, "Sample");
+                                return;
+                            }
+                            float* saveBuffer = new float[frames];
+                            std::memset(saveBuffer, 0, frames * sizeof(float));
+                            for (uint32_t i = 0; i < frames; i++) saveBuffer[i] = (*in)[(size_t)i * 2] * 0.8f;
+                            swf->generate_sf2(saveBuffer, 0, frames, frames, 44100, file, "Sample");
+                            delete[] saveBuffer;
+                        });
+                    });
+            }
+        }
+
+        // SF2 writing through a ofstream (the baseline), with writev and with O_DIRECT
+        for (uint32_t s : len) {
+            for (const char* mode : {"ofstream", "buffered", "direct"}) {
+                const uint32_t frames = 44100 * s;
+                add(std::string("write/") + mode + "/" + std::to_string(s) + "s", frames,
+                    [this, frames, mode]() {
+                        auto in = std::make_shared<std::vector<float>>(
+                                    Signal::make(Signal::HARMONIC, 44100, frames, 1));
+                        auto swf = std::make_shared<SoundFontWriter>();
+                        if (std::strcmp(mode, "ofstream") == 0) swf->setPortableIO(true);
+                        else if (std::strcmp(mode, "direct") == 0) swf->setDirectIO(true, 0);
+                        const std::string file = tmpFile("write.sf2");
+                        return std::function<void()>([in, swf, file, frames]() {
+                            swf->generate_sf2(in->data(), 0, frames, frames, 44100, file, "Sample");
+                        });
+                    });
+            }
+        }
+
+        // batch conversion, scaling with the number of threads
+        const uint32_t files = quick ? 8 : 32;
+        const uint32_t cores = std::max(1u, std::thread::hardware_concurrency());
+        for (uint32_t threads = 1; ; threads *= 2) {
+            threads = std::min(threads, cores);
+            add("batch/" + std::to_string(files) + "x2s/" + std::to_string(threads) + "t", files,
+                [this, files, threads]() {
+                    std::vector<std::string> inputs;
+                    for (uint32_t i = 0; i < files; i++) {
+                        const std::string file = tmpFile("batch" + std::to_string(i) + ".wav");
+                        Signal::writeWav(file, Signal::make(Signal::HARMONIC, 48000, 96000, 1,
+                                                110.0f * (1 + i % 8)), 48000, 1, true);
+                        inputs.push_back(file);
+                    }
+                    auto pool = std::make_shared<TaskPool>(threads);
+                    auto conv = std::make_shared<Converter>();
+                    return std::function<void()>([this, inputs, pool, conv]() {
+                        std::vector<std::shared_ptr<Converter::Context>> jobs;
+                        for (const auto& in : inputs) {
+                            auto c = std::make_shared<Converter::Context>();
+                            c->job.input = in;
+                            c->job.output = Converter::outputFor(in, tmpDir);
+                            c->job.sampleRate = 44100;
+                            jobs.push_back(c);
+                        }
+                        conv->runBatch(*pool, jobs);
+                    });
+                });
+            if (threads >= cores) break;
+        }
+    }
+
+    // the passband and stopband error of every tier and ratio as CSV.
+    // passband: the largest gain error of tones up to 0.4 * the lower rate,
+    // stopband: the loudest unwanted output (images, aliases, tones which
+    // fold into the passband) relative to the test tone
+    static void accuracy(std::ostream& out) {
+        out << "tier,ratio,passband_db,stopband_db" << std::endl;
+        for (uint32_t q : tiers) {
+            for (const auto& r : ratios) {
+                const uint32_t from = r.first;
+                const uint32_t to = r.second;
+                const double low = std::min(from, to);
+                double pass = 0.0;
+                double stop = -200.0;
+                const uint32_t tones = 24;
+                for (uint32_t i = 0; i < tones; i++) {
+                    const double f = 50.0 * std::pow(0.4 * low / 50.0, (double)i / (tones - 1));
+                    double gain, rest, level;
+                    if (!measureTone(q, from, to, f, gain, rest, level)) continue;
+                    pass = std::max(pass, std::fabs(gain));
+                    stop = std::max(stop, rest);
+                }
+                // tones the downsampling has to remove, the ones which alias into the passband
+                for (double f = 0.6 * low; from > to && f < 0.48 * from; f += 0.05 * low) {
+                    double gain, rest, level;
+                    if (!measureTone(q, from, to, f, gain, rest, level)) continue;
+                    stop = std::max(stop, level);
+                }
+                char line[128];
+                snprintf(line, sizeof(line), "%s,%u-%u,%.4f,%.1f", CheckResample::qualityName(q).c_str(),
+                                from, to, pass, stop);
+                out << line << std::endl;
+            }
+        }
+    }
+
+    // list the case names
+    void list() const {
+        for (const auto& c : cases) std::cout << c.name << std::endl;
+    }
+
+    // run all cases, return false when a case failed
+    bool run(std::vector<Row>& rows) {
+        bool ok = true;
+        for (const auto& c : cases) {
+            Row r;
+            r.name = c.name;
+            if (!runCase(c, r)) {
+                std::cerr << "Error: case " << c.name << " failed" << std::endl;
+                ok = false;
+                continue;
+            }
+            fprintf(stderr, "%-40s %5u  min %10.3f ms  median %10.3f ms  %12.0f/s  %8llu kB\n",
+                    r.name.c_str(), r.iterations, r.minTime, r.medianTime, r.throughput,
+                    (unsigned long long)r.peakRss);
+            rows.push_back(r);
+        }
+        return ok;
+    }
+
+    static bool writeCsv(const std::string& file, const std::vector<Row>& rows) {
+        std::ofstream out(file);
+        if (!out) {
+            std::cerr << "Error: could not write " << file << std::endl;
+            return false;
+        }
+        out << "case,iterations,min_ms,median_ms,throughput_per_s,peak_rss_kb\n";
+        char line[512];
+        for (const auto& r : rows) {
+            snprintf(line, sizeof(line), "%s,%u,%.4f,%.4f,%.1f,%llu\n", r.name.c_str(),
+                        r.iterations, r.minTime, r.medianTime, r.throughput,
+                        (unsigned long long)r.peakRss);
+            out << line;
+        }
+        return (bool)out;
+    }
+
+    static bool readCsv(const std::string& file, std::vector<Row>& rows) {
+        std::ifstream in(file);
+        if (!in) {
+            std::cerr << "Error: could not read " << file << std::endl;
+            return false;
+        }
+        std::string line;
+        std::getline(in, line);
+        while (std::getline(in, line)) {
+            if (line.empty()) continue;
+            std::vector<std::string> f;
+            std::stringstream ss(line);
+            std::string v;
+            while (std::getline(ss, v, ',')) f.push_back(v);
+            if (f.size() < 6) {
+                std::cerr << "Error: invalid line in " << file << ": " << line << std::endl;
+                return false;
+            }
+            Row r;
+            r.name = f[0];
+            r.iterations = (uint32_t)std::strtoul(f[1].c_str(), nullptr, 10);
+            r.minTime = std::strtod(f[2].c_str(), nullptr);
+            r.medianTime = std::strtod(f[3].c_str(), nullptr);
+            r.throughput = std::strtod(f[4].c_str(), nullptr);
+            r.peakRss = std::strtoull(f[5].c_str(), nullptr, 10);
+            rows.push_back(r);
+        }
+        return true;
+    }
+
+    // compare the median time and the peak memory against the baseline,
+    // return the number of regressions (slower/larger by more than threshold percent)
+    static uint32_t compare(const std::vector<Row>& base, const std::vector<Row>& cur,
+                                                                double threshold) {
+        std::map<std::string, const Row*> b;
+        for (const auto& r : base) b[r.name] = &r;
+        uint32_t regressions = 0;
+        printf("%-40s %12s %12s %8s %10s  %s\n", "case", "base ms", "current ms",
+                    "time", "memory", "");
+        for (const auto& r : cur) {
+            auto it = b.find(r.name);
+            if (it == b.end()) {
+                printf("%-40s %12s %12.3f %8s %10s  new\n", r.name.c_str(), "-",
+                            r.medianTime, "-", "-");
+                continue;
+            }
+            const Row& o = *it->second;
+            const double dt = change(o.medianTime, r.medianTime);
+            const double dm = change((double)o.peakRss, (double)r.peakRss);
+            const char* flag = "";
+            if (dt > threshold || dm > threshold) {
+                flag = dt > threshold ? "REGRESSION" : "REGRESSION (memory)";
+                regressions++;
+            } else if (dt < -threshold) {
+                flag = "improved";
+            }
+            printf("%-40s %12.3f %12.3f %+7.1f%% %+9.1f%%  %s\n", r.name.c_str(),
+                        o.medianTime, r.medianTime, dt, dm, flag);
+        }
+        for (const auto& r : base) {
+            bool found = false;
+            for (const auto& c : cur) if (c.name == r.name) found = true;
+            if (!found) printf("%-40s %12.3f %12s %8s %10s  missing\n", r.name.c_str(),
+                                    r.medianTime, "-", "-", "-");
+        }
+        printf("%u regression(s) with a threshold of %.1f%%\n", regressions, threshold);
+        return regressions;
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr uint32_t tiers[] = {CheckResample::DRAFT, CheckResample::STANDARD,
+                                                        CheckResample::MASTERING};
+    // generic ratios and the half-band ones
+    static constexpr std::pair<uint32_t, uint32_t> ratios[] = {{48000, 44100}, {44100, 48000},
+                            {96000, 44100}, {44100, 88200}, {96000, 48000}, {48000, 96000}};
+
+    std::vector<Case> cases;
+
+    // resample a sine of frequency f, gain is the level of the fitted sine
+    // in the output, rest the level of the remainder and level the level
+    // of the whole output, all in dB relative to the input
+    static bool measureTone(uint32_t q, uint32_t from, uint32_t to, double f,
+                                        double& gain, double& rest, double& level) {
+        const uint32_t frames = 32768;
+        float* in = new float[frames];
+        for (uint32_t i = 0; i < frames; i++) in[i] = 0.5f * (float)std::sin(2.0 * M_PI * f * i / from);
+        CheckResample rs;
+        rs.setQuality(q);
+        uint32_t count = frames;
+        float* out = rs.checkSampleRate(&count, 1, in, from, to);
+        if (!out) return false;
+        // least squares fit of a sine at f over the middle, away from the edges
+        const uint32_t a = count / 4;
+        const uint32_t b = count * 3 / 4;
+        double ss = 0.0, sc = 0.0, cc = 0.0, ys = 0.0, yc = 0.0;
+        for (uint32_t i = a; i < b; i++) {
+            const double sn = std::sin(2.0 * M_PI * f * i / to);
+            const double cs = std::cos(2.0 * M_PI * f * i / to);
+            ss += sn * sn;
+            sc += sn * cs;
+            cc += cs * cs;
+            ys += out[i] * sn;
+            yc += out[i] * cs;
+        }
+        const double det = ss * cc - sc * sc;
+        const double ks = (ys * cc - yc * sc) / det;
+        const double kc = (yc * ss - ys * sc) / det;
+        double e = 0.0;
+        double t = 0.0;
+        for (uint32_t i = a; i < b; i++) {
+            t += (double)out[i] * out[i];
+            const double v = out[i] - ks * std::sin(2.0 * M_PI * f * i / to) -
+                                        kc * std::cos(2.0 * M_PI * f * i / to);
+            e += v * v;
+        }
+        delete[] out;
+        gain = 20.0 * std::log10(std::max(1e-12, std::sqrt(ks * ks + kc * kc) / 0.5));
+        rest = 20.0 * std::log10(std::max(1e-12, std::sqrt(2.0 * e / (b - a)) / 0.5));
+        level = 20.0 * std::log10(std::max(1e-12, std::sqrt(2.0 * t / (b - a)) / 0.5));
+        return true;
+    }
+
+    void add(const std::string& name, double items, std::function<std::function<void()>()> prepare) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) return;
+        cases.push_back({name, items, std::move(prepare)});
+    }
+
+    std::string tmpFile(const std::string& name) const {
+        return (fs::path(tmpDir) / name).string();
+    }
+
+    static double change(double base, double cur) {
+        if (base <= 0.0) return 0.0;
+        return (cur - base) / base * 100.0;
+    }
+
+    // prepare, warm up and time a case, at least 3 and up to 50 iterations
+    // or as much as fit into half a second
+    void measure(const Case& c, Row& r) {
+        std::function<void()> f = c.prepare();
+        f();
+        std::vector<double> t;
+        double total = 0.0;
+        while (t.size() < 3 || (t.size() < 50 && total < 500.0)) {
+            const auto s = Clock::now();
+            f();
+            const double d = std::chrono::duration<double, std::milli>(Clock::now() - s).count();
+            t.push_back(d);
+            total += d;
+        }
+        std::sort(t.begin(), t.end());
+        r.iterations = (uint32_t)t.size();
+        r.minTime = t.front();
+        r.medianTime = t[t.size() / 2];
+        r.throughput = r.medianTime > 0.0 ? c.items / (r.medianTime / 1000.0) : 0.0;
+    }
+
+    // run a case in a child process, the peak memory of the child is the peak of the case
+    bool runCase(const Case& c, Row& r) {
+        #if defined(_WIN32)
+        measure(c, r);
+        r.peakRss = Converter::peakMemory();
+        return true;
+        #else
+        int fd[2];
+        if (pipe(fd) != 0) return false;
+        fflush(stdout);
+        fflush(stderr);
+        pid_t pid = fork();
+        if (pid < 0) {
+            close(fd[0]);
+            close(fd[1]);
+            return false;
+        }
+        if (pid == 0) {
+            close(fd[0]);
+            measure(c, r);
+            char buf[128];
+            int n = snprintf(buf, sizeof(buf), "%u %.6f %.6f %.3f\n", r.iterations,
+                                r.minTime, r.medianTime, r.throughput);
+            const bool ok = write(fd[1], buf, n) == n;
+            _exit(ok ? 0 : 1);
+        }
+        close(fd[1]);
+        std::string res;
+        char buf[128];
+        ssize_t n;
+        while ((n = read(fd[0], buf, sizeof(buf))) > 0) res.append(buf, n);
+        close(fd[0]);
+        int status = 0;
+        struct rusage ru;
+        if (wait4(pid, &status, 0, &ru) < 0) return false;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) return false;
+        if (sscanf(res.c_str(), "%u %lf %lf %lf", &r.iterations, &r.minTime,
+                        &r.medianTime, &r.throughput) != 4) return false;
+        #if defined(__APPLE__)
+        r.peakRss = (uint64_t)ru.ru_maxrss / 1024;
+        #else
+        r.peakRss = (uint64_t)ru.ru_maxrss;
+        #endif
+        return true;
+        #endif
+    }
+};
+
+static void usage() {
+    std::cout << "usage: sf2generate-bench [options]" << std::endl;
+    std::cout << "       sf2generate-bench --compare BASELINE.csv [CURRENT.csv] [--threshold PCT]" << std::endl;
+    std::cout << "  Options:" << std::endl;
+    std::cout << "    --out FILE           write the results as CSV (default bench.csv)" << std::endl;
+    std::cout << "    --filter TEXT        run only cases with TEXT in the name" << std::endl;
+    std::cout << "    --quick              shorter signals and fewer files" << std::endl;
+    std::cout << "    --list               list the cases" << std::endl;
+    std::cout << "    --accuracy           print the passband and stopband error of the" << std::endl;
+    std::cout << "                         resampler quality tiers as CSV" << std::endl;
+    std::cout << "    --compare BASE       compare against a saved baseline, without CURRENT" << std::endl;
+    std::cout << "                         the benchmarks run first" << std::endl;
+    std::cout << "    --threshold PCT      allowed slowdown in percent (default 10)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    Bench bench;
+    std::string out = "bench.csv";
+    std::string baseline;
+    std::string current;
+    double threshold = 10.0;
+    bool listOnly = false;
+
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        const bool hasValue = i + 1 < argc;
+        if (a == "--out" && hasValue) {
+            out = argv[++i];
+        } else if (a == "--filter" && hasValue) {
+            bench.filter = argv[++i];
+        } else if (a == "--quick") {
+            bench.quick = true;
+        } else if (a == "--list") {
+            listOnly = true;
+        } else if (a == "--accuracy") {
+            Bench::accuracy(std::cout);
+            return 0;
+        } else if (a == "--compare" && hasValue) {
+            baseline = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') current = argv[++i];
+        } else if (a == "--threshold" && hasValue) {
+            threshold = std::strtod(argv[++i], nullptr);
+        } else {
+            usage();
+            return a == "--help" ? 0 : 1;
+        }
+    }
+
+    std::vector<Bench::Row> rows;
+    if (!current.empty()) {
+        std::vector<Bench::Row> base;
+        if (!Bench::readCsv(baseline, base) || !Bench::readCsv(current, rows)) return 1;
+        return Bench::compare(base, rows, threshold) ? 1 : 0;
+    }
+
+    std::error_code ec;
+    fs::path tmp = fs::temp_directory_path(ec) / ("sf2generate-bench-" + std::to_string(
+                        std::chrono::steady_clock::now().time_since_epoch().count()));
+    if (ec || !fs::create_directories(tmp, ec)) {
+        std::cerr << "Error: could not create a temporary directory" << std::endl;
+        return 1;
+    }
+    bench.tmpDir = tmp.string();
+    bench.build();
+    if (listOnly) {
+        bench.list();
+        fs::remove_all(tmp, ec);
+        return 0;
+    }
+    const bool ok = bench.run(rows);
+    fs::remove_all(tmp, ec);
+    if (!Bench::writeCsv(out, rows)) return 1;
+    std::cerr << "results written to " << out << std::endl;
+    if (!baseline.empty()) {
+        std::vector<Bench::Row> base;
+        if (!Bench::readCsv(baseline, base)) return 1;
+        if (Bench::compare(base, rows, threshold)) return 1;
+    }
+    return ok ? 0 : 1;
+}
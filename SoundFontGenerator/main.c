@@ -15,30 +15,35 @@
 #include <unistd.h>
 #include <iostream>
 #include <string>
+#include <filesystem>
 #include <condition_variable>
 
+#include "CmdLine.h"
+#include "Converter.h"
+#include "Daemon.h"
 #include "ParallelThread.h"
+#include "RtStats.h"
 #include "SoundEdit.h"
+#ifdef JACKAPI
+#include "xjack.h"
+typedef XJack AudioServer;
+#else
 #include "xpa.h"
+typedef XPa AudioServer;
+#endif
 
 SoundEditUi ui;
+RtStats rtStats;
 
-// the portaudio server process callback
-static int process(const void* inputBuffer, void* outputBuffer,
-    unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo,
-    PaStreamCallbackFlags statusFlags, void* data) {
-
-    float* out = static_cast<float*>(outputBuffer);
-    static std::condition_variable *Sync = static_cast<std::condition_variable*>(data);
-    static float fRec0[2] = {0};
-    static float ramp = 0.0;
-    static const float ramp_step = 256.0;
-    (void) timeInfo;
-    (void) statusFlags;
+static float fRec0[2] = {0};
+static float ramp = 0.0;
+static const float ramp_step = 256.0;
 
+// render frames stereo frames from the loaded file at its own Sample Rate
+static void render(float* out, uint32_t frames) {
     if (( ui.af.samplesize && ui.af.samples != nullptr) && ui.play && ui.ready) {
         float fSlow0 = 0.0010000000000000009 * ui.gain;
-        for (uint32_t i = 0; i<(uint32_t)frames; i++) {
+        for (uint32_t i = 0; i<frames; i++) {
             fRec0[0] = fSlow0 + 0.999 * fRec0[1];
             for (uint32_t c = 0; c < ui.af.channels; c++) {
                 if (!c) {
@@ -74,8 +79,33 @@ static int process(const void* inputBuffer, void* outputBuffer,
             }
         }
     } else {
-        memset(out, 0.0, (uint32_t)frames * 2 * sizeof(float));
+        memset(out, 0.0, frames * 2 * sizeof(float));
     }
+}
+
+// the audio server process callback
+static int process(const void* inputBuffer, void* outputBuffer,
+    unsigned long frames, const PaStreamCallbackTimeInfo* timeInfo,
+    PaStreamCallbackFlags statusFlags, void* data) {
+
+    RtStats::Scope rt(rtStats, (uint32_t)frames, statusFlags);
+    float* out = static_cast<float*>(outputBuffer);
+    static std::condition_variable *Sync = static_cast<std::condition_variable*>(data);
+
+    // the file keep its Sample Rate, resample to the server rate on the fly
+    PreviewResampler* preview = ui.preview.enter();
+    if (ui.ready && preview->active()) preview->process(out, (uint32_t)frames, render);
+    else render(out, (uint32_t)frames);
+
+    // publish when the next frame will be audible
+    double ahead = timeInfo ? timeInfo->outputBufferDacTime - timeInfo->currentTime : 0.0;
+    if (ahead < 0.0 || ahead > 1.0) ahead = 0.0;
+    if (ui.jack_sr) ahead += (double)frames / ui.jack_sr;
+    if (preview->active() && ui.af.samplerate)
+        ahead += (double)preview->latency() / ui.af.samplerate;
+    ui.preview.leave();
+    ui.playHead.publish(ui.position, PlayHead::now() + (uint64_t)(ahead * 1e9),
+                                                ui.play && ui.ready && ui.af.samples);
     Sync->notify_one();
 
     return 0;
@@ -104,51 +134,225 @@ signal_handler (int sig)
 }
 #endif
 
-int runHeadLess(int argc, char *argv[]){
-    uint32_t SampleRate = 0;
-    if (argc > 3) SampleRate = (uint32_t)atoi(argv[3]);
-    if (ui.af.getAudioFile(argv[1], SampleRate)) {
-        uint8_t rootkey = 0;
-        int16_t pitchCorrection = 0;
-        float freq = 0.0;
-        float gain = std::pow(1e+01, 0.05 * 0.0);
-        if (SampleRate) ui.af.samplerate = SampleRate;
-        rootkey = ui.pt.getPitch(ui.af.samples, ui.af.samplesize , ui.af.channels, ui.af.samplerate, &pitchCorrection, &freq);
-        if (rootkey) {
-            char s[10];
-            snprintf(s, 10, "%.2f Hz", freq);
-            std::string fr = s;
-            std::cout << "  Frequency:  " << fr << std::endl;
-            std::cout << "  SampleRate:  " << std::to_string(ui.af.samplerate) << " Hz " << std::endl;
-            std::cout << "  Root Key:  " + std::to_string(rootkey) << std::endl;
-            std::cout << "  PitchCorrection:  " << std::to_string(pitchCorrection) << " Cent" << std::endl;
-            std::cout << "  SampleSize: " << std::to_string(ui.af.samplesize) << std::endl;
-            ui.af.savesf2(argv[2], 0, ui.af.samplesize,
-                                ui.af.samplerate, gain, rootkey,
-                                500, 500, pitchCorrection);
-            std::cout << "Generated: " << argv[2]  << std::endl;
-            return 0;
+// setup the converter from the command-line options
+void setupConverter(const CmdLine& cmd, Converter& conv) {
+    if (cmd.useCache) conv.setCache(true, cmd.cacheDir, cmd.cacheSize);
+    if (cmd.directIO) conv.setDirectIO(true);
+    if (cmd.pipeline) conv.setPipeline(true);
+}
+
+int runHeadLess(const CmdLine& cmd){
+    Converter conv;
+    setupConverter(cmd, conv);
+    auto c = std::make_unique<Converter::Context>();
+    c->job.input = cmd.args[0];
+    c->job.output = cmd.args[1];
+    c->job.sampleRate = cmd.sampleRate;
+    c->job.quality = cmd.quality;
+    c->job.retune = cmd.retune;
+    c->job.trim = cmd.trim;
+    c->job.trimThreshold = cmd.trimThreshold;
+    c->job.normalize = cmd.normalize;
+    c->job.normalizeLevel = cmd.normalizeLevel;
+    c->job.stereo = cmd.stereo;
+    if (cmd.args.size() > 2) c->job.sampleRate = (uint32_t)atoi(cmd.args[2].c_str());
+    c->job.gain = std::pow(1e+01, 0.05 * 0.0);
+    conv.run(*c);
+    if (cmd.json) {
+        std::cout << Converter::json(*c) << std::endl;
+        return c->result.ok ? 0 : 1;
+    }
+    Converter::print(*c);
+    if (cmd.pipeline && c->result.ok) Pipeline::printStats(c->stats);
+    return c->result.ok ? 0 : 1;
+}
+
+// convert all files given on the command-line in parallel
+int runBatch(const CmdLine& cmd){
+    Converter conv;
+    setupConverter(cmd, conv);
+    // the files already run in parallel
+    if (cmd.args.size() > 1) conv.setRetuneThreads(1);
+    std::error_code ec;
+    std::filesystem::create_directories(cmd.batchDir, ec);
+    std::vector<std::shared_ptr<Converter::Context>> jobs;
+    for (const auto& in : cmd.args) {
+        auto c = std::make_shared<Converter::Context>();
+        c->job.input = in;
+        c->job.output = Converter::outputFor(in, cmd.batchDir);
+        c->job.sampleRate = cmd.sampleRate;
+        c->job.quality = cmd.quality;
+        c->job.retune = cmd.retune;
+        c->job.trim = cmd.trim;
+        c->job.trimThreshold = cmd.trimThreshold;
+        c->job.normalize = cmd.normalize;
+        c->job.normalizeLevel = cmd.normalizeLevel;
+        c->job.stereo = cmd.stereo;
+        jobs.push_back(c);
+    }
+    TaskPool pool(cmd.jobs, cmd.pinThreads);
+    conv.runBatch(pool, jobs);
+    int ret = 0;
+    for (const auto& c : jobs) {
+        if (cmd.json) {
+            std::cout << Converter::json(*c) << std::endl;
+        } else {
+            std::cout << c->job.input << std::endl;
+            Converter::print(*c);
+        }
+        if (!c->result.ok) ret = 1;
+    }
+    return ret;
+}
+
+// the audio files of a directory, sorted by name
+static void listAudioFiles(const std::string& dir, std::vector<std::string>& files) {
+    SupportedFormats formats;
+    std::vector<std::string> found;
+    std::error_code ec;
+    for (const auto& e : std::filesystem::directory_iterator(dir, ec)) {
+        if (e.is_regular_file(ec) && formats.isSupported(e.path().string()))
+            found.push_back(e.path().string());
+    }
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
+
+// write all notes given on the command-line as one multi-zone instrument
+int runInstrument(const CmdLine& cmd){
+    Converter conv;
+    setupConverter(cmd, conv);
+    std::vector<std::string> files;
+    for (const auto& in : cmd.args) {
+        std::error_code ec;
+        if (std::filesystem::is_directory(in, ec)) listAudioFiles(in, files);
+        else files.push_back(in);
+    }
+    // with --slice every note found in a file become a job
+    Slicer::Settings settings;
+    settings.threshold = cmd.sliceThreshold;
+    settings.gap = cmd.sliceGap;
+    std::vector<Slicer::Region> regions(1, Slicer::Region{0, 0});
+    std::vector<std::shared_ptr<Converter::Context>> jobs;
+    for (const auto& in : files) {
+        if (cmd.slice) {
+            Slicer slicer;
+            if (!slicer.detect(in, settings, regions)) {
+                std::cerr << "Fail to read: " << in << std::endl;
+                continue;
+            }
+            if (!cmd.json) std::cout << in << ": " << regions.size() << " notes" << std::endl;
+        }
+        for (size_t i = 0; i < regions.size(); i++) {
+            auto c = std::make_shared<Converter::Context>();
+            c->job.input = in;
+            c->job.sampleRate = cmd.sampleRate;
+            c->job.quality = cmd.quality;
+            c->job.retune = cmd.retune;
+            c->job.trim = cmd.trim;
+            c->job.trimThreshold = cmd.trimThreshold;
+            c->job.normalize = cmd.normalize;
+            c->job.normalizeLevel = cmd.normalizeLevel;
+            c->job.stereo = cmd.stereo;
+            if (cmd.slice) {
+                c->job.sliceStart = regions[i].start;
+                c->job.sliceFrames = regions[i].frames;
+                c->job.name = std::filesystem::path(in).stem().string() + "-" + std::to_string(i + 1);
+            }
+            jobs.push_back(c);
+        }
+    }
+    if (jobs.size() > 1) conv.setRetuneThreads(1);
+    TaskPool pool(cmd.jobs, cmd.pinThreads);
+    Converter::Instrument inst;
+    conv.runInstrument(pool, jobs, cmd.instrument, inst);
+    for (const auto& c : jobs) {
+        if (cmd.json) {
+            std::cout << Converter::json(*c) << std::endl;
         } else {
-            std::cout << "Fail to read: " << argv[1]  << std::endl;
+            std::cout << c->job.input;
+            if (!c->job.name.empty()) std::cout << " (" << c->job.name << ")";
+            std::cout << std::endl;
+            Converter::print(*c);
         }
     }
-    return 1;
+    if (cmd.json) std::cout << Converter::json(inst) << std::endl;
+    else Converter::print(inst);
+    return inst.ok ? 0 : 1;
+}
+
+#if !defined(_WIN32)
+void daemon_signal_handler (int sig)
+{
+    (void) sig;
+    Daemon::stop();
+}
+
+// serve conversion jobs on a Unix socket
+int runDaemon(const CmdLine& cmd){
+    Converter conv;
+    setupConverter(cmd, conv);
+    // the jobs already run in parallel
+    conv.setRetuneThreads(1);
+    TaskPool pool(cmd.jobs, cmd.pinThreads);
+    Daemon daemon(conv, pool);
+    if (!daemon.listen(cmd.daemonSocket)) return 1;
+    signal (SIGPIPE, SIG_IGN);
+    signal (SIGTERM, daemon_signal_handler);
+    signal (SIGHUP, daemon_signal_handler);
+    signal (SIGINT, daemon_signal_handler);
+    return daemon.run();
+}
+#endif
+
+// dump the trace when requested
+int traceExit(const CmdLine& cmd, int ret) {
+    if (!cmd.traceFile.empty()) Trace::dump(cmd.traceFile);
+    return ret;
 }
 
 int main(int argc, char *argv[]){
-    if (argc > 1) {
-        std::string cmd = argv[1];
+    CmdLine cmdline;
+    if (!cmdline.parse(argc, argv)) return 1;
+    if (!cmdline.traceFile.empty()) Trace::enable(true);
+    if (cmdline.args.size() > 0) {
+        std::string cmd = cmdline.args[0];
         if ((cmd.compare("--help") == 0) || (cmd.compare("-h") == 0)) {
             std::cout << "Minimal SF2 (SoundFont 2) writer for a single mono WAV file." << std::endl;
             std::cout << "  Usage: " << argv[0] << " input.wav output.sf2" << std::endl;
             std::cout << "  Optional argument: resample to Sample Rate" << std::endl;
             std::cout << "  Usage: " << argv[0] << " input.wav output.sf2" << " 48000" <<std::endl;
+            CmdLine::usage();
             return 0;
         }
     }
 
-    if (argc > 2) {
-       return runHeadLess(argc, argv);
+    if (cmdline.listDevices) {
+        AudioServer xpa ("sf2generate");
+        xpa.listDevices();
+        return 0;
+    }
+
+    #if !defined(_WIN32)
+    if (!cmdline.daemonSocket.empty()) {
+       return traceExit(cmdline, runDaemon(cmdline));
+    }
+
+    if (!cmdline.clientSocket.empty()) {
+       return Daemon::submit(cmdline.clientSocket, std::cin);
+    }
+    #endif
+
+    if (!cmdline.instrument.empty()) {
+       return traceExit(cmdline, runInstrument(cmdline));
+    }
+
+    if (!cmdline.batchDir.empty()) {
+       return traceExit(cmdline, runBatch(cmdline));
+    }
+
+    if (cmdline.args.size() > 1) {
+       return traceExit(cmdline, runHeadLess(cmdline));
     }
 
     #if defined(__linux__) || defined(__FreeBSD__) || \
@@ -171,21 +375,46 @@ int main(int argc, char *argv[]){
     signal (SIGINT, signal_handler);
     #endif
 
-    XPa xpa ("sf2generate");
+    AudioServer xpa ("sf2generate");
+    xpa.setDevice(cmdline.device);
+    xpa.setPeriod(cmdline.period);
+    xpa.setSampleRate(cmdline.deviceRate);
+    xpa.setLatency(cmdline.latency);
     if(!xpa.openStream(0, 2, &process, (void*) &Sync)) ui.onExit();
 
     ui.setJackSampleRate(xpa.getSampleRate());
+    rtStats.setSampleRate(xpa.getSampleRate());
 
     if(!xpa.startStream()) ui.onExit();
     ui.setPaStream(xpa.getStream());
 
-    if (argv[1])
-    #ifdef __XDG_MIME_H__
-    if(strstr(xdg_mime_get_mime_type_from_file_name(argv[1]), "audio")) {
-    #else
-    if( access(argv[1], F_OK ) != -1 ) {
-    #endif
-        ui.dialog_response(ui.w, (void*) &argv[1]);
+    // the device selector, the preview follow the Sample Rate of the new device
+    const std::vector<AudioServer::DeviceInfo> devices = xpa.getDevices();
+    std::vector<std::string> deviceNames;
+    int activeDevice = 0;
+    for (size_t i = 0; i < devices.size(); i++) {
+        deviceNames.push_back(devices[i].hostName + ":" + devices[i].name);
+        if (devices[i].index == xpa.getDevice()) activeDevice = (int)i;
+    }
+    ui.setDevices(deviceNames, activeDevice, [&xpa, &devices](int i) {
+        const int old = xpa.getDevice();
+        const bool ok = xpa.switchDevice(std::to_string(devices[i].index));
+        if (!ok && !xpa.switchDevice(std::to_string(old))) ui.onExit();
+        ui.setPaStream(xpa.getStream());
+        ui.setJackSampleRate(xpa.getSampleRate());
+        rtStats.setSampleRate(xpa.getSampleRate());
+        return ok;
+    });
+
+    if (cmdline.args.size() > 0) {
+        const char* file = cmdline.args[0].c_str();
+        #ifdef __XDG_MIME_H__
+        if(strstr(xdg_mime_get_mime_type_from_file_name(file), "audio")) {
+        #else
+        if( access(file, F_OK ) != -1 ) {
+        #endif
+            ui.dialog_response(ui.w, (void*) &file);
+        }
     }
 
     main_run(&app);
@@ -193,7 +422,8 @@ int main(int argc, char *argv[]){
     ui.pa.stop();
     main_quit(&app);
     xpa.stopStream();
+    if (cmdline.rtStats) rtStats.print(stderr);
     printf("bye bye\n");
-    return 0;
+    return traceExit(cmdline, 0);
 }
 
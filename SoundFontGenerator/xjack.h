@@ -0,0 +1,415 @@
+
+/*
+ * xjack.h
+ *
+ * SPDX-License-Identifier:  BSD-3-Clause
+ *
+ * Copyright (C) 2025 brummer <brummer@web.de>
+ */
+
+/****************************************************************
+  XJack - a native jack client with the interface of XPa
+
+  Used instead of XPa when build with JACKAPI (make jack), so the
+  audio goes straight to jackd without the buffering layer of the
+  portaudio jack host api. The portaudio style process callback
+  is called from the jack process callback, the interleaved buffers
+  get (de)interleaved from/to the jack ports.
+
+  A "device" is a jack client with audio input ports, the output
+  ports get connected to it on start (default the physical ports).
+  Period size and Sample Rate are set by the jack server, when they
+  change the buffer-size and sample-rate callbacks take care.
+  xruns reported by jack are passed as paOutputUnderflow to the
+  next call of the process callback.
+****************************************************************/
+
+#include <jack/jack.h>
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#pragma once
+
+#ifndef XJACK_H
+#define XJACK_H
+
+class XJack;
+
+// the portaudio types used by the process callback and the GUI
+typedef int PaError;
+typedef XJack PaStream;
+typedef unsigned long PaStreamCallbackFlags;
+
+typedef struct PaStreamCallbackTimeInfo {
+    double inputBufferAdcTime;
+    double currentTime;
+    double outputBufferDacTime;
+} PaStreamCallbackTimeInfo;
+
+typedef int PaStreamCallback(const void* input, void* output, unsigned long frameCount,
+                const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags,
+                void* userData);
+
+#ifndef paOutputUnderflow
+#define paOutputUnderflow ((PaStreamCallbackFlags) 0x00000004)
+#endif
+
+class XJack {
+public:
+    // a jack client with audio input ports
+    struct DeviceInfo {
+        int index;
+        std::string name;
+        std::string hostName;
+        int outputChannels;
+        uint32_t sampleRate;
+        double lowLatency;      // seconds
+        double highLatency;     // seconds
+    };
+
+    XJack(const char* cname){
+        jack_status_t status = static_cast<jack_status_t>(0);
+        client = jack_client_open(cname, JackNoStartServer, &status);
+        if (!client) {
+            std::cerr << "Error: could not connect to the jack server" << std::endl;
+        }
+        SampleRate = client ? jack_get_sample_rate(client) : 0;
+        bufferSize = client ? jack_get_buffer_size(client) : 0;
+        requestedRate = 0;
+        period = 0;
+        requestedLatency = 0.0;
+        latencyFrames = 0;
+        ichannels = 0;
+        ochannels = 0;
+        callback = nullptr;
+        callbackArg = nullptr;
+        capacity = 0;
+        device = -1;
+        active = false;
+        xrun = false;
+    };
+
+    ~XJack(){
+        stopStream();
+        if (client) jack_client_close(client);
+    };
+
+    // request a device by index or client name,
+    // a empty string select the physical playback ports
+    void setDevice(const std::string& name) {
+        requestedDevice = name;
+    }
+
+    // the period size is set by the jack server
+    void setPeriod(uint32_t frames) {
+        period = frames;
+    }
+
+    // the Sample Rate is set by the jack server
+    void setSampleRate(uint32_t sr) {
+        requestedRate = sr;
+    }
+
+    // the latency is set by the jack server
+    void setLatency(double seconds) {
+        requestedLatency = seconds;
+    }
+
+    // all jack clients with audio input ports
+    std::vector<DeviceInfo> getDevices() {
+        std::vector<DeviceInfo> devices;
+        if (!client) return devices;
+        const char** ports = jack_get_ports(client, nullptr, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput);
+        if (!ports) return devices;
+        const std::string self = std::string(jack_get_client_name(client)) + ":";
+        for (int i = 0; ports[i]; i++) {
+            const std::string port = ports[i];
+            if (port.compare(0, self.size(), self) == 0) continue;
+            const std::string name = port.substr(0, port.find(':'));
+            bool found = false;
+            for (auto& dev : devices) {
+                if (dev.name == name) {
+                    dev.outputChannels++;
+                    found = true;
+                }
+            }
+            if (found) continue;
+            DeviceInfo dev;
+            dev.index = (int)devices.size();
+            dev.name = name;
+            dev.hostName = "JACK";
+            dev.outputChannels = 1;
+            dev.sampleRate = SampleRate;
+            dev.lowLatency = (double)bufferSize / std::max<uint32_t>(1, SampleRate);
+            dev.highLatency = dev.lowLatency;
+            devices.push_back(dev);
+        }
+        jack_free(ports);
+        return devices;
+    }
+
+    // print the output devices
+    void listDevices() {
+        for (const auto& dev : getDevices()) {
+            std::cout << dev.index << ": " << dev.hostName << ":" << dev.name
+                << " (" << dev.outputChannels << " channels, " << dev.sampleRate
+                << "hz, " << bufferSize << " frames)" << std::endl;
+        }
+    }
+
+    // register the ports and set the audio process callback
+    bool openStream(uint32_t ichannels_, uint32_t ochannels_, PaStreamCallback *process, void* arg) {
+        if (!client) return false;
+        ichannels = ichannels_;
+        ochannels = ochannels_;
+        callback = process;
+        callbackArg = arg;
+        if (inPorts.empty() && outPorts.empty()) {
+            char name[32];
+            for (uint32_t i = 0; i < ichannels; i++) {
+                snprintf(name, sizeof(name), "in_%u", i + 1);
+                jack_port_t* p = jack_port_register(client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+                if (!p) return false;
+                inPorts.push_back(p);
+            }
+            for (uint32_t i = 0; i < ochannels; i++) {
+                snprintf(name, sizeof(name), "out_%u", i + 1);
+                jack_port_t* p = jack_port_register(client, name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+                if (!p) return false;
+                outPorts.push_back(p);
+            }
+            jack_set_process_callback(client, jackProcess, this);
+            jack_set_buffer_size_callback(client, jackBufferSize, this);
+            jack_set_sample_rate_callback(client, jackSampleRate, this);
+            jack_set_xrun_callback(client, jackXrun, this);
+            jack_set_latency_callback(client, jackLatency, this);
+            jack_on_shutdown(client, jackShutdown, this);
+        }
+        // the interleaved buffers are sized for the largest usual jack period,
+        // they never get reallocated while the process callback runs
+        resizeBuffers(std::max<uint32_t>(MAX_PERIOD, bufferSize));
+        if (period && period != bufferSize)
+            std::cerr << "Warning: the jack server run with " << bufferSize
+                << " frames per buffer, not " << period << std::endl;
+        if (requestedRate && requestedRate != SampleRate)
+            std::cerr << "Warning: the jack server run at " << SampleRate
+                << "hz Sample Rate, not " << requestedRate << "hz" << std::endl;
+        if (requestedLatency > 0.0)
+            std::cerr << "Warning: the latency is set by the jack server" << std::endl;
+        return true;
+    }
+
+    // connect to a other device
+    bool switchDevice(const std::string& name) {
+        stopStream();
+        setDevice(name);
+        return openStream(ichannels, ochannels, callback, callbackArg) && startStream();
+    }
+
+    // activate the client and connect the ports
+    bool startStream() {
+        if (!client) return false;
+        if (jack_activate(client) != 0) return false;
+        active = true;
+        connectPorts();
+        updateLatency();
+        std::cout << "using (" << (device >= 0 ? deviceName : std::string("system")) << ") JACK with "
+            << bufferSize << " frames per buffer, " << SampleRate << "hz Sample Rate and "
+            << getLatency() * 1000.0 << " ms output latency" << std::endl;
+        return true;
+    }
+
+    // helper function to get a pointer to the stream object
+    PaStream* getStream() {
+        return this;
+    }
+
+    // helper function to get the SampleRate used by the audio sever
+    uint32_t getSampleRate() {
+        return SampleRate;
+    }
+
+    // the output latency in seconds, the playback latency of the connected
+    // ports plus the own period, like the latency portaudio report
+    double getLatency() {
+        return SampleRate ? (double)(latencyFrames.load(std::memory_order_relaxed) + bufferSize)
+                                                                    / SampleRate : 0.0;
+    }
+
+    // the index of the connected device, -1 for the physical ports
+    int getDevice() {
+        return device;
+    }
+
+    bool isActive() {
+        return active.load(std::memory_order_acquire);
+    }
+
+    // deactivate the client, the ports get disconnected
+    void stopStream() {
+        if (!client || !active) return;
+        active = false;
+        jack_deactivate(client);
+    }
+
+private:
+    static constexpr uint32_t MAX_PERIOD = 8192;
+
+    jack_client_t* client;
+    std::vector<jack_port_t*> inPorts;
+    std::vector<jack_port_t*> outPorts;
+    std::vector<float> inBuffer;
+    std::vector<float> outBuffer;
+    uint32_t capacity;
+    std::atomic<uint32_t> SampleRate;
+    std::atomic<uint32_t> bufferSize;
+    std::atomic<uint32_t> latencyFrames;
+    uint32_t requestedRate;
+    uint32_t period;
+    double requestedLatency;
+    std::string requestedDevice;
+    std::string deviceName;
+    int device;
+    uint32_t ichannels;
+    uint32_t ochannels;
+    PaStreamCallback *callback;
+    void* callbackArg;
+    std::atomic<bool> active;
+    std::atomic<bool> xrun;
+
+    // connect the ports to the requested device or the physical ports
+    void connectPorts() {
+        device = -1;
+        deviceName.clear();
+        std::string pattern;
+        unsigned long flags = JackPortIsInput | JackPortIsPhysical;
+        if (!requestedDevice.empty()) {
+            const auto devices = getDevices();
+            char* e = nullptr;
+            long i = std::strtol(requestedDevice.c_str(), &e, 10);
+            const bool isIndex = e && *e == '\0' && e != requestedDevice.c_str();
+            for (const auto& dev : devices) {
+                if ((isIndex && dev.index == i) || dev.name == requestedDevice ||
+                                                "JACK:" + dev.name == requestedDevice) {
+                    device = dev.index;
+                    deviceName = dev.name;
+                }
+            }
+            if (device < 0) {
+                std::cerr << "Warning: device " << requestedDevice << " not found, use default" << std::endl;
+            } else {
+                pattern = "^" + deviceName + ":";
+                flags = JackPortIsInput;
+            }
+        }
+        const char** ports = jack_get_ports(client, pattern.empty() ? nullptr : pattern.c_str(),
+                                                    JACK_DEFAULT_AUDIO_TYPE, flags);
+        if (!ports) return;
+        size_t n = 0;
+        while (ports[n]) n++;
+        // a mono device get all channels
+        for (size_t i = 0; i < outPorts.size() && n; i++) {
+            jack_connect(client, jack_port_name(outPorts[i]), ports[std::min(i, n - 1)]);
+        }
+        jack_free(ports);
+    }
+
+    // the interleaved buffers for frames frames per period
+    void resizeBuffers(uint32_t frames) {
+        inBuffer.assign((size_t)frames * std::max<uint32_t>(1, ichannels), 0.0f);
+        outBuffer.assign((size_t)frames * std::max<uint32_t>(1, ochannels), 0.0f);
+        capacity = frames;
+    }
+
+    // the playback latency of the connected ports, the own period isn't
+    // counted, the callback add it for the frames it render (like with portaudio)
+    void updateLatency() {
+        jack_nframes_t l = 0;
+        for (auto p : outPorts) {
+            jack_latency_range_t r;
+            jack_port_get_latency_range(p, JackPlaybackLatency, &r);
+            l = std::max(l, r.max);
+        }
+        latencyFrames.store(l, std::memory_order_relaxed);
+    }
+
+    // call the portaudio style callback with interleaved buffers
+    static int jackProcess(jack_nframes_t nframes, void* arg) {
+        XJack* self = static_cast<XJack*>(arg);
+        if (nframes > self->capacity || !self->callback) {
+            for (auto p : self->outPorts)
+                std::memset(jack_port_get_buffer(p, nframes), 0, nframes * sizeof(float));
+            return 0;
+        }
+        const uint32_t ic = (uint32_t)self->inPorts.size();
+        for (uint32_t c = 0; c < ic; c++) {
+            const float* in = static_cast<const float*>(jack_port_get_buffer(self->inPorts[c], nframes));
+            for (uint32_t i = 0; i < nframes; i++) self->inBuffer[i * ic + c] = in[i];
+        }
+        PaStreamCallbackTimeInfo timeInfo;
+        timeInfo.currentTime = jack_get_time() / 1000000.0;
+        timeInfo.inputBufferAdcTime = timeInfo.currentTime;
+        // when the first frame of this period reach the DAC
+        const uint32_t sr = std::max<uint32_t>(1, self->SampleRate);
+        timeInfo.outputBufferDacTime = timeInfo.currentTime +
+                    (double)self->latencyFrames.load(std::memory_order_relaxed) / sr;
+        PaStreamCallbackFlags flags = self->xrun.exchange(false, std::memory_order_relaxed) ?
+                                                                        paOutputUnderflow : 0;
+        self->callback(ic ? self->inBuffer.data() : nullptr, self->outBuffer.data(), nframes,
+                                                        &timeInfo, flags, self->callbackArg);
+        const uint32_t oc = (uint32_t)self->outPorts.size();
+        for (uint32_t c = 0; c < oc; c++) {
+            float* out = static_cast<float*>(jack_port_get_buffer(self->outPorts[c], nframes));
+            for (uint32_t i = 0; i < nframes; i++) out[i] = self->outBuffer[i * oc + c];
+        }
+        return 0;
+    }
+
+    static int jackBufferSize(jack_nframes_t nframes, void* arg) {
+        XJack* self = static_cast<XJack*>(arg);
+        self->bufferSize = nframes;
+        // jack don't run the process callback while the buffer size change,
+        // so the buffers could grow here
+        if (nframes > self->capacity) self->resizeBuffers(nframes);
+        self->updateLatency();
+        return 0;
+    }
+
+    static int jackSampleRate(jack_nframes_t sr, void* arg) {
+        XJack* self = static_cast<XJack*>(arg);
+        self->SampleRate = sr;
+        return 0;
+    }
+
+    static int jackXrun(void* arg) {
+        XJack* self = static_cast<XJack*>(arg);
+        self->xrun.store(true, std::memory_order_relaxed);
+        return 0;
+    }
+
+    static void jackLatency(jack_latency_callback_mode_t mode, void* arg) {
+        XJack* self = static_cast<XJack*>(arg);
+        if (mode == JackPlaybackLatency) self->updateLatency();
+    }
+
+    static void jackShutdown(void* arg) {
+        XJack* self = static_cast<XJack*>(arg);
+        self->active.store(false, std::memory_order_release);
+        std::cerr << "Error: the jack server shut down" << std::endl;
+    }
+};
+
+// the GUI check if the server is running
+inline PaError Pa_IsStreamActive(PaStream* stream) {
+    return stream && stream->isActive() ? 1 : 0;
+}
+
+#endif
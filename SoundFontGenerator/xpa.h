@@ -12,6 +12,8 @@
 
   silent the portaudio device probe messages
   connection preference is set to 1.) jackd, 2.) pulse audio, 3.) alsa 
+  the device, Sample Rate, period size and latency could be requested,
+  the values portaudio negotiated are reported when the stream is opened
 
 ****************************************************************/
 
@@ -25,6 +27,9 @@
 #include <cmath>
 #include <vector>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
 #include <unistd.h>
 #include <iostream>
 #include <sstream>
@@ -38,6 +43,16 @@
 
 class XPa {
 public:
+    // a output capable device
+    struct DeviceInfo {
+        int index;
+        std::string name;
+        std::string hostName;
+        int outputChannels;
+        uint32_t sampleRate;
+        double lowLatency;      // seconds
+        double highLatency;     // seconds
+    };
 
     XPa(const char* cname){
         #if defined(__linux__) || defined(__FreeBSD__) || \
@@ -45,92 +60,94 @@ public:
         PaJack_SetClientName (cname);
         #endif
         init();
+        stream = nullptr;
         SampleRate = 0;
+        requestedRate = 0;
+        period = 0;
+        requestedLatency = 0.0;
+        latency = 0.0;
+        device = paNoDevice;
+        ichannels = 0;
+        ochannels = 0;
+        callback = nullptr;
+        callbackArg = nullptr;
     };
 
     ~XPa(){Pa_Terminate();};
 
-    // open a audio stream for input/output channels and set the audio process callback
-    bool openStream(uint32_t ichannels, uint32_t ochannels, PaStreamCallback *process, void* arg) {
-        #if defined(__linux__) || defined(__FreeBSD__) || \
-            defined(__NetBSD__) || defined(__OpenBSD__)
-        std::vector<Devices> devices;
-        int d = Pa_GetDeviceCount();
-        const PaDeviceInfo *info;
-        for (int i = 0; i<d;i++) {
-            info = Pa_GetDeviceInfo(i);
-            if ((std::strcmp(info->name, "pulse") ==0) ||
-               (std::strcmp(info->name, "default") ==0) ||
-               (std::strcmp(info->name, "system") ==0)) {
-                Devices dev;
-                if (std::strcmp(info->name, "pulse") ==0) dev.order = 2; // pulse audio
-                if (std::strcmp(info->name, "default") ==0) dev.order = 3; // alsa
-                if (std::strcmp(info->name, "system") ==0) dev.order = 1; // jackd
-                dev.index = i;
-                dev.SampleRate = SampleRate = info->defaultSampleRate;
-                dev.Name = info->name;
-                snprintf(dev.hostName, 63,"%s", getHostName(info->hostApi));
-                devices.push_back(dev);
-            }
-            
-        }
-
-        std::sort(devices.begin(), devices.end(), 
-        [](Devices const &a, Devices const &b) {
-            return a.order < b.order; 
-        });
-        auto it = devices.begin();
-        PaStreamParameters inputParameters;
-        inputParameters.device = it->index;
-        inputParameters.channelCount = ichannels;
-        inputParameters.sampleFormat = paFloat32;
-        inputParameters.hostApiSpecificStreamInfo = nullptr;
-
-        PaStreamParameters outputParameters;
-        outputParameters.device = it->index;
-        outputParameters.channelCount = ochannels;
-        outputParameters.sampleFormat = paFloat32;
-        outputParameters.hostApiSpecificStreamInfo = nullptr;
+    // request a device by index or name ("name" or "host:name"),
+    // a empty string select the default device
+    void setDevice(const std::string& name) {
+        requestedDevice = name;
+    }
 
-        bool isAlsa = strcmp(it->hostName, "ALSA") == 0 ;
-        int frames = isAlsa ? 1024 : paFramesPerBufferUnspecified;
+    // request the frames per buffer, 0 = let the host decide
+    void setPeriod(uint32_t frames) {
+        period = frames;
+    }
 
-        err = Pa_OpenStream(&stream, ichannels ? &inputParameters : nullptr, 
-                            ochannels ? &outputParameters : nullptr, it->SampleRate,
-                            frames, paClipOff, process, arg);
+    // request a Sample Rate, 0 = the default rate of the device
+    void setSampleRate(uint32_t sr) {
+        requestedRate = sr;
+    }
 
-        if (isAlsa) std::cout << "using (" << it->Name << ") " << it->hostName 
-            << " with " << frames << " frames per buffer and " << it->SampleRate 
-            << "hz Sample Rate" << std::endl;
+    // request a output latency in seconds, 0 = the default latency of the device
+    void setLatency(double seconds) {
+        requestedLatency = seconds;
+    }
 
-        devices.clear();
-        #else
-        const PaDeviceInfo *info;
-        info = Pa_GetDeviceInfo(Pa_GetDefaultOutputDevice());
-        std::cout << "using (" << info->name << ") " << getHostName(info->hostApi) 
-            << " with " << info->defaultSampleRate << "hz Sample Rate" << std::endl;
+    // all devices with output channels
+    std::vector<DeviceInfo> getDevices() {
+        std::vector<DeviceInfo> devices;
+        int d = Pa_GetDeviceCount();
+        for (int i = 0; i < d; i++) {
+            const PaDeviceInfo *info = Pa_GetDeviceInfo(i);
+            if (!info || info->maxOutputChannels < 1) continue;
+            DeviceInfo dev;
+            dev.index = i;
+            dev.name = info->name;
+            dev.hostName = getHostName(info->hostApi);
+            dev.outputChannels = info->maxOutputChannels;
+            dev.sampleRate = (uint32_t)info->defaultSampleRate;
+            dev.lowLatency = info->defaultLowOutputLatency;
+            dev.highLatency = info->defaultHighOutputLatency;
+            devices.push_back(dev);
+        }
+        return devices;
+    }
 
-        PaStreamParameters inputParameters;
-        inputParameters.device = Pa_GetDefaultInputDevice();
-        inputParameters.channelCount = ichannels;
-        inputParameters.sampleFormat = paFloat32;
-        inputParameters.suggestedLatency = 0.050;
-        inputParameters.hostApiSpecificStreamInfo = nullptr;
+    // print the output devices
+    void listDevices() {
+        for (const auto& dev : getDevices()) {
+            std::cout << dev.index << ": " << dev.hostName << ":" << dev.name
+                << " (" << dev.outputChannels << " channels, " << dev.sampleRate
+                << "hz, latency " << dev.lowLatency * 1000.0 << " - "
+                << dev.highLatency * 1000.0 << " ms)" << std::endl;
+        }
+    }
 
-        PaStreamParameters outputParameters;
-        outputParameters.device = Pa_GetDefaultOutputDevice();
-        if (outputParameters.device == paNoDevice) return false;
-        outputParameters.channelCount = ochannels;
-        outputParameters.sampleFormat = paFloat32;
-        outputParameters.suggestedLatency = 0.050;
-        outputParameters.hostApiSpecificStreamInfo = nullptr;
-        SampleRate = info->defaultSampleRate;
-        err = Pa_OpenStream(&stream, ichannels ? &inputParameters : nullptr, 
-                            ochannels ? &outputParameters : nullptr, SampleRate,
-                            paFramesPerBufferUnspecified, paClipOff, process, arg);
-        #endif
+    // open a audio stream for input/output channels and set the audio process callback
+    bool openStream(uint32_t ichannels_, uint32_t ochannels_, PaStreamCallback *process, void* arg) {
+        ichannels = ichannels_;
+        ochannels = ochannels_;
+        callback = process;
+        callbackArg = arg;
+        PaDeviceIndex dev = paNoDevice;
+        if (!requestedDevice.empty()) {
+            dev = findDevice(requestedDevice);
+            if (dev == paNoDevice)
+                std::cerr << "Warning: device " << requestedDevice << " not found, use default" << std::endl;
+        }
+        if (dev == paNoDevice) dev = defaultDevice();
+        if (dev == paNoDevice) return false;
+        return openDevice(dev);
+    }
 
-        return err == paNoError ? true : false;
+    // close the running stream and open the device (index or name) instead
+    bool switchDevice(const std::string& name) {
+        stopStream();
+        setDevice(name);
+        return openStream(ichannels, ochannels, callback, callbackArg) && startStream();
     }
 
     // start the audio processing
@@ -149,33 +166,172 @@ public:
         return SampleRate;
     }
 
+    // the output latency negotiated by portaudio in seconds
+    double getLatency() {
+        return latency;
+    }
+
+    // the index of the opened device
+    int getDevice() {
+        return device;
+    }
+
     // stop the audio processing
     void stopStream() {
+        if (!stream) return;
         if (Pa_IsStreamActive(stream)) {
             err = Pa_StopStream(stream);
             if (err != paNoError) {
                 std::cerr << "PortAudio error: " << Pa_GetErrorText(err) << std::endl;
             }
-            err = Pa_CloseStream(stream);
-            if (err != paNoError) {
-                std::cerr << "PortAudio error: " << Pa_GetErrorText(err) << std::endl;
-            }
         }
+        err = Pa_CloseStream(stream);
+        if (err != paNoError) {
+            std::cerr << "PortAudio error: " << Pa_GetErrorText(err) << std::endl;
+        }
+        stream = nullptr;
     }
 
 private:
     PaStream* stream;
     PaError err;
     uint32_t SampleRate;
+    uint32_t requestedRate;
+    uint32_t period;
+    double requestedLatency;
+    double latency;
+    std::string requestedDevice;
+    PaDeviceIndex device;
+    uint32_t ichannels;
+    uint32_t ochannels;
+    PaStreamCallback *callback;
+    void* callbackArg;
 
     struct Devices {
         int order;
         int index;
-        std::string Name;
-        char hostName[64];
-        uint32_t SampleRate;
     };
 
+    // find a output device by index, "name" or "host:name"
+    PaDeviceIndex findDevice(const std::string& name) {
+        char* e = nullptr;
+        long i = std::strtol(name.c_str(), &e, 10);
+        const auto devices = getDevices();
+        if (e && *e == '\0' && e != name.c_str()) {
+            for (const auto& dev : devices) if (dev.index == i) return dev.index;
+            return paNoDevice;
+        }
+        for (const auto& dev : devices) {
+            if (dev.name == name || dev.hostName + ":" + dev.name == name) return dev.index;
+        }
+        return paNoDevice;
+    }
+
+    // connection preference is 1.) jackd, 2.) pulse audio, 3.) alsa
+    PaDeviceIndex defaultDevice() {
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        std::vector<Devices> devices;
+        int d = Pa_GetDeviceCount();
+        const PaDeviceInfo *info;
+        for (int i = 0; i<d;i++) {
+            info = Pa_GetDeviceInfo(i);
+            if ((std::strcmp(info->name, "pulse") ==0) ||
+               (std::strcmp(info->name, "default") ==0) ||
+               (std::strcmp(info->name, "system") ==0)) {
+                Devices dev;
+                if (std::strcmp(info->name, "pulse") ==0) dev.order = 2; // pulse audio
+                if (std::strcmp(info->name, "default") ==0) dev.order = 3; // alsa
+                if (std::strcmp(info->name, "system") ==0) dev.order = 1; // jackd
+                dev.index = i;
+                devices.push_back(dev);
+            }
+        }
+        if (!devices.empty()) {
+            std::sort(devices.begin(), devices.end(), 
+            [](Devices const &a, Devices const &b) {
+                return a.order < b.order; 
+            });
+            return devices.begin()->index;
+        }
+        #endif
+        return Pa_GetDefaultOutputDevice();
+    }
+
+    // open the stream with the requested rate, period and latency
+    // and report what portaudio made out of it
+    bool openDevice(PaDeviceIndex dev) {
+        const PaDeviceInfo *info = Pa_GetDeviceInfo(dev);
+        if (!info) return false;
+        const char* hostName = getHostName(info->hostApi);
+
+        PaStreamParameters inputParameters;
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        inputParameters.device = dev;
+        #else
+        inputParameters.device = Pa_GetDefaultInputDevice();
+        #endif
+        inputParameters.channelCount = ichannels;
+        inputParameters.sampleFormat = paFloat32;
+        inputParameters.suggestedLatency = requestedLatency > 0.0 ? requestedLatency : 0.050;
+        inputParameters.hostApiSpecificStreamInfo = nullptr;
+
+        PaStreamParameters outputParameters;
+        outputParameters.device = dev;
+        outputParameters.channelCount = ochannels;
+        outputParameters.sampleFormat = paFloat32;
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        outputParameters.suggestedLatency = requestedLatency > 0.0 ? requestedLatency :
+                                                    info->defaultHighOutputLatency;
+        #else
+        outputParameters.suggestedLatency = requestedLatency > 0.0 ? requestedLatency : 0.050;
+        #endif
+        outputParameters.hostApiSpecificStreamInfo = nullptr;
+
+        double sr = info->defaultSampleRate;
+        if (requestedRate) {
+            if (Pa_IsFormatSupported(ichannels ? &inputParameters : nullptr,
+                    ochannels ? &outputParameters : nullptr, requestedRate) == paFormatIsSupported) {
+                sr = requestedRate;
+            } else {
+                std::cerr << "Warning: " << requestedRate << "hz Sample Rate not supported by "
+                    << info->name << ", use " << sr << "hz" << std::endl;
+            }
+        }
+
+        unsigned long frames = paFramesPerBufferUnspecified;
+        if (period) frames = period;
+        #if defined(__linux__) || defined(__FreeBSD__) || \
+            defined(__NetBSD__) || defined(__OpenBSD__)
+        else if (strcmp(hostName, "ALSA") == 0) frames = 1024;
+        #endif
+
+        err = Pa_OpenStream(&stream, ichannels ? &inputParameters : nullptr, 
+                            ochannels ? &outputParameters : nullptr, sr,
+                            frames, paClipOff, callback, callbackArg);
+        if (err != paNoError) {
+            std::cerr << "PortAudio error: " << Pa_GetErrorText(err) << std::endl;
+            stream = nullptr;
+            return false;
+        }
+        device = dev;
+        SampleRate = sr;
+        latency = outputParameters.suggestedLatency;
+        const PaStreamInfo *sinfo = Pa_GetStreamInfo(stream);
+        if (sinfo) {
+            SampleRate = sinfo->sampleRate;
+            latency = sinfo->outputLatency;
+        }
+
+        std::cout << "using (" << info->name << ") " << hostName;
+        if (frames != paFramesPerBufferUnspecified) std::cout << " with " << frames << " frames per buffer,";
+        std::cout << " " << SampleRate << "hz Sample Rate and " << latency * 1000.0
+            << " ms output latency" << std::endl;
+        return true;
+    }
+
     const char* getHostName(unsigned int index){
         const PaHostApiInfo* info;
         uint32_t apicount =  Pa_GetHostApiCount();
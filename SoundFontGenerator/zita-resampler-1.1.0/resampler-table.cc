@@ -1,6 +1,10 @@
 // ----------------------------------------------------------------------------
 //
 //  Copyright (C) 2006-2012 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  Modified for sf2generate: unused tables stay resident in a bounded
+//  LRU, lock free lookup and the table generation without trig calls
+//  in the inner loop.
 //    
 //  This program is free software; you can redistribute it and/or modify
 //  it under the terms of the GNU General Public License as published by
@@ -37,52 +41,89 @@ int zita_resampler_minor_version (void)
 }
 
 
-static double sinc (double x)
-{
-    x = fabs (x);
-    if (x < 1e-6) return 1.0;
-    x *= M_PI;
-    return sin (x) / x;
-}
-
-
-static double wind (double x)
-{
-    x = fabs (x);
-    if (x >= 1.0) return 0.0f;
-    x *= M_PI;
-    return 0.384 + 0.500 * cos (x) + 0.116 * cos (2 * x);
-}
-
+// A table stay resident when its last user leave, so a resampler set
+// up again for the same rates (the next file of a batch) find it ready.
+// The unused tables are bounded by IDLE_BYTES, beyond that the one
+// unused for the longest time is dropped (the daemon could be asked
+// for any rate pair, each one would pin a table otherwise).
+//
+// create() search the list without a lock. A table is taken by a CAS
+// on _refc, which fail once trim() marked it DEAD. trim() unlink dead
+// tables under the mutex, but a reader which started before could
+// still walk over them, so they are only freed by reclaim() once no
+// lock free search is running (_readers is 0) after the unlink.
 
 
-Resampler_table  *Resampler_table::_list = 0;
+std::atomic<Resampler_table *> Resampler_table::_list (0);
+std::atomic<unsigned int> Resampler_table::_readers (0);
+Resampler_table  *Resampler_table::_retired_list = 0;
+std::atomic<unsigned long> Resampler_table::_clock (0);
 Resampler_mutex   Resampler_table::_mutex;
 
 
+// The table hold fr * sinc (t * fr) * wind (t / hl) for the np + 1 phases
+// t = j / np + i, i = 0 .. hl - 1. The phases are computed side by side,
+// sin (pi * fr * t) and the two cosines of the window advance by a fixed
+// angle per tap, so the recurrence y [i+1] = 2 cos (w) y [i] - y [i-1]
+// replace the trig calls and the loop over the phases vectorize.
+
 Resampler_table::Resampler_table (double fr, unsigned int hl, unsigned int np) :
     _next (0),
     _refc (0),
     _fr (fr),
     _hl (hl),
-    _np (np)
+    _np (np),
+    _stamp (0),
+    _retired (0)
 {
-    unsigned int  i, j;
-    double        t;
+    unsigned int  i, j, n;
+    double        a, w, ws, wc1, wc2;
+    double        *S0, *S1, *C0, *C1, *D0, *D1, *T;
     float         *p;
 
-    _ctab = new float [hl * (np + 1)];
-    p = _ctab;
-    for (j = 0; j <= np; j++)
+    n = np + 1;
+    _ctab = new float [hl * n];
+    T = new double [7 * n];
+    S0 = T + n;  S1 = S0 + n;
+    C0 = S1 + n; C1 = C0 + n;
+    D0 = C1 + n; D1 = D0 + n;
+    ws = M_PI * fr;
+    w = M_PI / hl;
+    for (j = 0; j < n; j++)
+    {
+	T [j] = (double) j / (double) np;
+	a = T [j];
+	// values at tap -1 and tap 0
+	S0 [j] = sin ((a - 1) * ws);
+	S1 [j] = sin (a * ws);
+	C0 [j] = cos ((a - 1) * w);
+	C1 [j] = cos (a * w);
+	D0 [j] = cos (2 * (a - 1) * w);
+	D1 [j] = cos (2 * a * w);
+    }
+    wc1 = 2 * cos (ws);
+    wc2 = 2 * cos (w);
+    w = 2 * cos (2 * w);
+    for (i = 0; i < hl; i++)
     {
-	t = (double) j / (double) np;
-	for (i = 0; i < hl; i++)
+	p = _ctab + hl - i - 1;
+	for (j = 0; j < n; j++)
 	{
-	    p [hl - i - 1] = (float)(fr * sinc (t * fr) * wind (t / hl));
-	    t += 1;
+	    double s, c, d, x;
+	    x = (T [j] + i) * ws;
+	    p [j * hl] = (float)(fr * (S1 [j] / x) * (0.384 + 0.500 * C1 [j] + 0.116 * D1 [j]));
+	    s = wc1 * S1 [j] - S0 [j];
+	    c = wc2 * C1 [j] - C0 [j];
+	    d = w * D1 [j] - D0 [j];
+	    S0 [j] = S1 [j];  S1 [j] = s;
+	    C0 [j] = C1 [j];  C1 [j] = c;
+	    D0 [j] = D1 [j];  D1 [j] = d;
 	}
-	p += hl;
     }
+    // sinc (0) and the end of the window
+    _ctab [hl - 1] = (float) fr;
+    _ctab [np * hl] = 0.0f;
+    delete[] T;
 }
 
 
@@ -92,26 +133,55 @@ Resampler_table::~Resampler_table (void)
 }
 
 
+static inline bool match (double fr, unsigned int hl, unsigned int np,
+                          double pfr, unsigned int phl, unsigned int pnp)
+{
+    return (fr >= pfr * 0.999) && (fr <= pfr * 1.001) && (hl == phl) && (np == pnp);
+}
+
+
+bool Resampler_table::take (Resampler_table *T)
+{
+    unsigned int r = T->_refc.load (std::memory_order_relaxed);
+
+    while (!(r & DEAD))
+    {
+	if (T->_refc.compare_exchange_weak (r, r + 1, std::memory_order_acquire)) return true;
+    }
+    return false;
+}
+
+
 Resampler_table *Resampler_table::create (double fr, unsigned int hl, unsigned int np)
 {
     Resampler_table *P;
 
+    // lock free lookup, the entries are immutable once published
+    _readers.fetch_add (1);
+    for (P = _list.load (); P; P = P->_next.load ())
+    {
+	if (match (fr, hl, np, P->_fr, P->_hl, P->_np) && take (P))
+	{
+	    _readers.fetch_sub (1);
+	    return P;
+	}
+    }
+    _readers.fetch_sub (1);
     _mutex.lock ();
-    P = _list;
-    while (P)
+    // search again, it could have been added since the first look
+    for (P = _list.load (); P; P = P->_next.load ())
     {
-	if ((fr >= P->_fr * 0.999) && (fr <= P->_fr * 1.001) && (hl == P->_hl) && (np == P->_np))
+	if (match (fr, hl, np, P->_fr, P->_hl, P->_np) && take (P))
 	{
-	    P->_refc++;
-            _mutex.unlock ();
-            return P;
+	    _mutex.unlock ();
+	    return P;
 	}
-	P = P->_next;
     }
     P = new Resampler_table (fr, hl, np);
-    P->_refc = 1;
-    P->_next = _list;
-    _list = P;
+    P->_refc.store (1, std::memory_order_relaxed);
+    P->_next.store (_list.load ());
+    _list.store (P);
+    reclaim ();
     _mutex.unlock ();
     return P;
 }
@@ -119,31 +189,66 @@ Resampler_table *Resampler_table::create (double fr, unsigned int hl, unsigned i
 
 void Resampler_table::destroy (Resampler_table *T)
 {
-    Resampler_table *P, *Q;
-
+    if (!T) return;
+    // stamp it while the reference is held, once _refc is 0 trim()
+    // in a other thread could free it
+    T->_stamp.store (_clock.fetch_add (1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (T->_refc.fetch_sub (1, std::memory_order_release) != 1) return;
+    // the last user left, the table stay resident as long as it fit
     _mutex.lock ();
-    if (T)
+    trim ();
+    reclaim ();
+    _mutex.unlock ();
+}
+
+
+// drop the least recently used unused tables until they fit in
+// IDLE_BYTES, called with the mutex held
+void Resampler_table::trim (void)
+{
+    Resampler_table *P, *Q, *prev, *prevQ;
+    size_t          idle;
+
+    while (true)
     {
-	T->_refc--;
-	if (T->_refc == 0)
+	idle = 0;
+	Q = prevQ = 0;
+	prev = 0;
+	for (P = _list.load (); P; prev = P, P = P->_next.load ())
 	{
-	    P = _list;
-	    Q = 0;
-	    while (P)
+	    if (P->_refc.load (std::memory_order_relaxed)) continue;
+	    idle += P->bytes ();
+	    if (!Q || P->_stamp.load (std::memory_order_relaxed) < Q->_stamp.load (std::memory_order_relaxed))
 	    {
-		if (P == T)
-		{
-		    if (Q) Q->_next = T->_next;
-		    else      _list = T->_next;
-		    break;
-		}
 		Q = P;
-		P = P->_next;
+		prevQ = prev;
 	    }
-	    delete T;
 	}
+	if (idle <= IDLE_BYTES) return;
+	unsigned int r = 0;
+	// a lock free reader could take it right now, then look again
+	if (!Q->_refc.compare_exchange_strong (r, DEAD, std::memory_order_acquire)) continue;
+	if (prevQ) prevQ->_next.store (Q->_next.load ());
+	else _list.store (Q->_next.load ());
+	Q->_retired = _retired_list;
+	_retired_list = Q;
+    }
+}
+
+
+// free the unlinked tables once no lock free search could still
+// see them, called with the mutex held
+void Resampler_table::reclaim (void)
+{
+    Resampler_table *P;
+
+    if (!_retired_list || _readers.load ()) return;
+    while (_retired_list)
+    {
+	P = _retired_list;
+	_retired_list = P->_retired;
+	delete P;
     }
-    _mutex.unlock ();
 }
 
 
@@ -151,11 +256,13 @@ void Resampler_table::print_list (void)
 {
     Resampler_table *P;
 
+    _mutex.lock ();
     printf ("Resampler table\n----\n");
-    for (P = _list; P; P = P->_next)
+    for (P = _list.load (); P; P = P->_next.load ())
     {
-	printf ("refc = %3d   fr = %10.6lf  hl = %4d  np = %4d\n", P->_refc, P->_fr, P->_hl, P->_np);
+	printf ("refc = %3d   fr = %10.6lf  hl = %4d  np = %4d\n", P->_refc.load (), P->_fr, P->_hl, P->_np);
     }
     printf ("----\n\n");
+    _mutex.unlock ();
 }
 
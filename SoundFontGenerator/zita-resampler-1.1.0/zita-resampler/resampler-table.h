@@ -1,6 +1,9 @@
 // ----------------------------------------------------------------------------
 //
 //  Copyright (C) 2006-2012 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  Modified for sf2generate: the tables stay resident, lock free lookup
+//  and the table generation without trig calls in the inner loop.
 //    
 //  This program is free software; you can redistribute it and/or modify
 //  it under the terms of the GNU General Public License as published by
@@ -23,6 +26,8 @@
 
 
 #include <pthread.h>
+#include <stddef.h>
+#include <atomic>
 
 
 #define ZITA_RESAMPLER_MAJOR_VERSION 1
@@ -62,17 +67,32 @@ private:
     friend class Resampler;
     friend class VResampler;
 
-    Resampler_table     *_next;
-    unsigned int         _refc;
+    std::atomic<Resampler_table *> _next;
+    std::atomic<unsigned int> _refc;
     float               *_ctab;
     double               _fr;
     unsigned int         _hl;
     unsigned int         _np;
+    std::atomic<unsigned long> _stamp;  // when a user left, for the LRU
+    Resampler_table     *_retired;  // the next table waiting to be freed
+
+    // set in _refc once the table is unlinked, it can't be taken again
+    static const unsigned int DEAD = 0x80000000u;
+    // bytes the unused tables could hold before the oldest get freed
+    static const size_t IDLE_BYTES = 32 * 1024 * 1024;
+
+    size_t bytes (void) const { return sizeof (float) * _hl * (_np + 1); }
 
     static Resampler_table *create (double fr, unsigned int hl, unsigned int np);
     static void destroy (Resampler_table *T);
-
-    static Resampler_table  *_list;
+    static bool take (Resampler_table *T);
+    static void trim (void);
+    static void reclaim (void);
+
+    static std::atomic<Resampler_table *> _list;
+    static std::atomic<unsigned int> _readers;
+    static Resampler_table  *_retired_list;
+    static std::atomic<unsigned long> _clock;
     static Resampler_mutex   _mutex;
 };
 